@@ -1,10 +1,37 @@
 const std = @import("std");
 
+/// Compile flags shared by the library and the test programs, the feature
+/// defines change struct layouts so both sides must agree.
+fn cFlags(
+    b: *std.Build,
+    target: std.Build.ResolvedTarget,
+    use_ssl: bool,
+    use_io_uring: bool,
+    disable_simd: bool,
+) []const []const u8 {
+    const web_target = (target.result.cpu.arch == .wasm32 or target.result.cpu.arch == .wasm64);
+    const ssl_flag: []const u8 = if (use_ssl and !web_target) "-DWEBC_USE_SSL=1" else "";
+    const io_uring_flag: []const u8 = if (use_io_uring and !web_target) "-DWEBC_USE_IO_URING=1" else "";
+    const simd_flag: []const u8 = if (disable_simd) "-DDISABLE_SIMD=1" else "-march=native";
+    const emscripten_flag: []const u8 = if (web_target) "-D__EMSCRIPTEN__=1" else "";
+    return b.allocator.dupe([]const u8, &.{
+        "-Wall",
+        "-Wextra",
+        "-O2",
+        "-std=gnu11",
+        ssl_flag,
+        io_uring_flag,
+        simd_flag,
+        emscripten_flag,
+    }) catch @panic("OOM");
+}
+
 fn createModule(
     b: *std.Build,
     optimize: std.builtin.OptimizeMode,
     target: std.Build.ResolvedTarget,
     use_ssl: bool,
+    use_io_uring: bool,
     disable_simd: bool,
 ) *std.Build.Module {
     const web_target = (target.result.cpu.arch == .wasm32 or target.result.cpu.arch == .wasm64);
@@ -16,19 +43,14 @@ fn createModule(
         "src/reader.c",
         "src/protocol.c",
         "src/encode.c",
+        "src/loop.c",
+        "src/dns.c",
+        "src/standby.c",
+        "src/tls.c",
+        "src/handshake.c",
+        "src/server.c",
     };
-    const ssl_flag: []const u8 = if (use_ssl and !web_target) "-DWEBC_USE_SSL=1" else "";
-    const simd_flag: []const u8 = if (disable_simd) "-DDISABLE_SIMD=1" else "-march=native";
-    const emscripten_flag: []const u8 = if (web_target) "-D__EMSCRIPTEN__=1" else "";
-    const flags: []const []const u8 = &.{
-        "-Wall",
-        "-Wextra",
-        "-O2",
-        "-std=gnu11",
-        ssl_flag,
-        simd_flag,
-        emscripten_flag,
-    };
+    const flags = cFlags(b, target, use_ssl, use_io_uring, disable_simd);
     const module = b.addModule("ws", .{
         .pic = true,
         .target = target,
@@ -38,6 +60,12 @@ fn createModule(
         module.addLibraryPath(.{ .cwd_relative = "/usr/lib/x86_64-linux-gnu" });
         module.linkSystemLibrary("openssl", .{ .needed = use_ssl });
     }
+    if (!web_target) {
+        module.linkSystemLibrary("pthread", .{});
+    }
+    if (use_io_uring and !web_target) {
+        module.linkSystemLibrary("uring", .{ .needed = use_io_uring });
+    }
     module.addCSourceFiles(.{
         .language = .c,
         .files = files,
@@ -54,12 +82,13 @@ fn createModule(
 pub fn build(b: *std.Build) void {
     const optimize = b.standardOptimizeOption(.{});
     const use_ssl = b.option(bool, "use_ssl", "Use OpenSSL for WebSocket Secure support.") orelse false;
+    const use_io_uring = b.option(bool, "use_io_uring", "Use io_uring for the event loop when the kernel supports it.") orelse false;
     const disable_simd = b.option(bool, "disable_simd", "Disable SIMD instructions.") orelse false;
     //const webTarget = b.resolveTargetQuery(.{ .cpu_arch = .wasm32, .os_tag = .freestanding });
     //const webLib = b.addLibrary(.{
     //    .name = "webws",
     //    .linkage = .static,
-    //    .root_module = createModule(b, optimize, webTarget, use_ssl, disable_simd),
+    //    .root_module = createModule(b, optimize, webTarget, use_ssl, use_io_uring, disable_simd),
     //    .use_llvm = true,
     //});
     //b.installArtifact(webLib);
@@ -68,7 +97,48 @@ pub fn build(b: *std.Build) void {
     const nativeLib = b.addLibrary(.{
         .name = "ws",
         .linkage = linkage,
-        .root_module = createModule(b, optimize, nativeTarget, use_ssl, disable_simd),
+        .root_module = createModule(b, optimize, nativeTarget, use_ssl, use_io_uring, disable_simd),
     });
     b.installArtifact(nativeLib);
+
+    // zig build test: every program in tests/ links the library and exits
+    // non-zero when a check fails.
+    const test_files: []const []const u8 = &.{
+        "tests/dns_test.c",
+        "tests/encode_test.c",
+        "tests/handshake_test.c",
+        "tests/http_test.c",
+        "tests/loop_test.c",
+        "tests/net_test.c",
+        "tests/protocol_test.c",
+        "tests/standby_test.c",
+        "tests/tls_test.c",
+        "tests/websocket_test.c",
+    };
+    const test_step = b.step("test", "Build and run the C tests");
+    for (test_files) |file| {
+        const test_module = b.createModule(.{
+            .target = nativeTarget,
+            .optimize = optimize,
+            .link_libc = true,
+        });
+        test_module.addCSourceFiles(.{
+            .language = .c,
+            .files = &.{file},
+            .flags = cFlags(b, nativeTarget, use_ssl, use_io_uring, disable_simd),
+        });
+        test_module.addIncludePath(b.path("."));
+        test_module.addIncludePath(b.path("./deps/cstd/headers/"));
+        test_module.addIncludePath(b.path("./deps/cstd/deps/utf8-zig/headers/"));
+        test_module.addLibraryPath(b.path("./deps/cstd/lib"));
+        test_module.addLibraryPath(b.path("./deps/cstd/deps/utf8-zig/zig-out/lib/"));
+        test_module.linkSystemLibrary("custom_std", .{});
+        test_module.linkSystemLibrary("utf8-zig", .{});
+        test_module.linkLibrary(nativeLib);
+        const test_exe = b.addExecutable(.{
+            .name = std.fs.path.stem(file),
+            .root_module = test_module,
+        });
+        test_step.dependOn(&b.addRunArtifact(test_exe).step);
+    }
 }
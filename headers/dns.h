@@ -0,0 +1,137 @@
+#ifndef CSTD_WEBSOCKET_DNS_H
+#define CSTD_WEBSOCKET_DNS_H
+
+/**
+ * Host name resolution shared by every connection.
+ *
+ * Results are kept in a small in-process cache for DNS_CACHE_TTL_MS so
+ * reconnecting many clients to the same host only resolves it once.
+ * getaddrinfo doesn't expose record TTLs so every entry lives for the same
+ * configurable time.
+ *
+ * dns_resolve_async resolves on a helper thread so callers like an event
+ * loop never block on the resolver.
+ */
+
+#include "defs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+__BEGIN_DECLS
+
+/**
+ * Default time in milliseconds a resolved address list is reused.
+ */
+#define DNS_CACHE_TTL_MS 30000
+
+/**
+ * Max number of host/port pairs in the cache.
+ */
+#define DNS_CACHE_SIZE 64
+
+/**
+ * Max number of addresses kept per host.
+ */
+#define DNS_MAX_ADDRS 16
+
+/**
+ * A single resolved address.
+ */
+struct dns_addr_t {
+  int family;
+  int socktype;
+  int protocol;
+  socklen_t addr_len;
+  struct sockaddr_storage addr;
+};
+
+/**
+ * Resolved addresses of a host in the resolver's preferred order.
+ */
+struct dns_result_t {
+  size_t len;
+  struct dns_addr_t addrs[DNS_MAX_ADDRS];
+};
+
+/**
+ * Callback definition for an asynchronous resolve.
+ * Called on the resolver thread, or on the thread calling dns_shutdown for
+ * requests it dropped.
+ *
+ * @param[in] result The resolved addresses, NULL if the lookup failed.
+ * @param[in] context User supplied data.
+ */
+typedef void(dns_callback)(const struct dns_result_t *result, void *context);
+
+/**
+ * Resolve the host/port to stream socket addresses.
+ * Uses the cache when possible, otherwise blocks on getaddrinfo and caches
+ * the result. Concurrent calls for the same host/port share one getaddrinfo
+ * call, later callers wait for the first one's result.
+ *
+ * @param[in] host The hostname.
+ * @param[in] port The port number.
+ * @param[out] out The resolved addresses.
+ * @return True on success, false otherwise.
+ */
+bool dns_resolve(const char *restrict host, const char *restrict port,
+                 struct dns_result_t *out) __nonnull((1, 2, 3));
+
+/**
+ * Resolve the host/port on the resolver thread.
+ * The thread is started on first use. Requests for the same host that queue
+ * up behind each other are answered from the cache after the first one.
+ *
+ * @param[in] host The hostname.
+ * @param[in] port The port number.
+ * @param[in] cb The callback to receive the result.
+ * @param[in] context The user supplied data.
+ * @return True if the request was queued, false otherwise.
+ */
+bool dns_resolve_async(const char *restrict host, const char *restrict port,
+                       dns_callback cb, void *context) __nonnull((1, 2, 3));
+
+/**
+ * Look up the host/port in the cache only.
+ *
+ * @param[in] host The hostname.
+ * @param[in] port The port number.
+ * @param[out] out The cached addresses.
+ * @return True if a live entry was found, false otherwise.
+ */
+bool dns_cache_lookup(const char *restrict host, const char *restrict port,
+                      struct dns_result_t *out) __nonnull((1, 2, 3));
+
+/**
+ * Set how long resolved addresses are reused, 0 disables the cache.
+ *
+ * @param[in] ttl_ms The time to live in milliseconds.
+ */
+void dns_cache_set_ttl(unsigned int ttl_ms);
+
+/**
+ * Drop every cached entry, e.g. after a failover.
+ */
+void dns_cache_clear();
+
+/**
+ * Drop the cached addresses of one host/port, e.g. after none of them
+ * could be connected.
+ *
+ * @param[in] host The hostname.
+ * @param[in] port The port number.
+ */
+void dns_cache_remove(const char *restrict host, const char *restrict port)
+    __nonnull((1, 2));
+
+/**
+ * Stop the resolver thread and drop pending requests, their callbacks get a
+ * NULL result. dns_resolve_async fails while the shutdown is in progress.
+ */
+void dns_shutdown();
+
+__END_DECLS
+
+#endif
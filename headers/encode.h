@@ -9,6 +9,26 @@
 
 __BEGIN_DECLS
 
+/**
+ * Byte length of a SHA-1 digest.
+ */
+#define SHA1_DIGEST_LEN 20
+
+/**
+ * Length of the base64 string for n input bytes (excluding null terminator).
+ */
+#define BASE64_ENCODE_LEN(n) ((((n) + 2) / 3) * 4)
+
+/**
+ * Max length of the decoded bytes for a base64 string of n characters.
+ */
+#define BASE64_DECODE_LEN(n) (((n) / 4) * 3)
+
+/**
+ * Length of the Sec-WebSocket-Accept value (base64 of a SHA-1 digest).
+ */
+#define WS_ACCEPT_NOONCE_LEN BASE64_ENCODE_LEN(SHA1_DIGEST_LEN)
+
 /**
  * Generate base64 string from the given buffer.
  * The caller is responsible for freeing the returned string.
@@ -21,6 +41,60 @@ __BEGIN_DECLS
 char *base64_encode(uint8_t *buf, size_t len, size_t *output_length)
     __nonnull((3));
 
+/**
+ * Encode the given buffer as base64 into the caller supplied output buffer.
+ * The output is null-terminated so out_len must be at least
+ * BASE64_ENCODE_LEN(len) + 1.
+ *
+ * @param[in] buf The input buffer.
+ * @param[in] len The length of the input buffer.
+ * @param[out] out The output buffer.
+ * @param[in] out_len The length of the output buffer.
+ * @return The length of the base64 string, 0 on failure.
+ */
+size_t base64_encode_buf(const uint8_t *restrict buf, size_t len,
+                         char *restrict out, size_t out_len)
+    __nonnull((1, 3));
+
+/**
+ * Decode the given base64 string into the caller supplied output buffer.
+ * out_len must be at least BASE64_DECODE_LEN(len).
+ *
+ * @param[in] str The base64 string.
+ * @param[in] len The length of the base64 string, must be a multiple of 4.
+ * @param[out] out The output buffer.
+ * @param[in] out_len The length of the output buffer.
+ * @return The number of decoded bytes, 0 on failure or invalid input.
+ */
+size_t base64_decode_buf(const char *restrict str, size_t len,
+                         uint8_t *restrict out, size_t out_len)
+    __nonnull((1, 3));
+
+/**
+ * Generate the SHA-1 digest of the given buffer.
+ *
+ * @param[in] buf The input buffer.
+ * @param[in] len The length of the input buffer.
+ * @param[out] digest The digest to populate.
+ */
+void sha1_digest(const uint8_t *buf, size_t len,
+                 uint8_t digest[SHA1_DIGEST_LEN]) __nonnull((3));
+
+/**
+ * Generate the Sec-WebSocket-Accept value for the given Sec-WebSocket-Key.
+ * The output is null-terminated so out_len must be at least
+ * WS_ACCEPT_NOONCE_LEN + 1.
+ *
+ * @param[in] key The base64 encoded key sent by the client.
+ * @param[in] key_len The length of the key.
+ * @param[out] out The output buffer.
+ * @param[in] out_len The length of the output buffer.
+ * @return The length of the accept value, 0 on failure.
+ */
+size_t generate_accept_noonce(const char *restrict key, size_t key_len,
+                              char *restrict out, size_t out_len)
+    __nonnull((1, 3));
+
 /**
  * Check the response noonce with the given buffer.
  *
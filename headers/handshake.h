@@ -0,0 +1,146 @@
+#ifndef CSTD_WEBSOCKET_HANDSHAKE_H
+#define CSTD_WEBSOCKET_HANDSHAKE_H
+
+/**
+ * Bounded pool of worker threads running connection handshakes.
+ *
+ * Client connects (DNS, TCP, TLS and the upgrade) and server TLS handshakes
+ * are CPU heavy. During a mass reconnect they would stall the thread
+ * serving traffic, the pool runs them on its own threads instead. Finished
+ * connections are handed back on the I/O thread: poll ws_handshake_pool_fd
+ * and call ws_handshake_pool_dispatch, which runs the callbacks.
+ */
+
+#include "defs.h"
+#include "net.h"
+#include "websocket.h"
+
+#include <stdbool.h>
+
+__BEGIN_DECLS
+
+/**
+ * Default number of worker threads.
+ */
+#define WS_HANDSHAKE_POOL_THREADS 2
+
+/**
+ * Default max number of handshakes waiting for a worker.
+ */
+#define WS_HANDSHAKE_POOL_MAX_QUEUED 1024
+
+/**
+ * Handshake pool structure.
+ */
+struct ws_handshake_pool_t;
+
+/**
+ * Callback definition for a finished client connect, run by
+ * ws_handshake_pool_dispatch. The callback owns the client again.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] ok True if the client is connected, false otherwise.
+ * @param[in] context User supplied data.
+ */
+typedef void(on_connected_callback)(struct ws_client_t *client, bool ok,
+                                    void *context);
+
+/**
+ * Create a handshake pool and start its worker threads.
+ * Free with ws_handshake_pool_destroy.
+ *
+ * @param[in] threads The number of worker threads, 0 for
+ *  WS_HANDSHAKE_POOL_THREADS.
+ * @param[in] max_queued The max number of handshakes waiting for a worker,
+ *  0 for WS_HANDSHAKE_POOL_MAX_QUEUED.
+ * @return The handshake pool, NULL on failure.
+ */
+struct ws_handshake_pool_t *ws_handshake_pool_create(unsigned int threads,
+                                                     unsigned int max_queued);
+
+/**
+ * Connect the client (ws_client_connect) on a worker thread.
+ * The client must not be used until its callback runs.
+ *
+ * @param[in] pool The handshake pool.
+ * @param[in] client The initialized WebSocket client.
+ * @param[in] cb The callback once the connect finished.
+ * @param[in] context The user supplied data passed to the callback.
+ * @return True if queued, false if the queue is full or on failure.
+ */
+bool ws_handshake_pool_connect(struct ws_handshake_pool_t *pool,
+                               struct ws_client_t *client,
+                               on_connected_callback cb, void *context)
+    __nonnull((1, 2, 3));
+
+#ifdef WEBC_USE_SSL
+/**
+ * Callback definition for a finished server handshake, run by
+ * ws_handshake_pool_dispatch. The callback owns the connection again and
+ * closes it on failure.
+ *
+ * @param[in] info The accepted connection.
+ * @param[in] ok True if the handshake succeeded, false otherwise.
+ * @param[in] context User supplied data.
+ */
+typedef void(on_accepted_callback)(struct net_info_t *info, bool ok,
+                                   void *context);
+
+/**
+ * Run the server TLS handshake (net_handshake) of a connection accepted by
+ * a listener with defer_handshake on a worker thread.
+ *
+ * @param[in] pool The handshake pool.
+ * @param[in] info The accepted connection, copied into the pool.
+ * @param[in] timeout_ms Max time for the handshake, 0 waits forever.
+ * @param[in] cb The callback once the handshake finished.
+ * @param[in] context The user supplied data passed to the callback.
+ * @return True if queued, false if the queue is full or on failure.
+ */
+bool ws_handshake_pool_accept(struct ws_handshake_pool_t *pool,
+                              const struct net_info_t *info,
+                              unsigned int timeout_ms, on_accepted_callback cb,
+                              void *context) __nonnull((1, 2, 4));
+#endif
+
+/**
+ * Get the file descriptor that becomes readable when finished handshakes
+ * are waiting for ws_handshake_pool_dispatch, e.g. to add it to poll/epoll.
+ *
+ * @param[in] pool The handshake pool.
+ * @return The file descriptor.
+ */
+int ws_handshake_pool_fd(struct ws_handshake_pool_t *pool) __nonnull((1));
+
+/**
+ * Run the callbacks of every finished handshake on the calling thread.
+ *
+ * @param[in] pool The handshake pool.
+ * @return The number of callbacks run.
+ */
+unsigned int ws_handshake_pool_dispatch(struct ws_handshake_pool_t *pool)
+    __nonnull((1));
+
+/**
+ * Get the number of handshakes queued or running.
+ *
+ * @param[in] pool The handshake pool.
+ * @return The number of handshakes not finished yet.
+ */
+unsigned int ws_handshake_pool_pending(struct ws_handshake_pool_t *pool)
+    __nonnull((1));
+
+/**
+ * Stop the workers and free the handshake pool.
+ * Running handshakes finish first. Callbacks of finished handshakes run and
+ * queued ones get theirs with ok set to false, so ownership of every
+ * connection goes back to the caller.
+ * The handshake pool is automatically NULL'ed out.
+ *
+ * @param[in] pool The handshake pool.
+ */
+void ws_handshake_pool_destroy(struct ws_handshake_pool_t **pool);
+
+__END_DECLS
+
+#endif
@@ -100,6 +100,74 @@ struct http_request_t {
   struct http_message_t message;
 };
 
+/**
+ * Offset and length of a value inside of a parsed buffer.
+ */
+struct http_span_t {
+  uint32_t offset;
+  uint32_t len;
+};
+
+/**
+ * Result of parsing a HTTP message in place.
+ */
+enum http_parse_result_t {
+  HTTP_PARSE_OK = 0,
+  /**
+   * The end of the header section has not been received yet.
+   */
+  HTTP_PARSE_INCOMPLETE,
+  /**
+   * The message is malformed or is not a valid WebSocket upgrade.
+   */
+  HTTP_PARSE_INVALID,
+};
+
+/**
+ * WebSocket upgrade request parsed in place.
+ * All spans point into the buffer given to http_upgrade_request_parse, so the
+ * buffer must outlive this structure. Missing headers have a zero length.
+ */
+struct http_upgrade_request_t {
+  /**
+   * Method of the request. Only GET is valid for an upgrade.
+   */
+  enum http_method_t method;
+  /**
+   * The request target. (i.e. /ws)
+   */
+  struct http_span_t path;
+  /**
+   * Protocol of the request. (i.e. HTTP/1.1)
+   */
+  struct http_span_t protocol;
+  /**
+   * The Host header.
+   */
+  struct http_span_t host;
+  /**
+   * The Sec-WebSocket-Key header.
+   */
+  struct http_span_t key;
+  /**
+   * The Sec-WebSocket-Version header.
+   */
+  struct http_span_t version;
+  /**
+   * The Sec-WebSocket-Protocol header.
+   */
+  struct http_span_t ws_protocol;
+  /**
+   * The Sec-WebSocket-Extensions header.
+   */
+  struct http_span_t extensions;
+  /**
+   * The length of the request line and headers, including the final empty
+   * line. Any bytes after this belong to the WebSocket stream.
+   */
+  size_t header_len;
+};
+
 /// HTTP Message functions.
 
 /**
@@ -266,6 +334,23 @@ bool http_request_write(struct http_request_t *r, const uint8_t *buf,
  */
 void http_request_free(struct http_request_t *r);
 
+/// HTTP Upgrade Request functions.
+
+/**
+ * Parse and validate a WebSocket upgrade request without allocating.
+ * The request line and the Upgrade, Connection, Sec-WebSocket-Key and
+ * Sec-WebSocket-Version headers are validated per RFC 6455.
+ *
+ * @param[out] r The HTTP upgrade request structure to populate.
+ * @param[in] str The raw request buffer, does not need to be null-terminated.
+ * @param[in] len The length of the request buffer.
+ * @return HTTP_PARSE_OK on success, HTTP_PARSE_INCOMPLETE if more data is
+ *  needed, HTTP_PARSE_INVALID otherwise.
+ */
+enum http_parse_result_t
+http_upgrade_request_parse(struct http_upgrade_request_t *r, const char *str,
+                           size_t len) __nonnull((1, 2));
+
 __END_DECLS
 
 #endif
@@ -0,0 +1,176 @@
+#ifndef CSTD_WEBSOCKET_LOOP_H
+#define CSTD_WEBSOCKET_LOOP_H
+
+/**
+ * Event loop driving many WebSocket clients from a single thread.
+ * Clients are switched to non-blocking mode and watched with edge triggered
+ * epoll so every wakeup reads until the socket is drained.
+ *
+ * When built with WEBC_USE_IO_URING (USE_IO_URING=1/-Duse_io_uring) the loop
+ * uses io_uring instead: plain connections receive through multishot recv
+ * into a ring of provided buffers and the writes of every client are
+ * submitted together once per iteration. TLS connections are polled through
+ * the ring. Kernels without support fall back to epoll.
+ *
+ * ws_loop_run_spin trades a core for latency: the thread is pinned and
+ * spins on non-blocking reads of every client instead of sleeping in the
+ * kernel, parking only after a quiet period.
+ *
+ * Only available on Linux.
+ */
+
+#include "defs.h"
+#include "websocket.h"
+
+#include <stdbool.h>
+
+__BEGIN_DECLS
+
+#ifdef __linux__
+
+/**
+ * Default time spent spinning without a message before parking.
+ */
+#define WS_LOOP_SPIN_US 50000
+
+/**
+ * Event loop structure.
+ */
+struct ws_loop_t;
+
+/**
+ * Spin-then-park policy for ws_loop_run_spin.
+ * Initialize with ws_loop_spin_init.
+ */
+struct ws_loop_spin_t {
+  /**
+   * CPU the running thread is pinned to, -1 leaves the affinity alone.
+   * Default is -1.
+   */
+  int cpu;
+  /**
+   * Time spent spinning without a message before parking, -1 never parks
+   * and 0 parks right away like ws_loop_run.
+   * Default is WS_LOOP_SPIN_US.
+   */
+  int spin_us;
+  /**
+   * Max time parked before spinning again, -1 waits for the next event.
+   * Default is -1.
+   */
+  int park_ms;
+};
+
+/**
+ * Callback definition for a client leaving the loop because the connection
+ * was closed, failed or the message callback returned false.
+ * The client is removed from the loop before this is called, the callback
+ * owns it from then on (e.g. call ws_client_free).
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] status Why the client left the loop.
+ * @param[in] context User supplied data.
+ */
+typedef void(on_close_callback)(struct ws_client_t *client,
+                                enum ws_client_status_t status,
+                                void *context);
+
+/**
+ * Create an event loop.
+ * Free with ws_loop_destroy.
+ *
+ * @return The event loop, NULL on failure.
+ */
+struct ws_loop_t *ws_loop_create();
+
+/**
+ * Add a connected client to the event loop.
+ * The client is switched to non-blocking mode.
+ *
+ * @param[in] loop The event loop.
+ * @param[in] client The connected WebSocket client.
+ * @param[in] cb The callback for TEXT and BIN messages.
+ * @param[in] close_cb Optional callback when the client leaves the loop.
+ * @param[in] context The user supplied data passed to both callbacks.
+ * @return True on success, false otherwise.
+ */
+bool ws_loop_add(struct ws_loop_t *loop, struct ws_client_t *client,
+                 on_message_callback cb, on_close_callback close_cb,
+                 void *context) __nonnull((1, 2, 3));
+
+/**
+ * Remove a client from the event loop without closing it.
+ * Safe to call from within the loop's callbacks.
+ *
+ * @param[in] loop The event loop.
+ * @param[in] client The WebSocket client.
+ * @return True if the client was removed, false if it was not in the loop.
+ */
+bool ws_loop_remove(struct ws_loop_t *loop, struct ws_client_t *client)
+    __nonnull((1, 2));
+
+/**
+ * Wait for events once and handle every ready client.
+ *
+ * @param[in] loop The event loop.
+ * @param[in] timeout_ms Max time to wait, -1 waits forever.
+ * @return The number of events handled, -1 on failure.
+ */
+int ws_loop_run_once(struct ws_loop_t *loop, int timeout_ms) __nonnull((1));
+
+/**
+ * Run the event loop until ws_loop_stop is called or no clients remain.
+ *
+ * @param[in] loop The event loop.
+ * @return True on a clean exit, false on failure.
+ */
+bool ws_loop_run(struct ws_loop_t *loop) __nonnull((1));
+
+/**
+ * Initialize the spin policy with default values.
+ *
+ * @param[out] spin The spin policy.
+ */
+void ws_loop_spin_init(struct ws_loop_spin_t *spin) __nonnull((1));
+
+/**
+ * Run the event loop in busy-poll mode until ws_loop_stop is called or no
+ * clients remain.
+ * The calling thread is pinned to spin->cpu and reads every client without
+ * blocking in a tight loop, so messages are handled without waiting for the
+ * scheduler to wake the thread. Once no message arrived for spin->spin_us
+ * the thread parks in the kernel like ws_loop_run and spins again on the
+ * next event.
+ * Set net_options.busy_poll_us on the clients before connecting to also
+ * busy poll the device queue (SO_BUSY_POLL) on every read.
+ * With io_uring the spin polls the ring for completions instead.
+ *
+ * @param[in] loop The event loop.
+ * @param[in] spin The spin policy.
+ * @return True on a clean exit, false on failure.
+ */
+bool ws_loop_run_spin(struct ws_loop_t *loop, const struct ws_loop_spin_t *spin)
+    __nonnull((1, 2));
+
+/**
+ * Stop a running event loop.
+ * Safe to call from another thread.
+ *
+ * @param[in] loop The event loop.
+ * @return True on success, false otherwise.
+ */
+bool ws_loop_stop(struct ws_loop_t *loop) __nonnull((1));
+
+/**
+ * Destroy the event loop.
+ * Clients still in the loop are not closed or freed.
+ *
+ * @param[in] loop The event loop.
+ */
+void ws_loop_destroy(struct ws_loop_t **loop);
+
+#endif
+
+__END_DECLS
+
+#endif
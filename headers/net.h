@@ -5,8 +5,10 @@
  * Wrapper functionality for network communication.
  * This will handle regular and OpenSSL operations.
  *
- * If using OpenSSL net_init_[client|server]/net_deinit must be used appropriately.
- * Only one can be initialized, either client or server.
+ * If using OpenSSL, connections need a TLS context. Either create contexts
+ * with net_tls_ctx_create_[client|server] and pass them explicitly, or use
+ * net_init_[client|server]/net_deinit to manage the default contexts used
+ * when none is given. Client and server contexts can exist side by side.
  */
 
 #include "defs.h"
@@ -15,24 +17,436 @@ __BEGIN_DECLS
 
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 #ifdef WEBC_USE_SSL
 #include <openssl/types.h>
+
+/**
+ * TLS context holding the trust/certificate configuration and the client
+ * session cache. Connections made with different contexts share nothing,
+ * e.g. give each worker thread its own to avoid contention on the cache.
+ */
+struct net_tls_ctx_t;
 #endif
 
+/**
+ * Returned by the read/write functions when the connection is non-blocking
+ * and the operation would have blocked.
+ */
+#define NET_WOULD_BLOCK (-2)
+
+/**
+ * Default delay before starting the next connection attempt, RFC 8305
+ * recommends 250ms.
+ */
+#define NET_ATTEMPT_DELAY_MS 250
+
+#ifdef WEBC_USE_SSL
+/**
+ * Plaintext bytes per small TLS record, sized so a record plus its header
+ * and tag fits a single 1500 byte MTU segment and can be decrypted as soon
+ * as that segment arrives.
+ */
+#define NET_TLS_SMALL_RECORD 1369
+
+/**
+ * Bytes written in a burst after which dynamic sizing switches to full
+ * 16 KB records.
+ */
+#define NET_TLS_BOOST_BYTES (1024 * 1024)
+
+/**
+ * Idle time in milliseconds after which dynamic sizing starts a new burst
+ * with small records.
+ */
+#define NET_TLS_IDLE_RESET_MS 1000
+
+/**
+ * How outgoing data is cut into TLS records.
+ */
+enum net_tls_records_t {
+  /**
+   * Full records of up to 16 KB, best throughput.
+   */
+  NET_TLS_RECORDS_FULL,
+  /**
+   * Small records at the start of every burst, full records once
+   * NET_TLS_BOOST_BYTES were written without pausing for
+   * NET_TLS_IDLE_RESET_MS.
+   */
+  NET_TLS_RECORDS_DYNAMIC,
+  /**
+   * Always small records, lowest time to first byte for latency sensitive
+   * streams.
+   */
+  NET_TLS_RECORDS_SMALL,
+};
+#endif
+
+/**
+ * Options for establishing a connection.
+ */
+struct net_options_t {
+  /**
+   * Max time in milliseconds for the whole connect, including the TLS
+   * handshake. 0 waits as long as the kernel does.
+   */
+  unsigned int connect_timeout_ms;
+  /**
+   * Delay in milliseconds before the next address is tried in parallel when
+   * the current attempts haven't finished (Happy Eyeballs).
+   * Default is NET_ATTEMPT_DELAY_MS.
+   */
+  unsigned int attempt_delay_ms;
+  /**
+   * Disable Nagle's algorithm (TCP_NODELAY) so small messages are sent
+   * right away. Default is true.
+   */
+  bool no_delay;
+  /**
+   * Send ACKs right away instead of delaying them (TCP_QUICKACK). Linux
+   * clears the flag again on its own, so it is set anew after every read
+   * that returned data. Default is false.
+   */
+  bool quick_ack;
+  /**
+   * Kernel receive buffer size in bytes (SO_RCVBUF), 0 keeps the default.
+   */
+  int recv_buf_size;
+  /**
+   * Kernel send buffer size in bytes (SO_SNDBUF), 0 keeps the default.
+   */
+  int send_buf_size;
+  /**
+   * Microseconds to busy poll the device queue on blocking reads
+   * (SO_BUSY_POLL), 0 keeps the default. Values above the
+   * net.core.busy_read sysctl need CAP_NET_ADMIN.
+   */
+  int busy_poll_us;
+  /**
+   * Max time in milliseconds sent data may stay unacknowledged before the
+   * connection is dropped (TCP_USER_TIMEOUT), 0 keeps the default.
+   */
+  unsigned int user_timeout_ms;
+  /**
+   * Type of service / traffic class byte (IP_TOS/IPV6_TCLASS), -1 keeps the
+   * default.
+   */
+  int tos;
+  /**
+   * Send the first write (the upgrade request or TLS ClientHello) in the SYN
+   * when the kernel has a Fast Open cookie for the server
+   * (TCP_FASTOPEN_CONNECT), saving a round trip on reconnects. The connect
+   * completes right away so only the first address is tried and a refused
+   * connection shows up on the first read/write. Needs the client bit (1) of
+   * the net.ipv4.tcp_fastopen sysctl. Default is false.
+   */
+  bool fast_open;
+  /**
+   * Capture kernel receive timestamps (SO_TIMESTAMPING) on every read, see
+   * net_info_t.rx_time. Software timestamps work on any TCP connection,
+   * hardware ones need timestamping enabled on the interface
+   * (SIOCSHWTSTAMP, e.g. hwstamp_ctl). Unix domain sockets get none.
+   * TLS in user space stamps approximately: OpenSSL reads the socket itself,
+   * so a peek before each socket read takes the stamp and every record that
+   * read brings in shares it. With ktls the kernel stamps each read exactly.
+   * Default is false.
+   */
+  bool rx_timestamps;
+#ifdef WEBC_USE_SSL
+  /**
+   * Hand record encryption to the kernel (kTLS) after the handshake so
+   * reads/writes are plain socket calls. Needs the kernel tls module and an
+   * OpenSSL built with kTLS, otherwise OpenSSL keeps doing the crypto.
+   * With TLS 1.3, reads only skip OpenSSL once the server's first session
+   * ticket was cached. A later ticket or a KeyUpdate from the server then
+   * fails the read, since the kernel can't hand it to OpenSSL. Servers that
+   * send no tickets keep reads in OpenSSL. net_listen_options_t.ktls does
+   * the same for accepted connections.
+   * Default is false.
+   */
+  bool ktls;
+  /**
+   * Send the first write (the upgrade request) as TLS 1.3 early data when
+   * resuming a session whose server allows it, saving a round trip. The
+   * handshake then finishes during that write and rejected early data is
+   * sent again transparently. Early data can be replayed, only the
+   * idempotent upgrade request should go first. Default is false.
+   */
+  bool early_data;
+  /**
+   * How writes are cut into TLS records, see net_tls_records_t. Not applied
+   * with kTLS, the kernel always sends full records.
+   * Default is NET_TLS_RECORDS_FULL.
+   */
+  enum net_tls_records_t tls_records;
+  /**
+   * TLS context for the connection, NULL uses the default client context
+   * from net_init_client. Must outlive the connect call.
+   * Default is NULL.
+   */
+  struct net_tls_ctx_t *tls_ctx;
+#endif
+};
+
+/**
+ * Options for a listening socket.
+ */
+struct net_listen_options_t {
+  /**
+   * Max number of pending connections. Default is SOMAXCONN.
+   */
+  int backlog;
+  /**
+   * Let several sockets listen on the same address (SO_REUSEPORT), the
+   * kernel spreads incoming connections across them. Give every worker
+   * thread its own listener to shard accepts. Default is false.
+   */
+  bool reuse_port;
+  /**
+   * Make the listener and the accepted connections non-blocking.
+   * Default is false.
+   */
+  bool nonblocking;
+  /**
+   * Max number of pending TCP Fast Open requests (TCP_FASTOPEN), lets
+   * clients with a cookie send data in the SYN. Needs the server bit (2) of
+   * the net.ipv4.tcp_fastopen sysctl. 0 disables it. Default is 0.
+   */
+  int fast_open_queue;
+#ifdef WEBC_USE_SSL
+  /**
+   * TLS context for accepted connections, NULL uses the default server
+   * context from net_init_server. Connections are plain TCP when neither
+   * is set. Must outlive the listener. Default is NULL.
+   */
+  struct net_tls_ctx_t *tls_ctx;
+  /**
+   * Accept TLS connections without running the server handshake, finish it
+   * with net_handshake (e.g. on a worker thread). Default is false.
+   */
+  bool defer_handshake;
+  /**
+   * Hand record encryption of accepted TLS connections to the kernel
+   * (kTLS), see net_options_t.ktls. Reads skip OpenSSL right after the
+   * handshake, a KeyUpdate from the client then fails the read. Only
+   * handshakes finished in net_accept or net_handshake switch, a
+   * non-blocking one finished by the first reads/writes keeps them in
+   * OpenSSL. TCP listeners only. Default is false.
+   */
+  bool ktls;
+#endif
+};
+
+struct net_info_t;
+
+/**
+ * Receive timestamps of the data returned by a read, zero when unknown.
+ */
+struct net_rx_time_t {
+  /**
+   * When the kernel received the data (CLOCK_REALTIME).
+   */
+  struct timespec software;
+  /**
+   * When the network card received the data, in the card's clock which is
+   * usually synchronized to CLOCK_REALTIME by PTP.
+   */
+  struct timespec hardware;
+};
+
+/**
+ * Transport a connection's I/O goes through, picked once when the
+ * connection is made. Each function gets the connection and behaves like
+ * the net_* function of the same name. Custom transports keep their state
+ * in net_info_t.transport_data.
+ */
+struct net_transport_t {
+  /**
+   * Short name for logs, e.g. "tcp".
+   */
+  const char *name;
+  ssize_t (*peek)(struct net_info_t *info, void *buf, size_t buf_len);
+  ssize_t (*read)(struct net_info_t *info, void *buf, size_t buf_len);
+  ssize_t (*write)(struct net_info_t *info, const void *buf, size_t buf_len);
+  bool (*set_nonblocking)(struct net_info_t *info, bool enable);
+  void (*close)(struct net_info_t *info);
+};
+
+/**
+ * Plain TCP socket.
+ */
+extern const struct net_transport_t net_tcp_transport;
+
+/**
+ * Unix domain stream socket.
+ */
+extern const struct net_transport_t net_unix_transport;
+
+/**
+ * In-memory pipe, see net_pipe.
+ */
+extern const struct net_transport_t net_pipe_transport;
+
+#ifdef WEBC_USE_SSL
+/**
+ * OpenSSL on a socket, including kTLS and early data.
+ */
+extern const struct net_transport_t net_tls_transport;
+#endif
+
+/**
+ * A listening socket.
+ */
+struct net_listener_t {
+  int socket;
+  bool nonblocking;
+  /**
+   * Transport of the accepted connections, before TLS.
+   */
+  const struct net_transport_t *transport;
+#ifdef WEBC_USE_SSL
+  struct net_tls_ctx_t *tls_ctx;
+  bool defer_handshake;
+  bool ktls;
+#endif
+};
+
 struct net_info_t {
+  /**
+   * The socket, -1 for transports without one.
+   */
   int socket;
+  /**
+   * Transport of the connection, NULL is treated as net_tcp_transport.
+   */
+  const struct net_transport_t *transport;
+  /**
+   * State owned by the transport.
+   */
+  void *transport_data;
+  /**
+   * Capture receive timestamps, see net_options_t.rx_timestamps.
+   */
+  bool rx_timestamps;
+  /**
+   * Receive timestamps of the last read that returned data.
+   */
+  struct net_rx_time_t rx_time;
+  /**
+   * Set TCP_QUICKACK after every read, see net_options_t.quick_ack.
+   */
+  bool quick_ack;
+  /**
+   * Set by net_set_nonblocking and for connections accepted from a
+   * non-blocking listener.
+   */
+  bool nonblocking;
 #ifdef WEBC_USE_SSL
   SSL *ssl;
+  /**
+   * The kernel encrypts outgoing records (kTLS), writes skip OpenSSL.
+   */
+  bool ktls_send;
+  /**
+   * The kernel decrypts incoming records (kTLS), reads skip OpenSSL.
+   */
+  bool ktls_recv;
+  /**
+   * The kernel decrypts incoming records but reads go through OpenSSL until
+   * the first TLS 1.3 session ticket arrived.
+   */
+  bool ktls_recv_wait;
+  /**
+   * The handshake is finished by the first write, sent as early data.
+   */
+  bool early_data_pending;
+  /**
+   * Early data received while accepting, returned by the first reads.
+   */
+  uint8_t *early_data;
+  size_t early_data_len;
+  size_t early_data_off;
+  /**
+   * Record sizing state, see net_tls_records_t.
+   */
+  enum net_tls_records_t tls_records;
+  size_t record_size;
+  size_t burst_bytes;
+  int64_t last_write_ms;
 #endif
 };
 
 #ifdef WEBC_USE_SSL
 
 /**
- * Initialize SSL library functionality for client.
+ * Max number of host:port pairs with a resumable TLS session kept by a
+ * client context.
+ */
+#define NET_SESSION_CACHE_SIZE 64
+
+/**
+ * Create a client TLS context.
  * Provide optional cert/path for trusted verification.
- * Cannot use if net_init_server has already been used.
+ * Free with net_tls_ctx_destroy.
+ *
+ * @param cert The cert file name.
+ * @param path The path to the cert file. Can be NULL if relative.
+ * @return The TLS context, NULL on failure.
+ */
+struct net_tls_ctx_t *net_tls_ctx_create_client(const char *restrict cert,
+                                                const char *restrict path);
+
+/**
+ * Create a server TLS context.
+ * Provide server certificates.
+ * Free with net_tls_ctx_destroy.
+ *
+ * @param key The private key file name.
+ * @param cert The cert file name.
+ * @return The TLS context, NULL on failure.
+ */
+struct net_tls_ctx_t *net_tls_ctx_create_server(const char *restrict key,
+                                                const char *restrict cert);
+
+/**
+ * Allow TLS 1.3 early data (0-RTT) of up to max_bytes on a server context.
+ * Tickets issued afterwards let resuming clients send their first request
+ * with the ClientHello. Blocking listeners read it while accepting, it is
+ * returned by the first reads of the connection. Early data can be
+ * replayed, only enable it for idempotent requests like the upgrade.
+ *
+ * @param tls_ctx The server TLS context.
+ * @param max_bytes The max amount of early data, 0 disables it.
+ * @return True on success, false otherwise.
+ */
+bool net_tls_ctx_set_early_data(struct net_tls_ctx_t *tls_ctx,
+                                uint32_t max_bytes) __nonnull((1));
+
+/**
+ * Get the underlying OpenSSL context, e.g. to set ciphers or ALPN.
+ *
+ * @param tls_ctx The TLS context.
+ * @return The OpenSSL context owned by the TLS context.
+ */
+SSL_CTX *net_tls_ctx_get(struct net_tls_ctx_t *tls_ctx) __nonnull((1));
+
+/**
+ * Destroy the TLS context and drop its cached sessions.
+ * Close every connection made with it first, their session callbacks use the
+ * cache freed here.
+ * The context is automatically NULL'ed out.
+ *
+ * @param tls_ctx The TLS context.
+ */
+void net_tls_ctx_destroy(struct net_tls_ctx_t **tls_ctx);
+
+/**
+ * Initialize the default client TLS context.
+ * Provide optional cert/path for trusted verification.
+ * Does nothing if it is already initialized.
  *
  * @param cert The cert file name.
  * @param path The path to the cert file. Can be NULL if relative.
@@ -41,9 +455,9 @@ struct net_info_t {
 bool net_init_client(const char *restrict cert, const char *restrict path);
 
 /**
- * Initialize SSL library functionality for server.
+ * Initialize the default server TLS context.
  * Provide server certificates.
- * Cannot use if net_init_client has already been used.
+ * Does nothing if it is already initialized.
  *
  * @param key The private key file name.
  * @param cert The cert file name.
@@ -52,10 +466,36 @@ bool net_init_client(const char *restrict cert, const char *restrict path);
 bool net_init_server(const char *restrict key, const char *restrict cert);
 
 /**
- * Deinitalize the SSL library functionality.
+ * Get the default client TLS context.
+ *
+ * @return The context from net_init_client, NULL if not initialized.
+ */
+struct net_tls_ctx_t *net_default_client_ctx();
+
+/**
+ * Get the default server TLS context.
+ *
+ * @return The context from net_init_server, NULL if not initialized.
+ */
+struct net_tls_ctx_t *net_default_server_ctx();
+
+/**
+ * Destroy the default TLS contexts.
+ * Also drops every session cached by the default client context.
+ * Close the connections using the default contexts first.
  */
 void net_deinit();
 
+/**
+ * Check if the connection's TLS handshake resumed a cached session.
+ * Client connections offer the last session seen for the same host:port
+ * automatically.
+ *
+ * @param info The net info structure.
+ * @return True if the session was resumed, false otherwise.
+ */
+bool net_session_resumed(struct net_info_t *info) __nonnull((1));
+
 #endif
 
 
@@ -71,11 +511,145 @@ void net_deinit();
 bool net_connect(const char *restrict host, const char *restrict port,
                  struct net_info_t *out) __nonnull((3));
 
-// TODO need to implement create_listener socket to go along with accept
+/**
+ * Connect to a Unix domain stream socket and populate the given connection
+ * info in the net_info_t structure.
+ * The connection is always plain, only the socket level options
+ * (buffer sizes, busy poll, connect timeout) apply.
+ *
+ * @param path The path of the socket file.
+ * @param opts The connect options, NULL for the defaults.
+ * @param out The net_info_t structure to populate.
+ * @return True on success, false otherwise.
+ */
+bool net_connect_unix(const char *path, const struct net_options_t *opts,
+                      struct net_info_t *out) __nonnull((1, 3));
+
+/**
+ * Create an in-memory connection, what is written to one end is read from
+ * the other. Lets the whole stack run without sockets, e.g. for tests and
+ * reproducible benchmarks. The ends may be used from different threads,
+ * blocking reads wait for the other end. Both ends have no socket so they
+ * can't be polled or used with net_set_options.
+ * Close each end with net_close, reads on the other end then return 0.
+ *
+ * @param a The first end to populate.
+ * @param b The second end to populate.
+ * @return True on success, false otherwise.
+ */
+bool net_pipe(struct net_info_t *a, struct net_info_t *b) __nonnull((1, 2));
+
+/**
+ * Initialize the net options with all default values.
+ *
+ * @param opts The net options.
+ */
+void net_options_init(struct net_options_t *opts) __nonnull((1));
+
+/**
+ * Apply the socket tuning options (everything except the connect timings)
+ * and the TLS record sizing to an existing connection. net_connect_with
+ * already applies them before connecting, this is for connections made
+ * elsewhere, e.g. accepted ones, or to switch the record sizing later.
+ *
+ * @param info The net info structure.
+ * @param opts The options to apply.
+ * @return True if every option was applied, false otherwise.
+ */
+bool net_set_options(struct net_info_t *info, const struct net_options_t *opts)
+    __nonnull((1, 2));
+
+/**
+ * Connect to a TCP socket with the given options and populate the given
+ * connection info in the net_info_t structure.
+ *
+ * Addresses are tried in parallel, staggered by attempt_delay_ms and
+ * alternating between IPv6 and IPv4 (RFC 8305). The first attempt to
+ * connect wins and the rest are closed. The socket tuning options are
+ * applied to every attempt before it connects.
+ *
+ * @param host The hostname.
+ * @param port The port number.
+ * @param opts The connect options, NULL for the defaults.
+ * @param out The net_info_t structure to populate.
+ * @return True on success, false otherwise.
+ */
+bool net_connect_with(const char *restrict host, const char *restrict port,
+                      const struct net_options_t *opts, struct net_info_t *out)
+    __nonnull((4));
+
+/**
+ * Initialize the listen options with all default values.
+ *
+ * @param opts The listen options.
+ */
+void net_listen_options_init(struct net_listen_options_t *opts) __nonnull((1));
+
+/**
+ * Create a TCP socket listening on the given address.
+ *
+ * @param host The address to bind, NULL for every local address.
+ * @param port The port number.
+ * @param opts The listen options, NULL for the defaults.
+ * @param out The listener to populate.
+ * @return True on success, false otherwise.
+ */
+bool net_listen(const char *restrict host, const char *restrict port,
+                const struct net_listen_options_t *opts,
+                struct net_listener_t *out) __nonnull((2, 4));
+
+/**
+ * Create a Unix domain stream socket listening on the given path.
+ * A stale socket file at the path is removed first. The file is left in
+ * place by net_listener_close, unlink it when done.
+ * reuse_port is ignored and accepted connections only use TLS when tls_ctx
+ * is set explicitly.
+ *
+ * @param path The path of the socket file.
+ * @param opts The listen options, NULL for the defaults.
+ * @param out The listener to populate.
+ * @return True on success, false otherwise.
+ */
+bool net_listen_unix(const char *path, const struct net_listen_options_t *opts,
+                     struct net_listener_t *out) __nonnull((1, 3));
+
 /**
  * Accept an incoming connection.
+ * TLS connections run the server handshake. On a non-blocking listener the
+ * handshake may still be in progress when this returns, the first
+ * reads/writes on the connection finish it. Listeners with defer_handshake
+ * leave the handshake to net_handshake.
+ * Use net_set_options to tune the accepted connection.
+ *
+ * @param listener The listener.
+ * @param out The net_info_t structure to populate.
+ * @return 1 on success, NET_WOULD_BLOCK if no connection is pending on a
+ *  non-blocking listener, -1 on failure.
  */
-bool net_accept(struct net_info_t *info);
+int net_accept(struct net_listener_t *listener, struct net_info_t *out);
+
+#ifdef WEBC_USE_SSL
+/**
+ * Run the server TLS handshake of a connection accepted by a listener with
+ * defer_handshake. Blocks until the handshake is done, even on
+ * non-blocking connections, so call it off the I/O thread.
+ * Does nothing for plain connections or finished handshakes.
+ *
+ * @param info The accepted connection.
+ * @param timeout_ms Max time for the handshake, 0 waits forever.
+ * @return True on success, false otherwise.
+ */
+bool net_handshake(struct net_info_t *info, unsigned int timeout_ms)
+    __nonnull((1));
+#endif
+
+/**
+ * Stop listening and close the socket.
+ * Accepted connections are not affected.
+ *
+ * @param listener The listener.
+ */
+void net_listener_close(struct net_listener_t *listener);
 
 /**
  * Peek the next buf_len bytes from the connection.
@@ -83,7 +657,8 @@ bool net_accept(struct net_info_t *info);
  * @param info The net info structure.
  * @param buf The buffer to populate.
  * @param buf_len The length of the given buffer.
- * @return The number of bytes peeked, -1 on failure.
+ * @return The number of bytes peeked, -1 on failure, NET_WOULD_BLOCK if no
+ *  data is available on a non-blocking connection.
  */
 ssize_t net_peek(struct net_info_t *info, void *buf, size_t buf_len);
 
@@ -93,7 +668,8 @@ ssize_t net_peek(struct net_info_t *info, void *buf, size_t buf_len);
  * @param info The net info structure.
  * @param buf The buffer to populate.
  * @param buf_len The length of the given buffer.
- * @return The number of bytes read, -1 on failure.
+ * @return The number of bytes read, -1 on failure, NET_WOULD_BLOCK if no
+ *  data is available on a non-blocking connection.
  */
 ssize_t net_read(struct net_info_t *info, void *buf, size_t buf_len);
 
@@ -103,10 +679,32 @@ ssize_t net_read(struct net_info_t *info, void *buf, size_t buf_len);
  * @param info The net info structure.
  * @param buf The buffer to populate.
  * @param buf_len The length of the given buffer.
- * @return The number of bytes written, -1 on failure.
+ * @return The number of bytes written, -1 on failure, NET_WOULD_BLOCK if the
+ *  send buffer is full on a non-blocking connection.
  */
 ssize_t net_write(struct net_info_t *info, const void *buf, size_t buf_len);
 
+/**
+ * Set the connection to non-blocking or blocking mode.
+ * In non-blocking mode net_peek/net_read/net_write return NET_WOULD_BLOCK
+ * instead of waiting. Non-blocking TLS connections without kTLS let OpenSSL
+ * read ahead, one net_read then returns every record a socket read brought
+ * in.
+ *
+ * @param info The net info structure.
+ * @param enable True for non-blocking, false for blocking.
+ * @return True on success, false otherwise.
+ */
+bool net_set_nonblocking(struct net_info_t *info, bool enable);
+
+/**
+ * Set TCP_QUICKACK again if the connection has quick_ack enabled.
+ * net_read does this itself, call it after reading the socket directly.
+ *
+ * @param info The net info structure.
+ */
+void net_quick_ack(struct net_info_t *info) __nonnull((1));
+
 /**
  * Close the connection.
  *
@@ -10,6 +10,16 @@
 
 __BEGIN_DECLS
 
+/**
+ * Max byte length of a frame header.
+ * 2 initial bytes, 8 byte extended payload length, and 4 byte masking key.
+ */
+#define WS_FRAME_MAX_HEADER_LEN 14
+/**
+ * Byte length ws_frame_write_header may touch in the output buffer.
+ */
+#define WS_FRAME_HEADER_STORE_LEN 16
+
 enum ws_frame_error_t {
   WS_FRAME_SUCCESS = 0,
   WS_FRAME_INVALID,
@@ -134,6 +144,103 @@ struct ws_frame_t {
   byte_array payload;
 };
 
+/**
+ * Bit flags for the first header byte.
+ */
+#define WS_FRAME_FIN 0x80
+#define WS_FRAME_RSV1 0x40
+#define WS_FRAME_RSV2 0x20
+#define WS_FRAME_RSV3 0x10
+#define WS_FRAME_OPCODE_MASK 0x0F
+/**
+ * Bit flags for the frame descriptor flags.
+ */
+#define WS_FRAME_DESC_MASKED 0x80
+
+/**
+ * Compact WebSocket frame descriptor.
+ * Describes a received frame whose payload lives in a separate buffer.
+ * The layout is fixed (no bitfields) so it does not depend on the compiler,
+ * use the ws_frame_desc_* accessors to read the header bits.
+ */
+struct ws_frame_desc_t {
+  /**
+   * First header byte. (fin, rsv1-3, and opcode)
+   */
+  uint8_t codes;
+  /**
+   * Descriptor flags. (WS_FRAME_DESC_MASKED)
+   */
+  uint8_t flags;
+  /**
+   * Byte length of the frame header.
+   */
+  uint8_t header_len;
+  uint8_t reserved;
+  /**
+   * Masking key used with payload, if the masked flag is set.
+   */
+  uint8_t masking_key[4];
+  /**
+   * Offset of the payload into the owning buffer.
+   */
+  uint32_t offset;
+  /**
+   * Length of the payload.
+   */
+  uint32_t len;
+};
+
+_Static_assert(sizeof(struct ws_frame_desc_t) == 16,
+               "ws_frame_desc_t must be 16 bytes");
+
+static inline enum ws_opcode_t
+ws_frame_desc_opcode(const struct ws_frame_desc_t *desc) {
+  return (enum ws_opcode_t)(desc->codes & WS_FRAME_OPCODE_MASK);
+}
+
+static inline bool ws_frame_desc_fin(const struct ws_frame_desc_t *desc) {
+  return (desc->codes & WS_FRAME_FIN) != 0;
+}
+
+static inline bool ws_frame_desc_rsv1(const struct ws_frame_desc_t *desc) {
+  return (desc->codes & WS_FRAME_RSV1) != 0;
+}
+
+static inline bool ws_frame_desc_rsv2(const struct ws_frame_desc_t *desc) {
+  return (desc->codes & WS_FRAME_RSV2) != 0;
+}
+
+static inline bool ws_frame_desc_rsv3(const struct ws_frame_desc_t *desc) {
+  return (desc->codes & WS_FRAME_RSV3) != 0;
+}
+
+static inline bool ws_frame_desc_masked(const struct ws_frame_desc_t *desc) {
+  return (desc->flags & WS_FRAME_DESC_MASKED) != 0;
+}
+
+/**
+ * Read a frame header from the given buffer into the frame descriptor.
+ * The descriptor offset is set relative to the start of buf.
+ *
+ * @param[out] desc The frame descriptor to populate.
+ * @param[in] buf The raw buffer of a WebSocket frame.
+ * @param[in] len The length of the given buffer.
+ * @return WS_FRAME_SUCCESS for success, WS_FRAME_ERROR_LEN if the buffer
+ *  does not hold the full header, WS_FRAME_INVALID if the payload length does
+ *  not fit in 32 bits.
+ */
+enum ws_frame_error_t ws_frame_desc_read(struct ws_frame_desc_t *desc,
+                                         const uint8_t *buf, size_t len)
+    __nonnull((1, 2));
+
+/**
+ * Print the given frame descriptor for debugging purposes.
+ *
+ * @param[in] desc The frame descriptor.
+ */
+void ws_frame_desc_print(const struct ws_frame_desc_t *desc) __nonnull((1));
+
 /**
  * Initialize WebSocket Frame structure.
  *
@@ -199,6 +306,39 @@ enum ws_frame_error_t ws_frame_read_body(struct ws_frame_t *frame, uint8_t *buf,
 enum ws_frame_error_t ws_frame_write(struct ws_frame_t *frame, byte_array *out)
     __nonnull((1, 2));
 
+/**
+ * Write a frame header into the given buffer.
+ * The header is written with full width stores so the buffer must have room
+ * for WS_FRAME_HEADER_STORE_LEN bytes, only the returned length is valid.
+ *
+ * @param[out] out The buffer to write the header into.
+ * @param[in] codes The first header byte (fin, rsv bits, and opcode).
+ * @param[in] mask Flag to include the masking key.
+ * @param[in] masking_key The masking key, ignored if mask is false.
+ * @param[in] payload_len The payload length.
+ * @return The byte length of the header (2-14).
+ */
+size_t ws_frame_write_header(uint8_t *out, uint8_t codes, bool mask,
+                             const uint8_t masking_key[4],
+                             uint64_t payload_len) __nonnull((1, 4));
+
+/**
+ * Encode a frame and append it to the given byte array, growing it as needed.
+ * The payload is masked while it is copied if mask is set.
+ *
+ * @param[out] out The byte array to append to.
+ * @param[in] codes The first header byte (fin, rsv bits, and opcode).
+ * @param[in] mask Flag to mask the payload.
+ * @param[in] masking_key The masking key, ignored if mask is false.
+ * @param[in] payload The payload, can be NULL if len is 0.
+ * @param[in] len The payload length.
+ * @return The ws_frame_error_t enum result, WS_FRAME_SUCCESS for success.
+ */
+enum ws_frame_error_t ws_frame_append(byte_array *out, uint8_t codes,
+                                      bool mask, uint8_t masking_key[4],
+                                      uint8_t *payload, size_t len)
+    __nonnull((1, 4));
+
 /**
  * Free internals of WebSocket Frame structure.
  *
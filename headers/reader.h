@@ -2,16 +2,16 @@
 #define CSTD_WEBSOCKET_READER_H
 
 #include "defs.h"
+#include "net.h"
 #include "protocol.h"
 #include "unicode_str.h"
 
 #include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
 
 __BEGIN_DECLS
 
-// forward declare
-struct net_info_t;
-
 /**
  * WebSocket Reader structure.
  */
@@ -30,6 +30,17 @@ struct ws_message_t {
    * The full body of the WebSocket message.
    */
   byte_array body;
+  /**
+   * Kernel receive timestamps of the read that completed the message, zero
+   * unless the connection has rx_timestamps enabled and read it itself.
+   * Approximate over TLS without kTLS, see net_options_t.rx_timestamps.
+   */
+  struct net_rx_time_t rx_time;
+  /**
+   * When the message left the reader for the callback or
+   * ws_client_next_msg (CLOCK_REALTIME, comparable to rx_time.software).
+   */
+  struct timespec dispatch_time;
 };
 
 /**
@@ -42,6 +53,8 @@ struct ws_reader_t* ws_reader_create();
 /**
  * Handle reading from the WebSocket reader to construct messages.
  * This function blocks while waiting for data from the server and handles fragmented frames.
+ * Data is read in large chunks into the receive buffer until at least one
+ * message is complete, so a chunk can produce several messages.
  * Use ws_reader_next_msg to get the messages generated from this call.
  *
  * @param[in] reader The WebSocket reader.
@@ -50,6 +63,32 @@ struct ws_reader_t* ws_reader_create();
  */
 bool ws_reader_handle(struct ws_reader_t *reader, struct net_info_t *info) __nonnull((1));
 
+/**
+ * Read whatever is available from the connection into the reader's receive
+ * buffer and parse every complete frame out of it.
+ * Only one read is issued so this is suitable for non-blocking connections.
+ * Use ws_reader_next_msg to get the messages generated from this call.
+ *
+ * @param[in] reader The WebSocket reader.
+ * @param[in] info The connection to read from.
+ * @return The number of bytes read, 0 if the connection was closed, -1 on
+ *  failure, NET_WOULD_BLOCK if no data was available.
+ */
+ssize_t ws_reader_fill(struct ws_reader_t *reader, struct net_info_t *info)
+    __nonnull((1));
+
+/**
+ * Feed already received bytes into the WebSocket reader and parse every
+ * complete frame out of them. Incomplete frames are kept for the next call.
+ *
+ * @param[in] reader The WebSocket reader.
+ * @param[in] buf The received bytes.
+ * @param[in] len The number of received bytes.
+ * @return True on success, false otherwise.
+ */
+bool ws_reader_feed(struct ws_reader_t *reader, const uint8_t *buf,
+                    size_t len) __nonnull((1));
+
 /**
  * Get the next generated message from the WebSocket reader.
  * The caller is responsible for freeing the returned message.
@@ -0,0 +1,42 @@
+#ifndef CSTD_WEBSOCKET_SERVER_H
+#define CSTD_WEBSOCKET_SERVER_H
+
+/**
+ * Accept side of the WebSocket handshake.
+ *
+ * Connections accepted with net_accept (or one end of net_pipe) are upgraded
+ * with ws_server_upgrade, which validates the request with
+ * http_upgrade_request_parse and answers with the 101 response.
+ */
+
+#include "defs.h"
+#include "net.h"
+#include "unicode_str.h"
+
+#include <stdbool.h>
+
+__BEGIN_DECLS
+
+/**
+ * Max byte length of an upgrade request, larger requests are rejected.
+ */
+#define WS_SERVER_MAX_REQUEST 8192
+
+/**
+ * Read the client's upgrade request from the connection and answer it.
+ * A valid request gets the 101 Switching Protocols response, an invalid or
+ * oversized one gets 400 Bad Request.
+ * Bytes the client sent behind the request (e.g. its first frames) are moved
+ * into rest, feed them to a ws_reader_t before reading from the connection.
+ *
+ * @param[in] info The accepted connection, must be blocking.
+ * @param[out] path Optional, the request path. The caller frees it.
+ * @param[out] rest Bytes received after the request. The caller frees them.
+ * @return True if the connection was upgraded, false otherwise.
+ */
+bool ws_server_upgrade(struct net_info_t *info, char **path, byte_array *rest)
+    __nonnull((1, 3));
+
+__END_DECLS
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef WEBSOCKETS_SIMD_H
 #define WEBSOCKETS_SIMD_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -24,6 +25,55 @@ enum ws_frame_error_t apply_mask_to_buffer(
     uint8_t *restrict src,
     size_t len) __nonnull((2, 3));
 
+/**
+ * Apply mask to the given buffer in place.
+ *
+ * @param[in] masking_key The masking key to use.
+ * @param[in,out] buf The buffer to unmask.
+ * @param[in] len The length of the buffer.
+ * @return WS_FRAME_SUCCESS for success.
+ */
+enum ws_frame_error_t apply_mask_in_place(const uint8_t masking_key[4],
+                                          uint8_t *buf, size_t len)
+    __nonnull((1, 2));
+
+/**
+ * Base64 encode the largest prefix of src that is a multiple of 3 bytes.
+ * The remaining bytes (and padding) are left to the caller.
+ * dest must have room for BASE64_ENCODE_LEN(len) characters.
+ *
+ * @param[out] dest The destination buffer.
+ * @param[in] src The source buffer.
+ * @param[in] len The length of the source buffer.
+ * @return The number of source bytes consumed.
+ */
+size_t base64_encode_blocks(char *restrict dest, const uint8_t *restrict src,
+                            size_t len) __nonnull((1, 2));
+
+/**
+ * Base64 decode the given characters, which must not contain padding.
+ * len must be a multiple of 4.
+ * dest must have room for BASE64_DECODE_LEN(len) bytes.
+ *
+ * @param[out] dest The destination buffer.
+ * @param[in] src The source characters.
+ * @param[in] len The number of source characters.
+ * @return True on success, false if an invalid character was found.
+ */
+bool base64_decode_blocks(uint8_t *restrict dest, const char *restrict src,
+                          size_t len) __nonnull((1, 2));
+
+/**
+ * Find the first occurrence of the target byte in the given buffer.
+ *
+ * @param[in] buf The buffer to scan.
+ * @param[in] len The length of the buffer.
+ * @param[in] target The byte to search for.
+ * @return The index of the target byte, len if not found.
+ */
+size_t find_next_byte(const uint8_t *buf, size_t len, uint8_t target)
+    __nonnull((1));
+
 __END_DECLS
 
 #endif
@@ -0,0 +1,172 @@
+#ifndef CSTD_WEBSOCKET_STANDBY_H
+#define CSTD_WEBSOCKET_STANDBY_H
+
+/**
+ * Hot-standby connection pair.
+ *
+ * Besides the active connection a second, fully handshaken connection to
+ * the same or an alternate endpoint is kept warm with pings. When the
+ * active connection fails (closed, errored or silent for too long) the
+ * standby is promoted right away and a new standby is connected on a
+ * helper thread, so DNS, TCP, TLS and the upgrade stay off the critical
+ * path.
+ *
+ * Messages received on the standby are discarded, subscribe from the
+ * promote callback once a connection becomes active.
+ */
+
+#include "defs.h"
+#include "net.h"
+#include "websocket.h"
+
+#include <stdbool.h>
+
+__BEGIN_DECLS
+
+/**
+ * Default time in milliseconds a connection may be idle before it is
+ * pinged.
+ */
+#define WS_STANDBY_PING_INTERVAL_MS 1000
+
+/**
+ * Default time in milliseconds without receiving anything after which a
+ * connection is considered dead.
+ */
+#define WS_STANDBY_DEAD_AFTER_MS 3000
+
+/**
+ * Default deadline in milliseconds for connecting a standby.
+ */
+#define WS_STANDBY_CONNECT_TIMEOUT_MS 5000
+
+/**
+ * Hot-standby structure.
+ */
+struct ws_standby_t;
+
+/**
+ * Options for a hot-standby pair.
+ */
+struct ws_standby_options_t {
+  /**
+   * Idle time in milliseconds before a connection is pinged.
+   * Default is WS_STANDBY_PING_INTERVAL_MS.
+   */
+  unsigned int ping_interval_ms;
+  /**
+   * Time in milliseconds without receiving anything, pongs included, after
+   * which a connection is treated as failed. 0 disables the check.
+   * Default is WS_STANDBY_DEAD_AFTER_MS.
+   */
+  unsigned int dead_after_ms;
+  /**
+   * Options for every connection made, the connect timeout defaults to
+   * WS_STANDBY_CONNECT_TIMEOUT_MS.
+   */
+  struct net_options_t net_options;
+};
+
+/**
+ * Callback definition for a connection becoming the active one, either
+ * initially or after a failover. Use it to (re)send subscriptions.
+ *
+ * @param[in] client The now active WebSocket client.
+ * @param[in] context User supplied data.
+ */
+typedef void(on_promote_callback)(struct ws_client_t *client, void *context);
+
+/**
+ * Initialize the standby options with all default values.
+ *
+ * @param[in] opts The standby options.
+ */
+void ws_standby_options_init(struct ws_standby_options_t *opts)
+    __nonnull((1));
+
+/**
+ * Create a hot-standby pair.
+ * Nothing is connected until ws_standby_connect.
+ * Free with ws_standby_destroy.
+ *
+ * @param[in] url The URL of the endpoint.
+ * @param[in] standby_url Optional alternate endpoint, connections alternate
+ *  between both. NULL uses url for every connection.
+ * @param[in] opts The options, NULL for the defaults.
+ * @param[in] cb The callback for TEXT and BIN messages of the active
+ *  connection.
+ * @param[in] promote_cb Optional callback when a connection becomes active.
+ * @param[in] context The user supplied data passed to both callbacks.
+ * @return The standby pair, NULL on failure.
+ */
+struct ws_standby_t *ws_standby_create(const char *url, const char *standby_url,
+                                       const struct ws_standby_options_t *opts,
+                                       on_message_callback cb,
+                                       on_promote_callback promote_cb,
+                                       void *context) __nonnull((1, 4));
+
+/**
+ * Connect the active connection and start connecting the standby in the
+ * background.
+ *
+ * @param[in] standby The standby pair.
+ * @return True if the active connection is up, false otherwise.
+ */
+bool ws_standby_connect(struct ws_standby_t *standby) __nonnull((1));
+
+/**
+ * Wait for events once: dispatch the active connection's messages, keep
+ * both connections alive with pings and fail over when the active one
+ * fails.
+ * If the active connection fails without a standby ready, the failure is
+ * returned and the next connection made in the background is promoted by
+ * a later call.
+ *
+ * @param[in] standby The standby pair.
+ * @param[in] timeout_ms Max time to wait, -1 waits until something happens.
+ * @return WS_CLIENT_OK if everything was handled or a failover happened,
+ *  WS_CLIENT_STOPPED if the message callback returned false, otherwise the
+ *  status of the failed active connection when no standby was ready.
+ */
+enum ws_client_status_t ws_standby_run_once(struct ws_standby_t *standby,
+                                            int timeout_ms) __nonnull((1));
+
+/**
+ * Get the active connection.
+ * Only valid until the next ws_standby_run_once call.
+ *
+ * @param[in] standby The standby pair.
+ * @return The active client, NULL if there is none.
+ */
+struct ws_client_t *ws_standby_active(struct ws_standby_t *standby)
+    __nonnull((1));
+
+/**
+ * Check if a warm standby connection is ready to take over.
+ *
+ * @param[in] standby The standby pair.
+ * @return True if a standby is connected, false otherwise.
+ */
+bool ws_standby_ready(struct ws_standby_t *standby) __nonnull((1));
+
+/**
+ * Get the number of failovers so far.
+ *
+ * @param[in] standby The standby pair.
+ * @return The number of times a standby was promoted.
+ */
+unsigned int ws_standby_failovers(struct ws_standby_t *standby)
+    __nonnull((1));
+
+/**
+ * Close both connections, stop the background connect and free the
+ * standby pair.
+ * The standby pair is automatically NULL'ed out.
+ *
+ * @param[in] standby The standby pair.
+ */
+void ws_standby_destroy(struct ws_standby_t **standby);
+
+__END_DECLS
+
+#endif
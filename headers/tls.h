@@ -0,0 +1,190 @@
+#ifndef CSTD_WEBSOCKET_TLS_H
+#define CSTD_WEBSOCKET_TLS_H
+
+/**
+ * TLS engine working on memory buffers instead of a socket.
+ *
+ * The caller moves ciphertext between the engine and whatever transport it
+ * uses (epoll, io_uring, a test pipe, ...): received bytes go in with
+ * tls_engine_feed and bytes to send come out with tls_engine_take.
+ * Plaintext is written/read with tls_engine_write/tls_engine_read, none of
+ * them ever block. Several writes can be encrypted before the output is
+ * taken and sent in one go.
+ *
+ * tls_engine_wrap puts an engine on top of an existing connection so TLS runs
+ * over any transport, e.g. a Unix socket or net_pipe.
+ *
+ * Only available when built with OpenSSL (WEBC_USE_SSL).
+ */
+
+#include "defs.h"
+#include "net.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+#ifdef WEBC_USE_SSL
+
+/**
+ * TLS engine structure.
+ */
+struct tls_engine_t;
+
+/**
+ * Create a client side TLS engine.
+ * The handshake starts with the first tls_engine_handshake/tls_engine_write.
+ * Free with tls_engine_destroy.
+ *
+ * @param[in] tls_ctx The client TLS context, must outlive the engine.
+ * @param[in] host Optional host name for SNI.
+ * @return The TLS engine, NULL on failure.
+ */
+struct tls_engine_t *tls_engine_create_client(struct net_tls_ctx_t *tls_ctx,
+                                              const char *host)
+    __nonnull((1));
+
+/**
+ * Create a server side TLS engine.
+ * Free with tls_engine_destroy.
+ *
+ * @param[in] tls_ctx The server TLS context, must outlive the engine.
+ * @return The TLS engine, NULL on failure.
+ */
+struct tls_engine_t *tls_engine_create_server(struct net_tls_ctx_t *tls_ctx)
+    __nonnull((1));
+
+/**
+ * Hand received ciphertext to the engine.
+ *
+ * @param[in] engine The TLS engine.
+ * @param[in] buf The received bytes.
+ * @param[in] len The number of received bytes.
+ * @return True on success, false otherwise.
+ */
+bool tls_engine_feed(struct tls_engine_t *engine, const uint8_t *buf,
+                     size_t len) __nonnull((1));
+
+/**
+ * Advance the handshake with the ciphertext fed so far.
+ * Take and send the engine's output afterwards.
+ *
+ * @param[in] engine The TLS engine.
+ * @return 1 once the handshake is done, NET_WOULD_BLOCK if more input is
+ *  needed, -1 on failure.
+ */
+int tls_engine_handshake(struct tls_engine_t *engine) __nonnull((1));
+
+/**
+ * Check if the handshake is done.
+ *
+ * @param[in] engine The TLS engine.
+ * @return True if application data can flow, false otherwise.
+ */
+bool tls_engine_is_ready(struct tls_engine_t *engine) __nonnull((1));
+
+/**
+ * Decrypt as much of the fed ciphertext as fits into the buffer.
+ * A close_notify or an alert behind decrypted data is returned by the next
+ * call.
+ *
+ * @param[in] engine The TLS engine.
+ * @param[out] buf The buffer to populate.
+ * @param[in] buf_len The length of the given buffer.
+ * @return The number of bytes read, 0 if the peer closed the connection,
+ *  NET_WOULD_BLOCK if more input is needed, -1 on failure.
+ */
+ssize_t tls_engine_read(struct tls_engine_t *engine, void *buf,
+                        size_t buf_len) __nonnull((1, 2));
+
+/**
+ * Like tls_engine_read but the decrypted bytes stay in the engine.
+ *
+ * @param[in] engine The TLS engine.
+ * @param[out] buf The buffer to populate.
+ * @param[in] buf_len The length of the given buffer.
+ * @return The number of bytes peeked, 0 if the peer closed the connection,
+ *  NET_WOULD_BLOCK if more input is needed, -1 on failure.
+ */
+ssize_t tls_engine_peek(struct tls_engine_t *engine, void *buf,
+                        size_t buf_len) __nonnull((1, 2));
+
+/**
+ * Encrypt the buffer into the engine's output.
+ * Writing before the handshake is done drives the handshake instead.
+ *
+ * @param[in] engine The TLS engine.
+ * @param[in] buf The plaintext.
+ * @param[in] buf_len The length of the plaintext.
+ * @return The number of bytes consumed, NET_WOULD_BLOCK if the handshake
+ *  needs more input first, -1 on failure.
+ */
+ssize_t tls_engine_write(struct tls_engine_t *engine, const void *buf,
+                         size_t buf_len) __nonnull((1, 2));
+
+/**
+ * Get the number of ciphertext bytes waiting to be sent.
+ *
+ * @param[in] engine The TLS engine.
+ * @return The number of pending output bytes.
+ */
+size_t tls_engine_pending(struct tls_engine_t *engine) __nonnull((1));
+
+/**
+ * Move pending ciphertext out of the engine.
+ *
+ * @param[in] engine The TLS engine.
+ * @param[out] buf The buffer to populate.
+ * @param[in] buf_len The length of the given buffer.
+ * @return The number of bytes taken.
+ */
+size_t tls_engine_take(struct tls_engine_t *engine, uint8_t *buf,
+                       size_t buf_len) __nonnull((1, 2));
+
+/**
+ * Queue a close_notify alert, take and send the output afterwards.
+ *
+ * @param[in] engine The TLS engine.
+ */
+void tls_engine_shutdown(struct tls_engine_t *engine) __nonnull((1));
+
+/**
+ * Destroy the TLS engine.
+ * The engine is automatically NULL'ed out.
+ *
+ * @param[in] engine The TLS engine.
+ */
+void tls_engine_destroy(struct tls_engine_t **engine);
+
+/**
+ * Transport of connections wrapped by tls_engine_wrap.
+ */
+extern const struct net_transport_t tls_engine_transport;
+
+/**
+ * Run TLS through the engine on top of the connection's current transport.
+ * The connection keeps its socket so it can still be polled.
+ *
+ * The handshake is driven by the first reads/writes. A write encrypts the
+ * whole buffer and sends all pending records with one write on the wrapped
+ * transport. On a non-blocking connection, a write that returns
+ * NET_WOULD_BLOCK must be retried with the same data, like SSL_write, the
+ * records may already hold part of it.
+ * Closing the connection sends a close_notify, destroys the engine and
+ * closes the wrapped connection.
+ *
+ * @param[in,out] info The connection to wrap.
+ * @param[in] engine The TLS engine, owned by the connection on success.
+ * @return True on success, false otherwise.
+ */
+bool tls_engine_wrap(struct net_info_t *info, struct tls_engine_t *engine)
+    __nonnull((1, 2));
+
+#endif
+
+__END_DECLS
+
+#endif
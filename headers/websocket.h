@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "net.h"
 #include "protocol.h"
 #include "reader.h"
 #include "unicode_str.h"
@@ -17,9 +18,6 @@ __BEGIN_DECLS
  */
 const char * lib_version();
 
-// forward ref
-struct net_info_t;
-
 /**
  * Internal WebSocket client data.
  */
@@ -38,6 +36,10 @@ struct ws_client_t {
    * The Host portion of the URL.
    */
   char *host;
+  /**
+   * Path of the Unix domain socket for ws+unix URLs, NULL for TCP.
+   */
+  char *unix_path;
   /**
    * The port.
    */
@@ -47,6 +49,12 @@ struct ws_client_t {
    * Default is 13.
    */
   unsigned short version;
+  /**
+   * Options for establishing the connection: the connect deadline and the
+   * socket tuning (TCP_NODELAY, buffer sizes, ...).
+   * Defaults come from net_options_init.
+   */
+  struct net_options_t net_options;
 #ifdef WEBC_USE_SSL
   /**
    * Flag to use TLS connection.
@@ -68,6 +76,28 @@ typedef bool(on_message_callback)(struct ws_client_t *client,
                                   struct ws_message_t *msg,
                                   void *context);
 
+/**
+ * Result of processing a client's connection.
+ */
+enum ws_client_status_t {
+  /**
+   * Everything available was handled, wait for more data.
+   */
+  WS_CLIENT_OK,
+  /**
+   * The message callback returned false.
+   */
+  WS_CLIENT_STOPPED,
+  /**
+   * The connection was closed by the server.
+   */
+  WS_CLIENT_CLOSED,
+  /**
+   * The connection failed.
+   */
+  WS_CLIENT_ERROR,
+};
+
 /**
  * Initialize ws_client_t with all default values.
  * @param client The WebSocket client.
@@ -77,6 +107,8 @@ bool ws_client_init(struct ws_client_t* client);
 
 /**
  * Create WebSocket client from the given URL.
+ * Besides ws:// and wss:// URLs, ws+unix:///path/to.sock:/ws connects to a
+ * Unix domain socket at /path/to.sock and requests /ws.
  *
  * @param url The URL to parse.
  * @param len The length of the URL string.
@@ -93,6 +125,18 @@ bool ws_client_from_str(const char *url, size_t len,
  */
 bool ws_client_connect(struct ws_client_t *client);
 
+/**
+ * Run the WebSocket upgrade over an already established connection, e.g.
+ * one end of net_pipe or a connection with a custom transport.
+ * The client takes ownership of the connection, it is closed on failure.
+ *
+ * @param client The WebSocket Client, host and path are used for the
+ *  upgrade request.
+ * @param info The established connection.
+ * @return True if successful, False otherwise.
+ */
+bool ws_client_upgrade(struct ws_client_t *client, struct net_info_t *info);
+
 /**
  * Listen for the next WebSocket message for the client and populate the out
  * message param. By default, this function blocks while waiting for a message.
@@ -141,6 +185,128 @@ bool ws_client_write(struct ws_client_t *client, enum ws_opcode_t type,
 bool ws_client_write_msg(struct ws_client_t *client, struct ws_message_t *msg)
     __nonnull((1, 2));
 
+/**
+ * Queue a message to be sent as soon as the connection is ready.
+ * Messages queued before ws_client_connect are sent together in one write
+ * right after the server's upgrade response is validated, so subscriptions
+ * don't need an extra round trip through the caller.
+ * Must be called after ws_client_init/ws_client_from_str.
+ * Queued messages survive a failed ws_client_connect/ws_client_upgrade and
+ * go out with the next successful one, e.g. after a reconnect. They are only
+ * dropped if the connection fails while they are being sent, or by
+ * ws_client_free.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] type The OPCODE type of the message.
+ * @param[in] body The body of the message, it is copied.
+ * @return True on success, False otherwise.
+ */
+bool ws_client_queue_msg(struct ws_client_t *client, enum ws_opcode_t type,
+                         byte_array body) __nonnull((1));
+
+/**
+ * Write out all queued messages in as few writes as possible.
+ *
+ * @param[in] client The WebSocket client.
+ * @return True on success, False otherwise.
+ */
+bool ws_client_flush(struct ws_client_t *client) __nonnull((1));
+
+/**
+ * Get the socket file descriptor of a connected client.
+ *
+ * @param[in] client The WebSocket client.
+ * @return The file descriptor, -1 if the client is not connected.
+ */
+int ws_client_get_fd(struct ws_client_t *client) __nonnull((1));
+
+/**
+ * Toggle non-blocking mode on a connected client.
+ * In non-blocking mode writes that can't complete are kept in the client's
+ * pending buffer and finished by ws_client_flush/ws_client_process.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] enable True to enable non-blocking mode.
+ * @return True on success, False otherwise.
+ */
+bool ws_client_set_nonblocking(struct ws_client_t *client, bool enable)
+    __nonnull((1));
+
+/**
+ * Toggle deferred writes on a connected client.
+ * With deferred writes every message is only appended to the client's
+ * pending buffer, the owner of the connection takes it with
+ * ws_client_take_pending and sends it. Used to batch sends across clients.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] enable True to enable deferred writes.
+ * @return True on success, False otherwise.
+ */
+bool ws_client_defer_writes(struct ws_client_t *client, bool enable)
+    __nonnull((1));
+
+/**
+ * Move the client's pending bytes out of the client.
+ * The caller owns the returned buffer and must free it.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[out] out The pending bytes.
+ * @return True if there were pending bytes, False otherwise.
+ */
+bool ws_client_take_pending(struct ws_client_t *client, byte_array *out)
+    __nonnull((1, 2));
+
+/**
+ * Check if the client has bytes waiting to be written.
+ *
+ * @param[in] client The WebSocket client.
+ * @return True if there are pending bytes, False otherwise.
+ */
+bool ws_client_has_pending(struct ws_client_t *client) __nonnull((1));
+
+/**
+ * Handle everything that is ready on the client's connection without
+ * blocking: finish pending writes, read until the socket would block and
+ * dispatch every complete message like ws_client_on_msg does.
+ * The client is not freed when the server closes the connection.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] cb The callback for TEXT and BIN messages.
+ * @param[in] context The user supplied data.
+ * @return The status of the connection.
+ */
+enum ws_client_status_t ws_client_process(struct ws_client_t *client,
+                                          on_message_callback cb,
+                                          void *context) __nonnull((1, 2));
+
+/**
+ * Handle bytes that were received for the client outside of the library,
+ * e.g. completed by io_uring, and dispatch every complete message like
+ * ws_client_process does.
+ *
+ * @param[in] client The WebSocket client.
+ * @param[in] buf The received bytes.
+ * @param[in] len The number of received bytes.
+ * @param[in] cb The callback for TEXT and BIN messages.
+ * @param[in] context The user supplied data.
+ * @return The status of the connection.
+ */
+enum ws_client_status_t ws_client_process_bytes(struct ws_client_t *client,
+                                                const uint8_t *buf, size_t len,
+                                                on_message_callback cb,
+                                                void *context)
+    __nonnull((1, 4));
+
+/**
+ * Get the number of bytes received by ws_client_process and
+ * ws_client_process_bytes so far, e.g. to tell a readable connection from
+ * one that only became writable.
+ *
+ * @param[in] client The WebSocket client.
+ * @return The number of received bytes.
+ */
+uint64_t ws_client_rx_bytes(struct ws_client_t *client) __nonnull((1));
+
 /**
  * Set the net info data for the websocket client.
  *
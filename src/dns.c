@@ -0,0 +1,379 @@
+#include "headers/dns.h"
+#include "string_ops.h"
+
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// longest host name (253) + ':' + longest port (5) + null.
+#define DNS_KEY_MAX_LEN 260
+
+struct dns_cache_entry_t {
+  char key[DNS_KEY_MAX_LEN];
+  int64_t expires_ms;
+  struct dns_result_t result;
+};
+
+/**
+ * Lookup in progress, later callers for the same key wait for its result
+ * instead of calling getaddrinfo themselves.
+ */
+struct dns_inflight_t {
+  char key[DNS_KEY_MAX_LEN];
+  bool busy;
+  bool done;
+  bool ok;
+  unsigned int waiters;
+  struct dns_result_t result;
+};
+
+/**
+ * Pending asynchronous resolve.
+ */
+struct dns_request_t {
+  char *host;
+  char *port;
+  dns_callback *cb;
+  void *context;
+  struct dns_request_t *next;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dns_cache_entry_t cache[DNS_CACHE_SIZE];
+static unsigned int cache_ttl_ms = DNS_CACHE_TTL_MS;
+
+static pthread_mutex_t inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inflight_cond = PTHREAD_COND_INITIALIZER;
+static struct dns_inflight_t inflight[DNS_CACHE_SIZE];
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct dns_request_t *queue_head = NULL;
+static struct dns_request_t *queue_tail = NULL;
+static pthread_t resolver_thread;
+static bool resolver_running = false;
+// set while dns_shutdown waits for the thread, new requests are refused.
+static bool resolver_stopping = false;
+
+static int64_t dns_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static bool dns_make_key(const char *host, const char *port,
+                         char key[DNS_KEY_MAX_LEN]) {
+  const int n = snprintf(key, DNS_KEY_MAX_LEN, "%s:%s", host, port);
+  return n > 0 && n < DNS_KEY_MAX_LEN;
+}
+
+bool dns_cache_lookup(const char *restrict host, const char *restrict port,
+                      struct dns_result_t *out) {
+  char key[DNS_KEY_MAX_LEN];
+  if (!dns_make_key(host, port, key)) {
+    return false;
+  }
+  const int64_t now = dns_now_ms();
+  bool found = false;
+  pthread_mutex_lock(&cache_lock);
+  for (size_t i = 0; i < DNS_CACHE_SIZE; ++i) {
+    if (cache[i].expires_ms > now && strcmp(cache[i].key, key) == 0) {
+      *out = cache[i].result;
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return found;
+}
+
+static void dns_cache_store(const char *key, const struct dns_result_t *result) {
+  const int64_t now = dns_now_ms();
+  pthread_mutex_lock(&cache_lock);
+  if (cache_ttl_ms == 0) {
+    pthread_mutex_unlock(&cache_lock);
+    return;
+  }
+  // reuse the entry for this key, otherwise evict the one closest to expiring.
+  size_t slot = 0;
+  for (size_t i = 0; i < DNS_CACHE_SIZE; ++i) {
+    if (strcmp(cache[i].key, key) == 0) {
+      slot = i;
+      break;
+    }
+    if (cache[i].expires_ms < cache[slot].expires_ms) {
+      slot = i;
+    }
+  }
+  strcpy(cache[slot].key, key);
+  cache[slot].expires_ms = now + cache_ttl_ms;
+  cache[slot].result = *result;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+static bool dns_getaddrinfo(const char *host, const char *port,
+                            struct dns_result_t *out) {
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  const int err = getaddrinfo(host, port, &hints, &res);
+  if (err != 0) {
+    fprintf(stderr, "failed to get address info - host:\"%s\", port:\"%s\".\n",
+            host, port);
+    fprintf(stderr, "error: %s\n", gai_strerror(err));
+    return false;
+  }
+  out->len = 0;
+  for (struct addrinfo *rp = res; rp != NULL && out->len < DNS_MAX_ADDRS;
+       rp = rp->ai_next) {
+    if (rp->ai_addrlen > sizeof(struct sockaddr_storage)) {
+      continue;
+    }
+    struct dns_addr_t *addr = &out->addrs[out->len];
+    addr->family = rp->ai_family;
+    addr->socktype = rp->ai_socktype;
+    addr->protocol = rp->ai_protocol;
+    addr->addr_len = rp->ai_addrlen;
+    memcpy(&addr->addr, rp->ai_addr, rp->ai_addrlen);
+    ++out->len;
+  }
+  freeaddrinfo(res);
+  return out->len > 0;
+}
+
+/**
+ * Wait for the lookup of the key another caller started, or claim a slot
+ * for the caller's own lookup.
+ *
+ * @return The slot owned by the caller, NULL if the lookup was answered
+ *  (answered, ok and out are set) or no slot was free.
+ */
+static struct dns_inflight_t *dns_inflight_join(const char *host,
+                                                const char *port,
+                                                const char *key,
+                                                struct dns_result_t *out,
+                                                bool *answered, bool *ok) {
+  *answered = false;
+  *ok = false;
+  pthread_mutex_lock(&inflight_lock);
+  struct dns_inflight_t *free_slot = NULL;
+  for (size_t i = 0; i < DNS_CACHE_SIZE; ++i) {
+    struct dns_inflight_t *slot = &inflight[i];
+    if (!slot->busy) {
+      free_slot = free_slot != NULL ? free_slot : slot;
+      continue;
+    }
+    if (strcmp(slot->key, key) != 0) {
+      continue;
+    }
+    ++slot->waiters;
+    while (!slot->done) {
+      pthread_cond_wait(&inflight_cond, &inflight_lock);
+    }
+    // a failed lookup is shared as well, a second one would fail alike.
+    *answered = true;
+    *ok = slot->ok;
+    *out = slot->result;
+    // the last caller out frees the slot.
+    if (--slot->waiters == 0) {
+      slot->busy = false;
+    }
+    pthread_mutex_unlock(&inflight_lock);
+    return NULL;
+  }
+  // a lookup that just finished stored its result before leaving.
+  if (dns_cache_lookup(host, port, out)) {
+    *answered = true;
+    *ok = true;
+    free_slot = NULL;
+  } else if (free_slot != NULL) {
+    strcpy(free_slot->key, key);
+    free_slot->busy = true;
+    free_slot->done = false;
+    free_slot->waiters = 0;
+  }
+  pthread_mutex_unlock(&inflight_lock);
+  return free_slot;
+}
+
+/**
+ * Hand the result of the caller's lookup to everyone waiting for it.
+ */
+static void dns_inflight_finish(struct dns_inflight_t *slot, bool ok,
+                                const struct dns_result_t *result) {
+  pthread_mutex_lock(&inflight_lock);
+  slot->done = true;
+  slot->ok = ok;
+  if (ok) {
+    slot->result = *result;
+  }
+  if (slot->waiters == 0) {
+    slot->busy = false;
+  }
+  pthread_cond_broadcast(&inflight_cond);
+  pthread_mutex_unlock(&inflight_lock);
+}
+
+bool dns_resolve(const char *restrict host, const char *restrict port,
+                 struct dns_result_t *out) {
+  char key[DNS_KEY_MAX_LEN];
+  if (!dns_make_key(host, port, key)) {
+    fprintf(stderr, "host name is too long.\n");
+    return false;
+  }
+  if (dns_cache_lookup(host, port, out)) {
+    return true;
+  }
+  bool answered;
+  bool ok;
+  struct dns_inflight_t *slot =
+      dns_inflight_join(host, port, key, out, &answered, &ok);
+  if (answered) {
+    return ok;
+  }
+  // without a free slot the lookup runs on its own.
+  ok = dns_getaddrinfo(host, port, out);
+  if (ok) {
+    dns_cache_store(key, out);
+  }
+  if (slot != NULL) {
+    dns_inflight_finish(slot, ok, out);
+  }
+  return ok;
+}
+
+static void dns_request_free(struct dns_request_t *req) {
+  free(req->host);
+  free(req->port);
+  free(req);
+}
+
+static void *dns_resolver_main(void *arg) {
+  (void)arg;
+  while (true) {
+    pthread_mutex_lock(&queue_lock);
+    while (resolver_running && queue_head == NULL) {
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+    if (!resolver_running) {
+      pthread_mutex_unlock(&queue_lock);
+      break;
+    }
+    struct dns_request_t *req = queue_head;
+    queue_head = req->next;
+    if (queue_head == NULL) {
+      queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    struct dns_result_t result;
+    const bool ok = dns_resolve(req->host, req->port, &result);
+    req->cb(ok ? &result : NULL, req->context);
+    dns_request_free(req);
+  }
+  return NULL;
+}
+
+bool dns_resolve_async(const char *restrict host, const char *restrict port,
+                       dns_callback cb, void *context) {
+  struct dns_request_t *req = malloc(sizeof(struct dns_request_t));
+  if (req == NULL) {
+    return false;
+  }
+  req->host = str_dup(host, strlen(host));
+  req->port = str_dup(port, strlen(port));
+  req->cb = cb;
+  req->context = context;
+  req->next = NULL;
+  if (req->host == NULL || req->port == NULL) {
+    dns_request_free(req);
+    return false;
+  }
+  pthread_mutex_lock(&queue_lock);
+  if (resolver_stopping) {
+    pthread_mutex_unlock(&queue_lock);
+    fprintf(stderr, "the resolver is shutting down.\n");
+    dns_request_free(req);
+    return false;
+  }
+  if (!resolver_running) {
+    if (pthread_create(&resolver_thread, NULL, dns_resolver_main, NULL) != 0) {
+      pthread_mutex_unlock(&queue_lock);
+      fprintf(stderr, "failed to start the resolver thread.\n");
+      dns_request_free(req);
+      return false;
+    }
+    resolver_running = true;
+  }
+  if (queue_tail != NULL) {
+    queue_tail->next = req;
+  } else {
+    queue_head = req;
+  }
+  queue_tail = req;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  return true;
+}
+
+void dns_cache_set_ttl(unsigned int ttl_ms) {
+  pthread_mutex_lock(&cache_lock);
+  cache_ttl_ms = ttl_ms;
+  pthread_mutex_unlock(&cache_lock);
+  if (ttl_ms == 0) {
+    dns_cache_clear();
+  }
+}
+
+void dns_cache_clear() {
+  pthread_mutex_lock(&cache_lock);
+  memset(cache, 0, sizeof(cache));
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void dns_cache_remove(const char *restrict host, const char *restrict port) {
+  char key[DNS_KEY_MAX_LEN];
+  if (!dns_make_key(host, port, key)) {
+    return;
+  }
+  pthread_mutex_lock(&cache_lock);
+  for (size_t i = 0; i < DNS_CACHE_SIZE; ++i) {
+    if (strcmp(cache[i].key, key) == 0) {
+      memset(&cache[i], 0, sizeof(struct dns_cache_entry_t));
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void dns_shutdown() {
+  pthread_mutex_lock(&queue_lock);
+  if (!resolver_running || resolver_stopping) {
+    pthread_mutex_unlock(&queue_lock);
+    return;
+  }
+  resolver_running = false;
+  resolver_stopping = true;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  // the current lookup, if any, finishes before the thread exits.
+  pthread_join(resolver_thread, NULL);
+  pthread_mutex_lock(&queue_lock);
+  struct dns_request_t *req = queue_head;
+  queue_head = NULL;
+  queue_tail = NULL;
+  // later requests start a new thread.
+  resolver_stopping = false;
+  pthread_mutex_unlock(&queue_lock);
+  // callers may wait on the context, every request gets an answer.
+  while (req != NULL) {
+    struct dns_request_t *next = req->next;
+    req->cb(NULL, req->context);
+    dns_request_free(req);
+    req = next;
+  }
+}
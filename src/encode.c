@@ -1,8 +1,6 @@
 #include "headers/encode.h"
-#include "magic.h"
-#include "string_ops.h"
+#include "headers/simd.h"
 
-#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -11,23 +9,15 @@
 #include <stdio.h>
 #endif
 
-#ifndef WEBC_USE_SSL
-// these are only for if we compile without OpenSSL
-#define REQUEST_NOONCE "7Wrl5Wp3kkEaYOVhio4o6w=="
-#define RESPONSE_NOONCE "mj/2Q6QlJ3Y5pun3vzHGmTO/xgs="
-#else
-
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
-#include <openssl/evp.h>
-#include <openssl/sha.h>
-#include <openssl/types.h>
-
 // Value comes from the RFC page 19 bullet number 4.
 // https://datatracker.ietf.org/doc/html/rfc6455#page-19
 #define WS_KEY_UUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#endif
+#define WS_KEY_UUID_LEN (sizeof(WS_KEY_UUID) - 1)
+// keys are 24 characters (16 random bytes), leave room for odd clients.
+#define WS_KEY_MAX_LEN 64
 
+#define SHA1_BLOCK_LEN 64
+#define _ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 
 void populate_rand(uint8_t *buf, size_t len) {
   if (buf == NULL || len == 0) {
@@ -41,74 +31,193 @@ void populate_rand(uint8_t *buf, size_t len) {
   }
 }
 
+size_t base64_encode_buf(const uint8_t *restrict buf, size_t len,
+                         char *restrict out, size_t out_len) {
+  const size_t result_len = BASE64_ENCODE_LEN(len);
+  if (len == 0 || out_len < (result_len + 1)) {
+    return 0;
+  }
+  const size_t offset = base64_encode_blocks(out, buf, len);
+  const size_t remaining = len - offset;
+  if (remaining > 0) {
+    // encode the zero filled last group then overwrite with padding.
+    uint8_t last[3] = {0};
+    memcpy(last, &buf[offset], remaining);
+    char *tail = &out[result_len - 4];
+    (void)base64_encode_blocks(tail, last, 3);
+    tail[3] = '=';
+    if (remaining == 1) {
+      tail[2] = '=';
+    }
+  }
+  out[result_len] = '\0';
+  return result_len;
+}
+
+size_t base64_decode_buf(const char *restrict str, size_t len,
+                         uint8_t *restrict out, size_t out_len) {
+  if (len == 0 || (len % 4) != 0 || out_len < BASE64_DECODE_LEN(len)) {
+    return 0;
+  }
+  size_t padding = 0;
+  if (str[len - 1] == '=') {
+    ++padding;
+    if (str[len - 2] == '=') {
+      ++padding;
+    }
+  }
+  // decode everything except the last group, which may contain padding.
+  const size_t body_len = len - 4;
+  if (!base64_decode_blocks(out, str, body_len)) {
+    return 0;
+  }
+  char last[4] = {str[body_len], str[body_len + 1], str[body_len + 2],
+                  str[body_len + 3]};
+  for (size_t i = 4 - padding; i < 4; ++i) {
+    last[i] = 'A';
+  }
+  uint8_t last_out[3];
+  if (!base64_decode_blocks(last_out, last, 4)) {
+    return 0;
+  }
+  const size_t result_len = BASE64_DECODE_LEN(len) - padding;
+  memcpy(&out[BASE64_DECODE_LEN(body_len)], last_out, 3 - padding);
+  return result_len;
+}
+
 char *base64_encode(uint8_t *buf, size_t len, size_t *output_length) {
   if (buf == NULL || len == 0) {
     return NULL;
   }
-#ifdef WEBC_USE_SSL
-  BIO *bio = NULL;
-  BIO *b64 = NULL;
-  b64 = BIO_new(BIO_f_base64());
-  bio = BIO_new(BIO_s_mem());
-  b64 = BIO_push(b64, bio);
-  // Ignore newlines - write everything in one line
-  BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-  (void)BIO_write(b64, buf, len);
-  (void)BIO_flush(b64);
+  const size_t buffer_len = BASE64_ENCODE_LEN(len) + 1;
+  char *buffer = (char *)malloc(buffer_len);
+  if (buffer == NULL) {
+    return NULL;
+  }
+  *output_length = base64_encode_buf(buf, len, buffer, buffer_len);
+  return buffer;
+}
 
-  BUF_MEM *buffer_ptr;
-  (void)BIO_get_mem_ptr(b64, &buffer_ptr);
+/**
+ * SHA-1 state.
+ */
+struct sha1_ctx_t {
+  uint32_t h[5];
+};
 
-  char *buffer = (char *)malloc(buffer_ptr->length + 1);
-  memcpy(buffer, buffer_ptr->data, buffer_ptr->length);
-  buffer[buffer_ptr->length] = '\0';
-  *output_length = buffer_ptr->length;
-  // free all
-  BIO_free_all(b64);
-  return buffer;
-#else
-  *output_length = strlen(REQUEST_NOONCE);
-  return str_dup(REQUEST_NOONCE, strlen(REQUEST_NOONCE));
-#endif
+static void sha1_block(struct sha1_ctx_t *ctx, const uint8_t *block) {
+  uint32_t w[80];
+  for (size_t i = 0; i < 16; ++i) {
+    w[i] = ((uint32_t)block[i * 4] << 24) |
+           ((uint32_t)block[(i * 4) + 1] << 16) |
+           ((uint32_t)block[(i * 4) + 2] << 8) | (uint32_t)block[(i * 4) + 3];
+  }
+  for (size_t i = 16; i < 80; ++i) {
+    w[i] = _ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+  uint32_t a = ctx->h[0];
+  uint32_t b = ctx->h[1];
+  uint32_t c = ctx->h[2];
+  uint32_t d = ctx->h[3];
+  uint32_t e = ctx->h[4];
+  for (size_t i = 0; i < 80; ++i) {
+    uint32_t f;
+    uint32_t k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDC;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6;
+    }
+    const uint32_t temp = _ROTL32(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = _ROTL32(b, 30);
+    b = a;
+    a = temp;
+  }
+  ctx->h[0] += a;
+  ctx->h[1] += b;
+  ctx->h[2] += c;
+  ctx->h[3] += d;
+  ctx->h[4] += e;
+}
+
+void sha1_digest(const uint8_t *buf, size_t len,
+                 uint8_t digest[SHA1_DIGEST_LEN]) {
+  struct sha1_ctx_t ctx = {
+      .h = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0},
+  };
+  size_t offset = 0;
+  for (; (offset + SHA1_BLOCK_LEN) <= len; offset += SHA1_BLOCK_LEN) {
+    sha1_block(&ctx, &buf[offset]);
+  }
+  // final block(s) with padding and the 64 bit message length in bits.
+  uint8_t tail[SHA1_BLOCK_LEN * 2] = {0};
+  const size_t remaining = len - offset;
+  if (remaining > 0) {
+    memcpy(tail, &buf[offset], remaining);
+  }
+  tail[remaining] = 0x80;
+  const size_t tail_len =
+      (remaining + 9) > SHA1_BLOCK_LEN ? SHA1_BLOCK_LEN * 2 : SHA1_BLOCK_LEN;
+  const uint64_t bit_len = (uint64_t)len * 8;
+  for (size_t i = 0; i < 8; ++i) {
+    tail[tail_len - 1 - i] = (bit_len >> (i * 8)) & 0xFF;
+  }
+  for (size_t i = 0; i < tail_len; i += SHA1_BLOCK_LEN) {
+    sha1_block(&ctx, &tail[i]);
+  }
+  for (size_t i = 0; i < 5; ++i) {
+    digest[i * 4] = (ctx.h[i] >> 24) & 0xFF;
+    digest[(i * 4) + 1] = (ctx.h[i] >> 16) & 0xFF;
+    digest[(i * 4) + 2] = (ctx.h[i] >> 8) & 0xFF;
+    digest[(i * 4) + 3] = ctx.h[i] & 0xFF;
+  }
+}
+
+size_t generate_accept_noonce(const char *restrict key, size_t key_len,
+                              char *restrict out, size_t out_len) {
+  if (key_len == 0 || key_len > WS_KEY_MAX_LEN) {
+    return 0;
+  }
+  // recreate response noonce
+  uint8_t concat_buf[WS_KEY_MAX_LEN + WS_KEY_UUID_LEN];
+  memcpy(concat_buf, key, key_len);
+  memcpy(&concat_buf[key_len], WS_KEY_UUID, WS_KEY_UUID_LEN);
+  // sha1 the response noonce
+  uint8_t digest[SHA1_DIGEST_LEN];
+  sha1_digest(concat_buf, key_len + WS_KEY_UUID_LEN, digest);
+  return base64_encode_buf(digest, SHA1_DIGEST_LEN, out, out_len);
 }
 
 bool check_response_noonce(uint8_t *buf, size_t buf_len, char *noonce,
                            size_t noonce_len) {
-  if (buf == NULL || buf_len == 0 || noonce == NULL || noonce_len == 0) {
+  if (buf == NULL || buf_len == 0 || noonce == NULL ||
+      noonce_len != WS_ACCEPT_NOONCE_LEN) {
     return false;
   }
-#ifdef WEBC_USE_SSL
-  size_t req_len = 0;
   // grab request noonce
-  char AUTO_C *req_noonce = base64_encode(buf, buf_len, &req_len);
-  if (req_noonce == NULL)
-    return false;
-
-  // recreate responce noonce
-  size_t resp_noonce_len = 0;
-  char AUTO_C *resp_noonce = concat(req_noonce, WS_KEY_UUID, &resp_noonce_len);
-  if (resp_noonce == NULL || resp_noonce_len == 0) {
+  char req_noonce[BASE64_ENCODE_LEN(WS_KEY_MAX_LEN) + 1];
+  const size_t req_len =
+      base64_encode_buf(buf, buf_len, req_noonce, sizeof(req_noonce));
+  if (req_len == 0) {
     return false;
   }
-
-  // sha1 the response noonce
-  uint8_t digest[SHA_DIGEST_LENGTH];
-  if (SHA1((const unsigned char *)resp_noonce, resp_noonce_len, digest) ==
-      NULL) {
-    return false;
-  }
-  size_t base64_resp_len = 0;
-  char AUTO_C *base64_resp_noonce =
-      base64_encode(digest, SHA_DIGEST_LENGTH, &base64_resp_len);
-  if (base64_resp_noonce == NULL || base64_resp_len == 0) {
+  char resp_noonce[WS_ACCEPT_NOONCE_LEN + 1];
+  if (generate_accept_noonce(req_noonce, req_len, resp_noonce,
+                             sizeof(resp_noonce)) == 0) {
     return false;
   }
 #ifdef DEBUG
-  printf("check response noonce concat: %s, %lu, %zu\n", resp_noonce, strlen(resp_noonce), resp_noonce_len);
-  printf("check response noonce: %s\n", base64_resp_noonce);
-#endif
-  return strncmp(base64_resp_noonce, noonce, noonce_len) == 0;
-#else
-  return strncmp(noonce, RESPONSE_NOONCE, strlen(RESPONSE_NOONCE)) == 0;
+  printf("check response noonce: %s\n", resp_noonce);
 #endif
+  return memcmp(resp_noonce, noonce, WS_ACCEPT_NOONCE_LEN) == 0;
 }
@@ -0,0 +1,278 @@
+#include "headers/handshake.h"
+#include "headers/net.h"
+#include "headers/websocket.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+enum ws_handshake_kind_t {
+  WS_HANDSHAKE_CONNECT,
+#ifdef WEBC_USE_SSL
+  WS_HANDSHAKE_ACCEPT,
+#endif
+};
+
+/**
+ * A handshake waiting for, running on or finished by a worker.
+ */
+struct ws_handshake_job_t {
+  enum ws_handshake_kind_t kind;
+  struct ws_client_t *client;
+  on_connected_callback *connected_cb;
+#ifdef WEBC_USE_SSL
+  struct net_info_t info;
+  unsigned int timeout_ms;
+  on_accepted_callback *accepted_cb;
+#endif
+  void *context;
+  bool ok;
+  struct ws_handshake_job_t *next;
+};
+
+/**
+ * Singly linked FIFO of jobs.
+ */
+struct ws_handshake_list_t {
+  struct ws_handshake_job_t *head;
+  struct ws_handshake_job_t *tail;
+};
+
+struct ws_handshake_pool_t {
+  pthread_t *threads;
+  unsigned int thread_len;
+  unsigned int max_queued;
+  /**
+   * Job state, guarded by lock.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct ws_handshake_list_t queued;
+  struct ws_handshake_list_t done;
+  unsigned int queued_len;
+  unsigned int running;
+  bool stopping;
+  // written by the workers to wake up the I/O thread.
+  int wake_fds[2];
+};
+
+static void handshake_list_push(struct ws_handshake_list_t *list,
+                                struct ws_handshake_job_t *job) {
+  job->next = NULL;
+  if (list->tail != NULL) {
+    list->tail->next = job;
+  } else {
+    list->head = job;
+  }
+  list->tail = job;
+}
+
+static struct ws_handshake_job_t *
+handshake_list_pop(struct ws_handshake_list_t *list) {
+  struct ws_handshake_job_t *job = list->head;
+  if (job != NULL) {
+    list->head = job->next;
+    if (list->head == NULL) {
+      list->tail = NULL;
+    }
+  }
+  return job;
+}
+
+static void handshake_run(struct ws_handshake_job_t *job) {
+  switch (job->kind) {
+  case WS_HANDSHAKE_CONNECT:
+    job->ok = ws_client_connect(job->client);
+    break;
+#ifdef WEBC_USE_SSL
+  case WS_HANDSHAKE_ACCEPT:
+    job->ok = net_handshake(&job->info, job->timeout_ms);
+    break;
+#endif
+  }
+}
+
+static void handshake_finish(struct ws_handshake_job_t *job) {
+  switch (job->kind) {
+  case WS_HANDSHAKE_CONNECT:
+    job->connected_cb(job->client, job->ok, job->context);
+    break;
+#ifdef WEBC_USE_SSL
+  case WS_HANDSHAKE_ACCEPT:
+    job->accepted_cb(&job->info, job->ok, job->context);
+    break;
+#endif
+  }
+  free(job);
+}
+
+static void *handshake_worker_main(void *arg) {
+  struct ws_handshake_pool_t *pool = arg;
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->stopping && pool->queued.head == NULL) {
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    if (pool->stopping) {
+      break;
+    }
+    struct ws_handshake_job_t *job = handshake_list_pop(&pool->queued);
+    --pool->queued_len;
+    ++pool->running;
+    pthread_mutex_unlock(&pool->lock);
+
+    handshake_run(job);
+
+    pthread_mutex_lock(&pool->lock);
+    --pool->running;
+    handshake_list_push(&pool->done, job);
+    const char byte = 1;
+    (void)write(pool->wake_fds[1], &byte, sizeof(byte));
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+/**
+ * Queue the job for the workers.
+ *
+ * @return True on success, false if the queue is full.
+ */
+static bool handshake_submit(struct ws_handshake_pool_t *pool,
+                             struct ws_handshake_job_t *job) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->stopping || pool->queued_len >= pool->max_queued) {
+    pthread_mutex_unlock(&pool->lock);
+    free(job);
+    return false;
+  }
+  handshake_list_push(&pool->queued, job);
+  ++pool->queued_len;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+  return true;
+}
+
+struct ws_handshake_pool_t *ws_handshake_pool_create(unsigned int threads,
+                                                     unsigned int max_queued) {
+  struct ws_handshake_pool_t *result =
+      calloc(1, sizeof(struct ws_handshake_pool_t));
+  if (result == NULL) {
+    return NULL;
+  }
+  const unsigned int thread_len =
+      threads > 0 ? threads : WS_HANDSHAKE_POOL_THREADS;
+  result->max_queued = max_queued > 0 ? max_queued : WS_HANDSHAKE_POOL_MAX_QUEUED;
+  result->threads = calloc(thread_len, sizeof(pthread_t));
+  if (result->threads == NULL || pipe(result->wake_fds) == -1) {
+    free(result->threads);
+    free(result);
+    return NULL;
+  }
+  (void)fcntl(result->wake_fds[0], F_SETFL, O_NONBLOCK);
+  (void)fcntl(result->wake_fds[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&result->lock, NULL);
+  pthread_cond_init(&result->cond, NULL);
+  for (; result->thread_len < thread_len; ++result->thread_len) {
+    if (pthread_create(&result->threads[result->thread_len], NULL,
+                       handshake_worker_main, result) != 0) {
+      fprintf(stderr, "failed to start a handshake worker.\n");
+      ws_handshake_pool_destroy(&result);
+      return NULL;
+    }
+  }
+  return result;
+}
+
+bool ws_handshake_pool_connect(struct ws_handshake_pool_t *pool,
+                               struct ws_client_t *client,
+                               on_connected_callback cb, void *context) {
+  struct ws_handshake_job_t *job = calloc(1, sizeof(struct ws_handshake_job_t));
+  if (job == NULL) {
+    return false;
+  }
+  job->kind = WS_HANDSHAKE_CONNECT;
+  job->client = client;
+  job->connected_cb = cb;
+  job->context = context;
+  return handshake_submit(pool, job);
+}
+
+#ifdef WEBC_USE_SSL
+bool ws_handshake_pool_accept(struct ws_handshake_pool_t *pool,
+                              const struct net_info_t *info,
+                              unsigned int timeout_ms, on_accepted_callback cb,
+                              void *context) {
+  struct ws_handshake_job_t *job = calloc(1, sizeof(struct ws_handshake_job_t));
+  if (job == NULL) {
+    return false;
+  }
+  job->kind = WS_HANDSHAKE_ACCEPT;
+  job->info = *info;
+  job->timeout_ms = timeout_ms;
+  job->accepted_cb = cb;
+  job->context = context;
+  return handshake_submit(pool, job);
+}
+#endif
+
+int ws_handshake_pool_fd(struct ws_handshake_pool_t *pool) {
+  return pool->wake_fds[0];
+}
+
+unsigned int ws_handshake_pool_dispatch(struct ws_handshake_pool_t *pool) {
+  char buf[64];
+  while (read(pool->wake_fds[0], buf, sizeof(buf)) > 0) {
+  }
+  pthread_mutex_lock(&pool->lock);
+  struct ws_handshake_job_t *job = pool->done.head;
+  pool->done.head = NULL;
+  pool->done.tail = NULL;
+  pthread_mutex_unlock(&pool->lock);
+  // callbacks run unlocked so they can queue new handshakes.
+  unsigned int result = 0;
+  while (job != NULL) {
+    struct ws_handshake_job_t *next = job->next;
+    handshake_finish(job);
+    job = next;
+    ++result;
+  }
+  return result;
+}
+
+unsigned int ws_handshake_pool_pending(struct ws_handshake_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  const unsigned int result = pool->queued_len + pool->running;
+  pthread_mutex_unlock(&pool->lock);
+  return result;
+}
+
+void ws_handshake_pool_destroy(struct ws_handshake_pool_t **pool) {
+  if (pool == NULL || *pool == NULL) {
+    return;
+  }
+  struct ws_handshake_pool_t *p = *pool;
+  pthread_mutex_lock(&p->lock);
+  p->stopping = true;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  // running handshakes finish before their worker exits.
+  for (unsigned int i = 0; i < p->thread_len; ++i) {
+    pthread_join(p->threads[i], NULL);
+  }
+  (void)ws_handshake_pool_dispatch(p);
+  struct ws_handshake_job_t *job;
+  while ((job = handshake_list_pop(&p->queued)) != NULL) {
+    job->ok = false;
+    handshake_finish(job);
+  }
+  free(p->threads);
+  close(p->wake_fds[0]);
+  close(p->wake_fds[1]);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  free(p);
+  *pool = NULL;
+}
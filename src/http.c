@@ -3,12 +3,15 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include "base_str.h"
 #include "hash_map.h"
 #include "string_ops.h"
 #include "unicode_str.h"
 #include "magic.h"
+#include "headers/encode.h"
+#include "headers/simd.h"
 
 const char *http_method_get_string(enum http_method_t method) {
   switch (method) {
@@ -435,3 +438,159 @@ void http_request_free(struct http_request_t *r) {
   }
   http_message_free(&r->message);
 }
+
+/// HTTP Upgrade Request functions
+
+#define UPGRADE_KEY_LEN 16
+#define UPGRADE_VERSION "13"
+
+/**
+ * Case insensitive compare of the span against the given null-terminated
+ * string.
+ */
+static bool span_equals(const char *str, struct http_span_t span,
+                        const char *value) {
+  const size_t value_len = strlen(value);
+  return span.len == value_len &&
+         strncasecmp(&str[span.offset], value, value_len) == 0;
+}
+
+/**
+ * Check if the comma separated list in the span contains the given token.
+ */
+static bool span_has_token(const char *str, struct http_span_t span,
+                           const char *token) {
+  size_t index = span.offset;
+  const size_t end = span.offset + span.len;
+  while (index < end) {
+    size_t token_end = index + find_next_byte((const uint8_t *)&str[index],
+                                              end - index, ',');
+    struct http_span_t current = {.offset = index, .len = token_end - index};
+    while (current.len > 0 && (str[current.offset] == ' ' ||
+                               str[current.offset] == '\t')) {
+      ++current.offset;
+      --current.len;
+    }
+    while (current.len > 0 && (str[current.offset + current.len - 1] == ' ' ||
+                               str[current.offset + current.len - 1] == '\t')) {
+      --current.len;
+    }
+    if (span_equals(str, current, token)) {
+      return true;
+    }
+    index = token_end + 1;
+  }
+  return false;
+}
+
+/**
+ * Parse the request line. (i.e. GET /ws HTTP/1.1)
+ */
+static bool parse_upgrade_start_line(struct http_upgrade_request_t *r,
+                                     const char *str, size_t len) {
+  const uint8_t *buf = (const uint8_t *)str;
+  size_t word_len = find_next_byte(buf, len, ' ');
+  if (word_len == len) {
+    return false;
+  }
+  r->method = (word_len == strlen(HTTP_METHOD_GET) &&
+               strncmp(str, HTTP_METHOD_GET, word_len) == 0)
+                  ? HTTP_GET
+                  : HTTP_INVALID_METHOD;
+  size_t index = word_len + 1;
+  word_len = find_next_byte(&buf[index], len - index, ' ');
+  if ((index + word_len) == len || word_len == 0) {
+    return false;
+  }
+  r->path = (struct http_span_t){.offset = index, .len = word_len};
+  index += word_len + 1;
+  r->protocol = (struct http_span_t){.offset = index, .len = len - index};
+  return true;
+}
+
+enum http_parse_result_t
+http_upgrade_request_parse(struct http_upgrade_request_t *r, const char *str,
+                           size_t len) {
+  memset(r, 0, sizeof(struct http_upgrade_request_t));
+  r->method = HTTP_INVALID_METHOD;
+  // spans are 32 bits.
+  if (len > UINT32_MAX) {
+    return HTTP_PARSE_INVALID;
+  }
+  const uint8_t *buf = (const uint8_t *)str;
+  bool has_upgrade = false;
+  bool has_connection = false;
+  bool start_line = true;
+  size_t index = 0;
+  while (true) {
+    const size_t line_len = find_next_byte(&buf[index], len - index, '\r');
+    // need the \r\n pair to know the line is complete.
+    if ((index + line_len + 1) >= len) {
+      return HTTP_PARSE_INCOMPLETE;
+    }
+    if (str[index + line_len + 1] != '\n') {
+      return HTTP_PARSE_INVALID;
+    }
+    if (start_line) {
+      if (!parse_upgrade_start_line(r, &str[index], line_len)) {
+        return HTTP_PARSE_INVALID;
+      }
+      start_line = false;
+      index += line_len + 2;
+      continue;
+    }
+    // empty line marks the end of the headers.
+    if (line_len == 0) {
+      index += 2;
+      break;
+    }
+    const size_t key_len = find_next_byte(&buf[index], line_len, ':');
+    if (key_len == line_len || key_len == 0) {
+      return HTTP_PARSE_INVALID;
+    }
+    const struct http_span_t key = {.offset = index, .len = key_len};
+    struct http_span_t value = {.offset = index + key_len + 1,
+                                .len = line_len - key_len - 1};
+    // trim optional whitespace around the value.
+    while (value.len > 0 &&
+           (str[value.offset] == ' ' || str[value.offset] == '\t')) {
+      ++value.offset;
+      --value.len;
+    }
+    while (value.len > 0 && (str[value.offset + value.len - 1] == ' ' ||
+                             str[value.offset + value.len - 1] == '\t')) {
+      --value.len;
+    }
+    // only look at the headers we care about, everything else is skipped.
+    if (span_equals(str, key, "Host")) {
+      r->host = value;
+    } else if (span_equals(str, key, "Upgrade")) {
+      has_upgrade = span_has_token(str, value, "websocket");
+    } else if (span_equals(str, key, "Connection")) {
+      has_connection = span_has_token(str, value, "upgrade");
+    } else if (span_equals(str, key, "Sec-WebSocket-Key")) {
+      r->key = value;
+    } else if (span_equals(str, key, "Sec-WebSocket-Version")) {
+      r->version = value;
+    } else if (span_equals(str, key, "Sec-WebSocket-Protocol")) {
+      r->ws_protocol = value;
+    } else if (span_equals(str, key, "Sec-WebSocket-Extensions")) {
+      r->extensions = value;
+    }
+    index += line_len + 2;
+  }
+  r->header_len = index;
+  if (r->method != HTTP_GET || !span_equals(str, r->protocol, "HTTP/1.1") ||
+      !has_upgrade || !has_connection || r->host.len == 0 ||
+      !span_equals(str, r->version, UPGRADE_VERSION)) {
+    return HTTP_PARSE_INVALID;
+  }
+  // the key must be a base64 encoded 16 byte value.
+  uint8_t key_buf[BASE64_DECODE_LEN(BASE64_ENCODE_LEN(UPGRADE_KEY_LEN))];
+  if (r->key.len != BASE64_ENCODE_LEN(UPGRADE_KEY_LEN) ||
+      base64_decode_buf(&str[r->key.offset], r->key.len, key_buf,
+                        sizeof(key_buf)) != UPGRADE_KEY_LEN) {
+    return HTTP_PARSE_INVALID;
+  }
+  return HTTP_PARSE_OK;
+}
@@ -0,0 +1,884 @@
+// pthread_setaffinity_np
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "headers/loop.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef WEBC_USE_IO_URING
+#include <liburing.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+#define LOOP_MAX_EVENTS 256
+
+#ifdef WEBC_USE_IO_URING
+#define URING_ENTRIES 1024
+// provided receive buffers, the count must be a power of 2.
+#define URING_BUF_COUNT 256
+#define URING_BUF_LEN 8192
+#define URING_BUF_GROUP 0
+
+/**
+ * Operation kinds, stored in the low bits of an operation's user data next
+ * to the entry pointer.
+ */
+enum uring_op_t {
+  URING_OP_STOP = 0,
+  URING_OP_RECV,
+  URING_OP_SEND,
+  URING_OP_POLL,
+  URING_OP_POLLOUT,
+  URING_OP_CANCEL,
+};
+#define URING_OP_MASK 7
+#endif
+
+/**
+ * A client registered with the loop.
+ */
+struct ws_loop_entry_t {
+  struct ws_client_t *client;
+  on_message_callback *cb;
+  on_close_callback *close_cb;
+  void *context;
+  int fd;
+  bool removed;
+  struct ws_loop_entry_t *prev;
+  struct ws_loop_entry_t *next;
+#ifdef WEBC_USE_IO_URING
+  // number of io_uring operations still referencing this entry.
+  unsigned int ops;
+  // TLS clients are polled and read through net_read, plain clients are
+  // received into the provided buffers.
+  bool use_poll;
+  bool armed;
+  bool pollout_armed;
+  bool sending;
+  // bytes being sent, owned by the entry until the send completes.
+  byte_array out;
+  size_t out_offset;
+  // bytes left by the client when it was removed during a send.
+  byte_array tail;
+  // entries added since the last run, the reader may already hold messages.
+  struct ws_loop_entry_t *fresh_next;
+#endif
+};
+
+struct ws_loop_t {
+  int epoll_fd;
+  // wakes up the loop when it is stopped.
+  int stop_fd;
+  // set next to stop_fd, checked while spinning without waiting on it.
+  atomic_bool stopping;
+  bool running;
+  size_t count;
+  // registered clients.
+  struct ws_loop_entry_t *entries;
+  // removed clients, freed once the current batch of events is handled since
+  // later events in the batch may still point at them.
+  struct ws_loop_entry_t *removed;
+#ifdef WEBC_USE_IO_URING
+  // NULL when io_uring is not supported and epoll is used instead.
+  struct io_uring *ring;
+  struct io_uring_buf_ring *buf_ring;
+  uint8_t *bufs;
+  bool stop_armed;
+  struct ws_loop_entry_t *fresh;
+#endif
+};
+
+#ifdef WEBC_USE_IO_URING
+
+/**
+ * Set up the ring and the provided receive buffers.
+ *
+ * @return True if io_uring can be used, false to fall back to epoll.
+ */
+static bool ws_loop_uring_init(struct ws_loop_t *loop) {
+  struct io_uring *ring = malloc(sizeof(struct io_uring));
+  if (ring == NULL) {
+    return false;
+  }
+  if (io_uring_queue_init(URING_ENTRIES, ring, 0) < 0) {
+    free(ring);
+    return false;
+  }
+  // multishot receive landed in the same kernel release (6.0) as zero copy
+  // send, which is the closest thing the probe can tell us.
+  struct io_uring_probe *probe = io_uring_get_probe_ring(ring);
+  const bool supported =
+      probe != NULL && io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+  if (probe != NULL) {
+    io_uring_free_probe(probe);
+  }
+  int ret = 0;
+  struct io_uring_buf_ring *buf_ring = NULL;
+  if (supported) {
+    buf_ring = io_uring_setup_buf_ring(ring, URING_BUF_COUNT, URING_BUF_GROUP,
+                                       0, &ret);
+  }
+  uint8_t *bufs = NULL;
+  if (buf_ring != NULL) {
+    bufs = malloc(URING_BUF_COUNT * URING_BUF_LEN);
+  }
+  if (bufs == NULL) {
+    if (buf_ring != NULL) {
+      (void)io_uring_free_buf_ring(ring, buf_ring, URING_BUF_COUNT,
+                                   URING_BUF_GROUP);
+    }
+    io_uring_queue_exit(ring);
+    free(ring);
+    return false;
+  }
+  const int mask = io_uring_buf_ring_mask(URING_BUF_COUNT);
+  for (int i = 0; i < URING_BUF_COUNT; ++i) {
+    io_uring_buf_ring_add(buf_ring, &bufs[i * URING_BUF_LEN], URING_BUF_LEN, i,
+                          mask, i);
+  }
+  io_uring_buf_ring_advance(buf_ring, URING_BUF_COUNT);
+  loop->ring = ring;
+  loop->buf_ring = buf_ring;
+  loop->bufs = bufs;
+  return true;
+}
+
+static struct io_uring_sqe *ws_loop_sqe(struct ws_loop_t *loop) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(loop->ring);
+  if (sqe == NULL) {
+    // submission queue is full, hand what we have to the kernel.
+    (void)io_uring_submit(loop->ring);
+    sqe = io_uring_get_sqe(loop->ring);
+  }
+  if (sqe == NULL) {
+    fprintf(stderr, "io_uring submission queue is full.\n");
+  }
+  return sqe;
+}
+
+static inline uint64_t ws_loop_op_data(struct ws_loop_entry_t *entry,
+                                       enum uring_op_t op) {
+  return (uint64_t)(uintptr_t)entry | op;
+}
+
+/**
+ * Arm the multishot receive (or poll for TLS clients) of the entry.
+ */
+static bool ws_loop_uring_arm(struct ws_loop_t *loop,
+                              struct ws_loop_entry_t *entry) {
+  struct io_uring_sqe *sqe = ws_loop_sqe(loop);
+  if (sqe == NULL) {
+    return false;
+  }
+  if (entry->use_poll) {
+    io_uring_prep_poll_multishot(sqe, entry->fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, ws_loop_op_data(entry, URING_OP_POLL));
+  } else {
+    io_uring_prep_recv_multishot(sqe, entry->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    io_uring_sqe_set_data64(sqe, ws_loop_op_data(entry, URING_OP_RECV));
+  }
+  entry->armed = true;
+  ++entry->ops;
+  return true;
+}
+
+static bool ws_loop_uring_send(struct ws_loop_t *loop,
+                               struct ws_loop_entry_t *entry) {
+  struct io_uring_sqe *sqe = ws_loop_sqe(loop);
+  if (sqe == NULL) {
+    return false;
+  }
+  io_uring_prep_send(sqe, entry->fd, &entry->out.byte_data[entry->out_offset],
+                     entry->out.len - entry->out_offset, MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, ws_loop_op_data(entry, URING_OP_SEND));
+  entry->sending = true;
+  ++entry->ops;
+  return true;
+}
+
+/**
+ * Queue a send for whatever the client has written since the last one.
+ * Sends are only submitted with the next io_uring_submit so every client
+ * written to in a batch goes out in the same syscall.
+ */
+static bool ws_loop_uring_flush(struct ws_loop_t *loop,
+                                struct ws_loop_entry_t *entry) {
+  if (entry->use_poll) {
+    // TLS clients write through net_write, wait for room when it's full.
+    if (entry->pollout_armed || !ws_client_has_pending(entry->client)) {
+      return true;
+    }
+    struct io_uring_sqe *sqe = ws_loop_sqe(loop);
+    if (sqe == NULL) {
+      return false;
+    }
+    io_uring_prep_poll_add(sqe, entry->fd, POLLOUT);
+    io_uring_sqe_set_data64(sqe, ws_loop_op_data(entry, URING_OP_POLLOUT));
+    entry->pollout_armed = true;
+    ++entry->ops;
+    return true;
+  }
+  if (entry->sending || !ws_client_take_pending(entry->client, &entry->out)) {
+    return true;
+  }
+  entry->out_offset = 0;
+  return ws_loop_uring_send(loop, entry);
+}
+
+static void ws_loop_uring_cancel(struct ws_loop_t *loop,
+                                 struct ws_loop_entry_t *entry,
+                                 enum uring_op_t op) {
+  struct io_uring_sqe *sqe = ws_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+  io_uring_prep_cancel64(sqe, ws_loop_op_data(entry, op), 0);
+  io_uring_sqe_set_data64(sqe, URING_OP_CANCEL);
+}
+
+/**
+ * Cancel the entry's operations and keep what the client still has to send.
+ */
+static void ws_loop_uring_unlink(struct ws_loop_t *loop,
+                                 struct ws_loop_entry_t *entry) {
+  if (!entry->use_poll) {
+    // e.g. the echo of a close frame, sent even after the client is gone.
+    if (entry->sending) {
+      (void)ws_client_take_pending(entry->client, &entry->tail);
+    } else if (ws_client_take_pending(entry->client, &entry->out)) {
+      entry->out_offset = 0;
+      (void)ws_loop_uring_send(loop, entry);
+    }
+    (void)ws_client_defer_writes(entry->client, false);
+  }
+  if (entry->armed) {
+    ws_loop_uring_cancel(loop, entry,
+                         entry->use_poll ? URING_OP_POLL : URING_OP_RECV);
+  }
+  if (entry->pollout_armed) {
+    ws_loop_uring_cancel(loop, entry, URING_OP_POLLOUT);
+  }
+}
+
+static void ws_loop_entry_free(struct ws_loop_entry_t *entry) {
+  if (entry->out.byte_data != NULL) {
+    byte_array_free(&entry->out);
+  }
+  if (entry->tail.byte_data != NULL) {
+    byte_array_free(&entry->tail);
+  }
+  free(entry);
+}
+
+#else
+
+static void ws_loop_entry_free(struct ws_loop_entry_t *entry) { free(entry); }
+
+#endif
+
+struct ws_loop_t *ws_loop_create() {
+  struct ws_loop_t *loop = malloc(sizeof(struct ws_loop_t));
+  if (loop == NULL) {
+    return NULL;
+  }
+  memset(loop, 0, sizeof(struct ws_loop_t));
+  atomic_init(&loop->stopping, false);
+  loop->epoll_fd = -1;
+  loop->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (loop->stop_fd == -1) {
+    perror("eventfd");
+    free(loop);
+    return NULL;
+  }
+#ifdef WEBC_USE_IO_URING
+  if (ws_loop_uring_init(loop)) {
+    return loop;
+  }
+#ifdef DEBUG
+  fprintf(stderr, "io_uring is not supported, falling back to epoll.\n");
+#endif
+#endif
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd == -1) {
+    perror("epoll_create1");
+    close(loop->stop_fd);
+    free(loop);
+    return NULL;
+  }
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &ev) == -1) {
+    perror("epoll_ctl");
+    close(loop->stop_fd);
+    close(loop->epoll_fd);
+    free(loop);
+    return NULL;
+  }
+  return loop;
+}
+
+/**
+ * Start watching the entry with the loop's backend.
+ */
+static bool ws_loop_watch(struct ws_loop_t *loop,
+                          struct ws_loop_entry_t *entry) {
+#ifdef WEBC_USE_IO_URING
+  if (loop->ring != NULL) {
+#ifdef WEBC_USE_SSL
+    entry->use_poll = entry->client->use_tls;
+#endif
+    // plain clients never touch the socket themselves, their writes are
+    // batched into the ring.
+    const bool ok = entry->use_poll
+                        ? ws_client_set_nonblocking(entry->client, true)
+                        : ws_client_defer_writes(entry->client, true);
+    if (!ok || !ws_loop_uring_arm(loop, entry)) {
+      return false;
+    }
+    entry->fresh_next = loop->fresh;
+    loop->fresh = entry;
+    return true;
+  }
+#endif
+  if (!ws_client_set_nonblocking(entry->client, true)) {
+    return false;
+  }
+  struct epoll_event ev = {
+      .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+      .data.ptr = entry,
+  };
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, entry->fd, &ev) == -1) {
+    perror("epoll_ctl");
+    return false;
+  }
+  return true;
+}
+
+bool ws_loop_add(struct ws_loop_t *loop, struct ws_client_t *client,
+                 on_message_callback cb, on_close_callback close_cb,
+                 void *context) {
+  const int fd = ws_client_get_fd(client);
+  if (fd < 0) {
+    fprintf(stderr, "WebSocket client is not connected.\n");
+    return false;
+  }
+  struct ws_loop_entry_t *entry = malloc(sizeof(struct ws_loop_entry_t));
+  if (entry == NULL) {
+    return false;
+  }
+  memset(entry, 0, sizeof(struct ws_loop_entry_t));
+  entry->client = client;
+  entry->cb = cb;
+  entry->close_cb = close_cb;
+  entry->context = context;
+  entry->fd = fd;
+  if (!ws_loop_watch(loop, entry)) {
+    ws_loop_entry_free(entry);
+    return false;
+  }
+  entry->prev = NULL;
+  entry->next = loop->entries;
+  if (loop->entries != NULL) {
+    loop->entries->prev = entry;
+  }
+  loop->entries = entry;
+  ++loop->count;
+  return true;
+}
+
+/**
+ * Unregister the entry and move it to the removed list.
+ */
+static void ws_loop_unlink(struct ws_loop_t *loop,
+                           struct ws_loop_entry_t *entry) {
+#ifdef WEBC_USE_IO_URING
+  if (loop->ring != NULL) {
+    ws_loop_uring_unlink(loop, entry);
+  } else {
+    (void)epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, entry->fd, NULL);
+  }
+#else
+  (void)epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, entry->fd, NULL);
+#endif
+  if (entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    loop->entries = entry->next;
+  }
+  if (entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  }
+  entry->removed = true;
+  entry->prev = NULL;
+  entry->next = loop->removed;
+  loop->removed = entry;
+  --loop->count;
+}
+
+/**
+ * Remove the entry from the loop and hand the client back through the close
+ * callback.
+ */
+static void ws_loop_close(struct ws_loop_t *loop, struct ws_loop_entry_t *entry,
+                          enum ws_client_status_t status) {
+  ws_loop_unlink(loop, entry);
+  if (entry->close_cb != NULL) {
+    entry->close_cb(entry->client, status, entry->context);
+  }
+}
+
+static void ws_loop_free_removed(struct ws_loop_t *loop) {
+  struct ws_loop_entry_t **link = &loop->removed;
+  while (*link != NULL) {
+    struct ws_loop_entry_t *entry = *link;
+#ifdef WEBC_USE_IO_URING
+    // the ring still has operations pointing at this entry.
+    if (entry->ops > 0) {
+      link = &entry->next;
+      continue;
+    }
+#endif
+    *link = entry->next;
+    ws_loop_entry_free(entry);
+  }
+}
+
+bool ws_loop_remove(struct ws_loop_t *loop, struct ws_client_t *client) {
+  for (struct ws_loop_entry_t *entry = loop->entries; entry != NULL;
+       entry = entry->next) {
+    if (entry->client == client) {
+      ws_loop_unlink(loop, entry);
+#ifdef WEBC_USE_IO_URING
+      // the ring holds the socket until its recv is cancelled, submit now in
+      // case the loop isn't running to close it after this.
+      if (loop->ring != NULL) {
+        (void)io_uring_submit(loop->ring);
+      }
+#endif
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef WEBC_USE_IO_URING
+
+static void ws_loop_uring_recv(struct ws_loop_t *loop,
+                               struct ws_loop_entry_t *entry,
+                               struct io_uring_cqe *cqe) {
+  if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+    entry->armed = false;
+    --entry->ops;
+  }
+  enum ws_client_status_t status = WS_CLIENT_OK;
+  if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+    const unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    uint8_t *buf = &loop->bufs[bid * URING_BUF_LEN];
+    if (!entry->removed) {
+      status = ws_client_process_bytes(entry->client, buf, cqe->res, entry->cb,
+                                       entry->context);
+    }
+    // the reader copied what it needs, recycle the buffer right away.
+    io_uring_buf_ring_add(loop->buf_ring, buf, URING_BUF_LEN, bid,
+                          io_uring_buf_ring_mask(URING_BUF_COUNT), 0);
+    io_uring_buf_ring_advance(loop->buf_ring, 1);
+  } else if (cqe->res == 0) {
+    status = WS_CLIENT_CLOSED;
+  } else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+    // out of buffers only stops the multishot, it's re-armed below.
+    status = WS_CLIENT_ERROR;
+  }
+  if (entry->removed) {
+    return;
+  }
+  if (status != WS_CLIENT_OK) {
+    ws_loop_close(loop, entry, status);
+    return;
+  }
+  if ((!entry->armed && !ws_loop_uring_arm(loop, entry)) ||
+      !ws_loop_uring_flush(loop, entry)) {
+    ws_loop_close(loop, entry, WS_CLIENT_ERROR);
+  }
+}
+
+static void ws_loop_uring_sent(struct ws_loop_t *loop,
+                               struct ws_loop_entry_t *entry,
+                               struct io_uring_cqe *cqe) {
+  entry->sending = false;
+  --entry->ops;
+  if (cqe->res < 0) {
+    byte_array_free(&entry->out);
+    memset(&entry->out, 0, sizeof(byte_array));
+    if (!entry->removed) {
+      ws_loop_close(loop, entry, WS_CLIENT_ERROR);
+    }
+    return;
+  }
+  entry->out_offset += cqe->res;
+  if (entry->out_offset < entry->out.len) {
+    if (!ws_loop_uring_send(loop, entry) && !entry->removed) {
+      ws_loop_close(loop, entry, WS_CLIENT_ERROR);
+    }
+    return;
+  }
+  byte_array_free(&entry->out);
+  memset(&entry->out, 0, sizeof(byte_array));
+  if (entry->removed) {
+    if (entry->tail.len > 0) {
+      entry->out = entry->tail;
+      entry->out_offset = 0;
+      memset(&entry->tail, 0, sizeof(byte_array));
+      (void)ws_loop_uring_send(loop, entry);
+    }
+    return;
+  }
+  if (!ws_loop_uring_flush(loop, entry)) {
+    ws_loop_close(loop, entry, WS_CLIENT_ERROR);
+  }
+}
+
+static void ws_loop_uring_polled(struct ws_loop_t *loop,
+                                 struct ws_loop_entry_t *entry,
+                                 struct io_uring_cqe *cqe, bool pollout) {
+  if (pollout) {
+    entry->pollout_armed = false;
+    --entry->ops;
+  } else if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+    entry->armed = false;
+    --entry->ops;
+  }
+  if (entry->removed || cqe->res == -ECANCELED) {
+    return;
+  }
+  enum ws_client_status_t status = WS_CLIENT_ERROR;
+  if (cqe->res >= 0) {
+    status = ws_client_process(entry->client, entry->cb, entry->context);
+  }
+  if (status != WS_CLIENT_OK) {
+    ws_loop_close(loop, entry, status);
+    return;
+  }
+  if ((!entry->armed && !ws_loop_uring_arm(loop, entry)) ||
+      !ws_loop_uring_flush(loop, entry)) {
+    ws_loop_close(loop, entry, WS_CLIENT_ERROR);
+  }
+}
+
+static int ws_loop_uring_run_once(struct ws_loop_t *loop, int timeout_ms) {
+  // messages that arrived with the handshake response.
+  while (loop->fresh != NULL) {
+    struct ws_loop_entry_t *entry = loop->fresh;
+    loop->fresh = entry->fresh_next;
+    if (entry->removed) {
+      continue;
+    }
+    const enum ws_client_status_t status =
+        ws_client_process_bytes(entry->client, NULL, 0, entry->cb,
+                                entry->context);
+    if (status != WS_CLIENT_OK) {
+      ws_loop_close(loop, entry, status);
+    }
+  }
+  // pick up writes made outside of the loop's callbacks.
+  for (struct ws_loop_entry_t *entry = loop->entries; entry != NULL;
+       entry = entry->next) {
+    (void)ws_loop_uring_flush(loop, entry);
+  }
+  if (!loop->stop_armed) {
+    struct io_uring_sqe *sqe = ws_loop_sqe(loop);
+    if (sqe == NULL) {
+      return -1;
+    }
+    io_uring_prep_poll_multishot(sqe, loop->stop_fd, POLLIN);
+    io_uring_sqe_set_data64(sqe, URING_OP_STOP);
+    loop->stop_armed = true;
+  }
+  int ret;
+  if (timeout_ms < 0) {
+    ret = io_uring_submit_and_wait(loop->ring, 1);
+  } else {
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000,
+    };
+    struct io_uring_cqe *cqe = NULL;
+    ret = io_uring_submit_and_wait_timeout(loop->ring, &cqe, 1, &ts, NULL);
+  }
+  if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+    fprintf(stderr, "io_uring wait failed: %s\n", strerror(-ret));
+    return -1;
+  }
+  unsigned int head;
+  unsigned int count = 0;
+  struct io_uring_cqe *cqe;
+  io_uring_for_each_cqe(loop->ring, head, cqe) {
+    ++count;
+    const uint64_t data = io_uring_cqe_get_data64(cqe);
+    const enum uring_op_t op = data & URING_OP_MASK;
+    struct ws_loop_entry_t *entry =
+        (struct ws_loop_entry_t *)(uintptr_t)(data & ~(uint64_t)URING_OP_MASK);
+    switch (op) {
+    case URING_OP_STOP: {
+      uint64_t value;
+      (void)read(loop->stop_fd, &value, sizeof(value));
+      atomic_store(&loop->stopping, false);
+      loop->running = false;
+      if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+        loop->stop_armed = false;
+      }
+      break;
+    }
+    case URING_OP_RECV:
+      ws_loop_uring_recv(loop, entry, cqe);
+      break;
+    case URING_OP_SEND:
+      ws_loop_uring_sent(loop, entry, cqe);
+      break;
+    case URING_OP_POLL:
+      ws_loop_uring_polled(loop, entry, cqe, false);
+      break;
+    case URING_OP_POLLOUT:
+      ws_loop_uring_polled(loop, entry, cqe, true);
+      break;
+    default:
+      break;
+    }
+  }
+  io_uring_cq_advance(loop->ring, count);
+  // submit sends and re-arms queued while handling completions.
+  (void)io_uring_submit(loop->ring);
+  ws_loop_free_removed(loop);
+  return count;
+}
+
+#endif
+
+int ws_loop_run_once(struct ws_loop_t *loop, int timeout_ms) {
+#ifdef WEBC_USE_IO_URING
+  if (loop->ring != NULL) {
+    return ws_loop_uring_run_once(loop, timeout_ms);
+  }
+#endif
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  const int n = epoll_wait(loop->epoll_fd, events, LOOP_MAX_EVENTS, timeout_ms);
+  if (n == -1) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    perror("epoll_wait");
+    return -1;
+  }
+  for (int i = 0; i < n; ++i) {
+    struct ws_loop_entry_t *entry = events[i].data.ptr;
+    if (entry == NULL) {
+      uint64_t value;
+      (void)read(loop->stop_fd, &value, sizeof(value));
+      atomic_store(&loop->stopping, false);
+      loop->running = false;
+      continue;
+    }
+    if (entry->removed) {
+      continue;
+    }
+    enum ws_client_status_t status;
+    if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+      status = ws_client_process(entry->client, entry->cb, entry->context);
+    } else {
+      // only writable, finish what is pending.
+      status = ws_client_flush(entry->client) ? WS_CLIENT_OK : WS_CLIENT_ERROR;
+    }
+    // the callback may have removed the client already.
+    if (status == WS_CLIENT_OK || entry->removed) {
+      continue;
+    }
+    ws_loop_close(loop, entry, status);
+  }
+  ws_loop_free_removed(loop);
+  return n;
+}
+
+bool ws_loop_run(struct ws_loop_t *loop) {
+  loop->running = true;
+  while (loop->running && loop->count > 0) {
+    if (ws_loop_run_once(loop, -1) == -1) {
+      loop->running = false;
+      return false;
+    }
+  }
+  loop->running = false;
+  return true;
+}
+
+void ws_loop_spin_init(struct ws_loop_spin_t *spin) {
+  spin->cpu = -1;
+  spin->spin_us = WS_LOOP_SPIN_US;
+  spin->park_ms = -1;
+}
+
+static bool ws_loop_pin(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    fprintf(stderr, "failed to pin the loop to cpu %d: %s\n", cpu,
+            strerror(err));
+    return false;
+  }
+  return true;
+}
+
+static int64_t ws_loop_now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Message callback context while spinning, counts the dispatched messages.
+ */
+struct ws_loop_spin_ctx_t {
+  struct ws_loop_entry_t *entry;
+  unsigned int messages;
+};
+
+static bool ws_loop_spin_dispatch(struct ws_client_t *client,
+                                  struct ws_message_t *msg, void *context) {
+  struct ws_loop_spin_ctx_t *ctx = context;
+  ++ctx->messages;
+  return ctx->entry->cb(client, msg, ctx->entry->context);
+}
+
+/**
+ * Read every client once without waiting for readiness.
+ *
+ * @return The number of messages dispatched.
+ */
+static unsigned int ws_loop_sweep(struct ws_loop_t *loop) {
+  struct ws_loop_spin_ctx_t ctx = {.entry = NULL, .messages = 0};
+  struct ws_loop_entry_t *entry = loop->entries;
+  while (entry != NULL) {
+    struct ws_loop_entry_t *removed = loop->removed;
+    ctx.entry = entry;
+    const enum ws_client_status_t status =
+        ws_client_process(entry->client, ws_loop_spin_dispatch, &ctx);
+    if (status != WS_CLIENT_OK && !entry->removed) {
+      ws_loop_close(loop, entry, status);
+    }
+    // a removal may have unlinked the next entry, the rest waits for the
+    // next sweep.
+    if (loop->removed != removed) {
+      break;
+    }
+    entry = entry->next;
+  }
+  ws_loop_free_removed(loop);
+  return ctx.messages;
+}
+
+bool ws_loop_run_spin(struct ws_loop_t *loop,
+                      const struct ws_loop_spin_t *spin) {
+  if (spin->cpu >= 0 && !ws_loop_pin(spin->cpu)) {
+    return false;
+  }
+  loop->running = true;
+  int64_t last_msg = ws_loop_now_us();
+  while (loop->running && loop->count > 0) {
+    bool busy;
+#ifdef WEBC_USE_IO_URING
+    if (loop->ring != NULL) {
+      // reads are owned by the ring, spin on its completions.
+      const int n = ws_loop_run_once(loop, 0);
+      if (n == -1) {
+        loop->running = false;
+        return false;
+      }
+      busy = n > 0;
+    } else {
+      busy = ws_loop_sweep(loop) > 0;
+    }
+#else
+    busy = ws_loop_sweep(loop) > 0;
+#endif
+    if (atomic_exchange(&loop->stopping, false)) {
+      uint64_t value;
+      (void)read(loop->stop_fd, &value, sizeof(value));
+      break;
+    }
+    const int64_t now = ws_loop_now_us();
+    if (busy) {
+      last_msg = now;
+      continue;
+    }
+    if (spin->spin_us < 0 || now - last_msg < spin->spin_us) {
+      continue;
+    }
+    // quiet for long enough, sleep until the next event.
+    if (ws_loop_run_once(loop, spin->park_ms) == -1) {
+      loop->running = false;
+      return false;
+    }
+    last_msg = ws_loop_now_us();
+  }
+  loop->running = false;
+  return true;
+}
+
+bool ws_loop_stop(struct ws_loop_t *loop) {
+  atomic_store(&loop->stopping, true);
+  const uint64_t value = 1;
+  return write(loop->stop_fd, &value, sizeof(value)) == sizeof(value);
+}
+
+void ws_loop_destroy(struct ws_loop_t **loop) {
+  if (loop == NULL || *loop == NULL) {
+    return;
+  }
+#ifdef WEBC_USE_IO_URING
+  if ((*loop)->ring != NULL) {
+    // tearing down the ring cancels everything still in flight.
+    (void)io_uring_free_buf_ring((*loop)->ring, (*loop)->buf_ring,
+                                 URING_BUF_COUNT, URING_BUF_GROUP);
+    io_uring_queue_exit((*loop)->ring);
+    free((*loop)->ring);
+    free((*loop)->bufs);
+  }
+#endif
+  struct ws_loop_entry_t *entry = (*loop)->entries;
+  while (entry != NULL) {
+    struct ws_loop_entry_t *next = entry->next;
+    ws_loop_entry_free(entry);
+    entry = next;
+  }
+  entry = (*loop)->removed;
+  while (entry != NULL) {
+    struct ws_loop_entry_t *next = entry->next;
+    ws_loop_entry_free(entry);
+    entry = next;
+  }
+  close((*loop)->stop_fd);
+  if ((*loop)->epoll_fd != -1) {
+    close((*loop)->epoll_fd);
+  }
+  free(*loop);
+  *loop = NULL;
+}
+
+#endif
@@ -1,97 +1,364 @@
+// accept4
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "headers/net.h"
+#include "headers/dns.h"
 #include "magic.h"
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifndef BUFSIZ
 #define BUFSIZ 4096
 #endif
 
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+#ifndef SOCK_CLOEXEC
+#define SOCK_CLOEXEC 0
+#endif
+
 #ifdef WEBC_USE_SSL
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/ssl.h>
 #include <openssl/tls1.h>
 #include <openssl/types.h>
+#ifdef __linux__
+#include <linux/tls.h>
+#endif
+
+// TLS record content types.
+#define NET_TLS_RECORD_ALERT 21
+#define NET_TLS_RECORD_APP_DATA 23
+
+// longest host name (253) + ':' + longest port (5) + null.
+#define NET_SESSION_KEY_MAX_LEN 260
 
-static SSL_CTX *ctx = NULL;
 /**
- * Init
+ * A resumable TLS session for a host:port.
  */
-bool net_init_client(const char *restrict cert, const char *restrict path) {
-  if (ctx == NULL) {
-    SSL_library_init();
-    SSL_load_error_strings();
-    OpenSSL_add_all_algorithms();
-    ctx = SSL_CTX_new(TLS_client_method());
-    if (ctx == NULL) {
-      ERR_print_errors_fp(stderr);
-      return false;
+struct net_session_entry_t {
+  char key[NET_SESSION_KEY_MAX_LEN];
+  SSL_SESSION *session;
+  uint64_t last_used;
+};
+
+/**
+ * Bounded client session cache, least recently used entries are evicted.
+ * Holds TLS 1.3 tickets as well as TLS 1.2 session IDs/tickets.
+ */
+struct net_session_cache_t {
+  pthread_mutex_t lock;
+  struct net_session_entry_t entries[NET_SESSION_CACHE_SIZE];
+  uint64_t clock;
+};
+
+struct net_tls_ctx_t {
+  SSL_CTX *ssl_ctx;
+  /**
+   * Sessions of the client connections made with this context.
+   */
+  struct net_session_cache_t session_cache;
+};
+
+// contexts used by connections that don't bring their own.
+static struct net_tls_ctx_t *default_client_ctx = NULL;
+static struct net_tls_ctx_t *default_server_ctx = NULL;
+static pthread_once_t library_init_once = PTHREAD_ONCE_INIT;
+// index of the host:port key attached to each client SSL object.
+static int session_key_index = -1;
+// index of the number of session tickets a client SSL object received.
+static int ticket_count_index = -1;
+
+static void net_session_key_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                                 int idx, long argl, void *argp) {
+  (void)parent;
+  (void)ad;
+  (void)idx;
+  (void)argl;
+  (void)argp;
+  free(ptr);
+}
+
+/**
+ * Store the session for the key, replacing the old one or evicting the
+ * least recently used entry. Takes ownership of the session reference.
+ */
+static void net_session_store(struct net_session_cache_t *cache,
+                              const char *key, SSL_SESSION *session) {
+  pthread_mutex_lock(&cache->lock);
+  size_t slot = 0;
+  for (size_t i = 0; i < NET_SESSION_CACHE_SIZE; ++i) {
+    if (strcmp(cache->entries[i].key, key) == 0) {
+      slot = i;
+      break;
     }
-    if (cert != NULL) {
-      if (!SSL_CTX_load_verify_locations(ctx, cert, path)) {
-        ERR_print_errors_fp(stderr);
-        SSL_CTX_free(ctx);
-        ctx = NULL;
-        return false;
-      }
-      SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
-      SSL_CTX_set_verify_depth(ctx, 4);
-      SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    if (cache->entries[i].last_used < cache->entries[slot].last_used) {
+      slot = i;
     }
   }
-  return true;
+  struct net_session_entry_t *entry = &cache->entries[slot];
+  if (entry->session != NULL) {
+    SSL_SESSION_free(entry->session);
+  }
+  strcpy(entry->key, key);
+  entry->session = session;
+  entry->last_used = ++cache->clock;
+  pthread_mutex_unlock(&cache->lock);
 }
 
-bool net_init_server(const char *restrict key, const char *restrict cert) {
-  if (ctx == NULL) {
-    SSL_library_init();
-    SSL_load_error_strings();
-    OpenSSL_add_all_algorithms();
-    ctx = SSL_CTX_new(TLS_client_method());
-    if (ctx == NULL) {
+/**
+ * Take the session for the key.
+ * TLS 1.3 tickets are removed since they should only be used once, the
+ * server sends fresh ones after resuming.
+ *
+ * @return The session with a reference for the caller, NULL if none.
+ */
+static SSL_SESSION *net_session_take(struct net_session_cache_t *cache,
+                                     const char *key) {
+  SSL_SESSION *result = NULL;
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < NET_SESSION_CACHE_SIZE; ++i) {
+    struct net_session_entry_t *entry = &cache->entries[i];
+    if (entry->session == NULL || strcmp(entry->key, key) != 0) {
+      continue;
+    }
+    if (!SSL_SESSION_is_resumable(entry->session)) {
+      SSL_SESSION_free(entry->session);
+      memset(entry, 0, sizeof(struct net_session_entry_t));
+      break;
+    }
+    result = entry->session;
+    if (SSL_SESSION_get_protocol_version(result) >= TLS1_3_VERSION) {
+      memset(entry, 0, sizeof(struct net_session_entry_t));
+    } else {
+      SSL_SESSION_up_ref(result);
+      entry->last_used = ++cache->clock;
+    }
+    break;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return result;
+}
+
+static void net_session_remove(struct net_session_cache_t *cache,
+                               const char *key) {
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < NET_SESSION_CACHE_SIZE; ++i) {
+    struct net_session_entry_t *entry = &cache->entries[i];
+    if (entry->session != NULL && strcmp(entry->key, key) == 0) {
+      SSL_SESSION_free(entry->session);
+      memset(entry, 0, sizeof(struct net_session_entry_t));
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+static void net_session_clear(struct net_session_cache_t *cache) {
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < NET_SESSION_CACHE_SIZE; ++i) {
+    if (cache->entries[i].session != NULL) {
+      SSL_SESSION_free(cache->entries[i].session);
+    }
+  }
+  memset(cache->entries, 0, sizeof(cache->entries));
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Drop the cached session for the host:port of the client connection.
+ */
+static void net_session_forget(SSL *ssl) {
+  const char *key = SSL_get_ex_data(ssl, session_key_index);
+  struct net_tls_ctx_t *tls_ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  if (key != NULL && tls_ctx != NULL) {
+    net_session_remove(&tls_ctx->session_cache, key);
+  }
+}
+
+/**
+ * Called by OpenSSL for every new session, including TLS 1.3 tickets that
+ * arrive after the handshake.
+ */
+static int net_session_new_cb(SSL *ssl, SSL_SESSION *session) {
+  const uintptr_t tickets = (uintptr_t)SSL_get_ex_data(ssl, ticket_count_index);
+  SSL_set_ex_data(ssl, ticket_count_index, (void *)(tickets + 1));
+  const char *key = SSL_get_ex_data(ssl, session_key_index);
+  struct net_tls_ctx_t *tls_ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  if (key == NULL || tls_ctx == NULL) {
+    return 0;
+  }
+  net_session_store(&tls_ctx->session_cache, key, session);
+  // we keep the reference.
+  return 1;
+}
+
+/**
+ * Enable client side session caching on the context.
+ */
+static void net_enable_session_cache(SSL_CTX *ssl_ctx) {
+  // the library keeps the sessions, OpenSSL's internal store is server side.
+  SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT |
+                                              SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_ctx, net_session_new_cb);
+}
+
+static void net_library_init() {
+  SSL_library_init();
+  SSL_load_error_strings();
+  OpenSSL_add_all_algorithms();
+  session_key_index =
+      SSL_get_ex_new_index(0, NULL, NULL, NULL, net_session_key_free);
+  ticket_count_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+/**
+ * Allocate a context around a new SSL_CTX for the given method.
+ */
+static struct net_tls_ctx_t *net_tls_ctx_create(const SSL_METHOD *method) {
+  pthread_once(&library_init_once, net_library_init);
+  struct net_tls_ctx_t *result = calloc(1, sizeof(struct net_tls_ctx_t));
+  if (result == NULL) {
+    return NULL;
+  }
+  result->ssl_ctx = SSL_CTX_new(method);
+  if (result->ssl_ctx == NULL) {
+    ERR_print_errors_fp(stderr);
+    free(result);
+    return NULL;
+  }
+  pthread_mutex_init(&result->session_cache.lock, NULL);
+  // lets the callbacks find the context from an SSL object.
+  SSL_CTX_set_app_data(result->ssl_ctx, result);
+  return result;
+}
+
+struct net_tls_ctx_t *net_tls_ctx_create_client(const char *restrict cert,
+                                                const char *restrict path) {
+  struct net_tls_ctx_t *result = net_tls_ctx_create(TLS_client_method());
+  if (result == NULL) {
+    return NULL;
+  }
+  net_enable_session_cache(result->ssl_ctx);
+  if (cert != NULL) {
+    if (!SSL_CTX_load_verify_locations(result->ssl_ctx, cert, path)) {
       ERR_print_errors_fp(stderr);
-      return false;
+      net_tls_ctx_destroy(&result);
+      return NULL;
     }
-    if (key != NULL && cert != NULL) {
-      if (SSL_CTX_use_certificate_file(ctx, cert, SSL_FILETYPE_PEM) <= 0) {
-        ERR_print_errors_fp(stderr);
-        SSL_CTX_free(ctx);
-        return false;
-      }
-      if (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) <= 0) {
-        ERR_print_errors_fp(stderr);
-        SSL_CTX_free(ctx);
-        return false;
-      }
-      if (!SSL_CTX_check_private_key(ctx)) {
-        fprintf(stderr,
-                "Private key does not match the certificate public key\n");
-        SSL_CTX_free(ctx);
-        return false;
-      }
-      SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(result->ssl_ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_verify_depth(result->ssl_ctx, 4);
+    SSL_CTX_set_min_proto_version(result->ssl_ctx, TLS1_2_VERSION);
+  }
+  return result;
+}
+
+struct net_tls_ctx_t *net_tls_ctx_create_server(const char *restrict key,
+                                                const char *restrict cert) {
+  struct net_tls_ctx_t *result = net_tls_ctx_create(TLS_server_method());
+  if (result == NULL) {
+    return NULL;
+  }
+  if (key != NULL && cert != NULL) {
+    if (SSL_CTX_use_certificate_file(result->ssl_ctx, cert,
+                                     SSL_FILETYPE_PEM) <= 0) {
+      ERR_print_errors_fp(stderr);
+      net_tls_ctx_destroy(&result);
+      return NULL;
     }
+    if (SSL_CTX_use_PrivateKey_file(result->ssl_ctx, key, SSL_FILETYPE_PEM) <=
+        0) {
+      ERR_print_errors_fp(stderr);
+      net_tls_ctx_destroy(&result);
+      return NULL;
+    }
+    if (!SSL_CTX_check_private_key(result->ssl_ctx)) {
+      fprintf(stderr,
+              "Private key does not match the certificate public key\n");
+      net_tls_ctx_destroy(&result);
+      return NULL;
+    }
+    SSL_CTX_set_min_proto_version(result->ssl_ctx, TLS1_2_VERSION);
+  }
+  return result;
+}
+
+bool net_tls_ctx_set_early_data(struct net_tls_ctx_t *tls_ctx,
+                                uint32_t max_bytes) {
+  if (SSL_CTX_set_max_early_data(tls_ctx->ssl_ctx, max_bytes) != 1 ||
+      SSL_CTX_set_recv_max_early_data(tls_ctx->ssl_ctx, max_bytes) != 1) {
+    ERR_print_errors_fp(stderr);
+    return false;
   }
   return true;
 }
 
+SSL_CTX *net_tls_ctx_get(struct net_tls_ctx_t *tls_ctx) {
+  return tls_ctx->ssl_ctx;
+}
+
+void net_tls_ctx_destroy(struct net_tls_ctx_t **tls_ctx) {
+  if (tls_ctx == NULL || *tls_ctx == NULL) {
+    return;
+  }
+  // detach the cache before clearing it so the session callbacks of a
+  // connection closed late find no cache instead of a freed one.
+  SSL_CTX_set_app_data((*tls_ctx)->ssl_ctx, NULL);
+  net_session_clear(&(*tls_ctx)->session_cache);
+  SSL_CTX_free((*tls_ctx)->ssl_ctx);
+  pthread_mutex_destroy(&(*tls_ctx)->session_cache.lock);
+  free(*tls_ctx);
+  *tls_ctx = NULL;
+}
+
+/**
+ * Init
+ */
+bool net_init_client(const char *restrict cert, const char *restrict path) {
+  if (default_client_ctx == NULL) {
+    default_client_ctx = net_tls_ctx_create_client(cert, path);
+  }
+  return default_client_ctx != NULL;
+}
+
+bool net_init_server(const char *restrict key, const char *restrict cert) {
+  if (default_server_ctx == NULL) {
+    default_server_ctx = net_tls_ctx_create_server(key, cert);
+  }
+  return default_server_ctx != NULL;
+}
+
+struct net_tls_ctx_t *net_default_client_ctx() { return default_client_ctx; }
+
+struct net_tls_ctx_t *net_default_server_ctx() { return default_server_ctx; }
+
 /**
  * Deinit
  */
 void net_deinit() {
-  if (ctx != NULL) {
-    SSL_CTX_free(ctx);
-    ctx = NULL;
-    EVP_cleanup();
-  }
+  net_tls_ctx_destroy(&default_client_ctx);
+  net_tls_ctx_destroy(&default_server_ctx);
 }
 #endif
 
@@ -135,160 +402,1522 @@ static void net_connect_cleanup(struct net_result_t *result) {
   }
 }
 
+void net_options_init(struct net_options_t *opts) {
+  opts->connect_timeout_ms = 0;
+  opts->attempt_delay_ms = NET_ATTEMPT_DELAY_MS;
+  opts->no_delay = true;
+  opts->quick_ack = false;
+  opts->recv_buf_size = 0;
+  opts->send_buf_size = 0;
+  opts->busy_poll_us = 0;
+  opts->user_timeout_ms = 0;
+  opts->tos = -1;
+  opts->fast_open = false;
+  opts->rx_timestamps = false;
+#ifdef WEBC_USE_SSL
+  opts->ktls = false;
+  opts->early_data = false;
+  opts->tls_records = NET_TLS_RECORDS_FULL;
+  opts->tls_ctx = NULL;
+#endif
+}
+
+static bool net_set_int_option(int sock, int level, int name, int value,
+                               const char *label) {
+  if (setsockopt(sock, level, name, &value, sizeof(value)) == -1) {
+    fprintf(stderr, "failed to set %s: %s\n", label, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
 /**
- * Connect
+ * Apply the socket tuning options to the socket.
+ * Failures are reported but don't stop the remaining options.
  */
-bool net_connect(const char *restrict host, const char *restrict port,
-                 struct net_info_t *out) {
-  if (host == NULL || port == NULL) {
-    return false;
+static bool net_apply_options(int sock, int family,
+                              const struct net_options_t *opts) {
+  bool result = true;
+  // only the socket level options apply to Unix domain sockets.
+  const bool is_tcp = family != AF_UNIX;
+  if (is_tcp && opts->no_delay) {
+    result &= net_set_int_option(sock, IPPROTO_TCP, TCP_NODELAY, 1,
+                                 "TCP_NODELAY");
   }
-  DEFER(net_connect_cleanup) struct net_result_t context = gen_net_result();
-  struct net_info_t result;
-  memset(&result, 0, sizeof(result));
-  result.socket = -1;
-  struct addrinfo hints, *res;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-  const int err = getaddrinfo(host, port, &hints, &res);
-  if (err != 0) {
-    fprintf(stderr, "failed to get address info - host:\"%s\", port:\"%s\".\n",
-            host, port);
-    fprintf(stderr, "errno: %s\n", strerror(err));
-    return false;
+#ifdef TCP_QUICKACK
+  if (is_tcp && opts->quick_ack) {
+    result &= net_set_int_option(sock, IPPROTO_TCP, TCP_QUICKACK, 1,
+                                 "TCP_QUICKACK");
   }
-  int sock = -1;
-  for (struct addrinfo *rp = res; rp != NULL; rp = rp->ai_next) {
-    sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-    if (sock == -1) {
-      continue;
-    }
-    if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
-      /* success */
-      // TODO probably want to copy addr info over as well.
-      //
-      result.socket = sock;
-      break;
-    }
-    close(sock);
-    sock = -1;
+#endif
+  if (opts->recv_buf_size > 0) {
+    result &= net_set_int_option(sock, SOL_SOCKET, SO_RCVBUF,
+                                 opts->recv_buf_size, "SO_RCVBUF");
   }
-  freeaddrinfo(res);
-  if (sock == -1) {
-    fprintf(stderr, "no valid socket connection found.\n");
-    context.error_triggered = true;
-    return false;
+  if (opts->send_buf_size > 0) {
+    result &= net_set_int_option(sock, SOL_SOCKET, SO_SNDBUF,
+                                 opts->send_buf_size, "SO_SNDBUF");
   }
-  // set the context to the result for if an error triggers.
-  // setting it here lets us know we entered a successful connection if an error
-  // occurred.
-  context.ctx = &result;
-#ifdef WEBC_USE_SSL
-  result.ssl = SSL_new(ctx);
-  if (result.ssl == NULL) {
-    fprintf(stderr, "SSL could not be instantiated for client.\n");
-    context.error_triggered = true;
-    return false;
+#ifdef SO_BUSY_POLL
+  if (opts->busy_poll_us > 0) {
+    result &= net_set_int_option(sock, SOL_SOCKET, SO_BUSY_POLL,
+                                 opts->busy_poll_us, "SO_BUSY_POLL");
   }
-  (void)SSL_set_fd(result.ssl, result.socket);
-  // optional feature so we don't flag as an error.
-  if (!SSL_set_tlsext_host_name(result.ssl, host)) {
-    fprintf(stderr, "SSL set host name failed.\n");
+#endif
+#ifdef TCP_USER_TIMEOUT
+  if (is_tcp && opts->user_timeout_ms > 0) {
+    result &= net_set_int_option(sock, IPPROTO_TCP, TCP_USER_TIMEOUT,
+                                 opts->user_timeout_ms, "TCP_USER_TIMEOUT");
   }
-  if (!SSL_connect(result.ssl)) {
-    fprintf(stderr, "SSL connect failed.\n");
-    context.error_triggered = true;
-    return false;
+#endif
+#ifdef SO_TIMESTAMPING
+  if (opts->rx_timestamps) {
+    // hardware stamps only show up if the interface has them enabled.
+    result &= net_set_int_option(
+        sock, SOL_SOCKET, SO_TIMESTAMPING,
+        SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+            SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE,
+        "SO_TIMESTAMPING");
   }
 #endif
-  *out = result;
-  return true;
+  if (opts->tos >= 0) {
+    if (family == AF_INET6) {
+      result &= net_set_int_option(sock, IPPROTO_IPV6, IPV6_TCLASS, opts->tos,
+                                   "IPV6_TCLASS");
+    } else if (family == AF_INET) {
+      result &= net_set_int_option(sock, IPPROTO_IP, IP_TOS, opts->tos,
+                                   "IP_TOS");
+    }
+  }
+  return result;
 }
 
+#ifdef WEBC_USE_SSL
 /**
- * Accept
- * TODO finish implementation.
+ * Set the plaintext size of the records OpenSSL sends.
  */
-bool net_accept(struct net_info_t *info) { return true; }
-
-ssize_t net_peek(struct net_info_t *info, void *buf, size_t buf_len) {
-  if (info == NULL || buf == NULL) {
-    return false;
+static void net_set_record_size(struct net_info_t *info, size_t size) {
+  if (info->record_size == size) {
+    return;
   }
-#ifdef WEBC_USE_SSL
-  if (info->ssl != NULL) {
-    const ssize_t n = SSL_peek(info->ssl, buf, buf_len);
-    if (n < 0) {
-      if (info->ssl != NULL && SSL_get_error(info->ssl, n) != SSL_ERROR_ZERO_RETURN) {
-        ERR_print_errors_fp(stderr);
-      }
-    }
-    return n;
+  // the write buffer is sized for the records at the time it is allocated,
+  // growing needs a new one. Buffers still holding data can't be released,
+  // the records stay small until the next write then.
+  if (size > info->record_size && info->record_size != 0 &&
+      SSL_free_buffers(info->ssl) != 1) {
+    return;
   }
-#endif
-  const ssize_t n = recv(info->socket, buf, buf_len, MSG_PEEK);
-  if (n < 0) {
-    fprintf(stderr, "WebSocket recv failed.\n");
+  // lowering the max also lowers the split size, growing needs both.
+  if (SSL_set_max_send_fragment(info->ssl, size) == 1 &&
+      SSL_set_split_send_fragment(info->ssl, size) == 1) {
+    info->record_size = size;
   }
-  return n;
 }
 
-ssize_t net_read(struct net_info_t *info, void *buf, size_t buf_len) {
-  if (info == NULL || buf == NULL) {
+/**
+ * Let OpenSSL read everything the socket has when receive timestamps are on,
+ * so the peek in net_tls_read runs once per socket read instead of once per
+ * record. Non-blocking connections read ahead too, net_ssl_read then returns
+ * all complete records in one call. kTLS needs the record layer empty when
+ * it takes over, so it keeps reading record by record.
+ */
+static void net_set_tls_read_ahead(struct net_info_t *info) {
+  if (info->ssl != NULL &&
+      (SSL_get_options(info->ssl) & SSL_OP_ENABLE_KTLS) == 0) {
+    SSL_set_read_ahead(info->ssl, info->rx_timestamps || info->nonblocking);
+  }
+}
+
+static void net_set_tls_records(struct net_info_t *info,
+                                enum net_tls_records_t mode) {
+  info->tls_records = mode;
+  info->burst_bytes = 0;
+  info->last_write_ms = 0;
+  if (info->ssl != NULL && mode == NET_TLS_RECORDS_FULL &&
+      info->record_size != 0) {
+    net_set_record_size(info, SSL3_RT_MAX_PLAIN_LENGTH);
+  }
+}
+#endif
+
+bool net_set_options(struct net_info_t *info,
+                     const struct net_options_t *opts) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(info->socket, (struct sockaddr *)&addr, &addr_len) == -1) {
     return false;
   }
+  info->rx_timestamps = opts->rx_timestamps;
+  info->quick_ack = opts->quick_ack && addr.ss_family != AF_UNIX;
 #ifdef WEBC_USE_SSL
-  if (info->ssl != NULL) {
-    const ssize_t n = SSL_read(info->ssl, buf, buf_len);
-    if (n < 0) {
-      if (info->ssl != NULL && SSL_get_error(info->ssl, n) != SSL_ERROR_ZERO_RETURN) {
-        ERR_print_errors_fp(stderr);
-      }
+  net_set_tls_records(info, opts->tls_records);
+  net_set_tls_read_ahead(info);
+#endif
+  return net_apply_options(info->socket, addr.ss_family, opts);
+}
+
+static int64_t net_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/**
+ * Order the addresses so the families alternate, starting with the family
+ * of the first (preferred) address.
+ */
+static void net_interleave_addrs(struct addrinfo *res, struct addrinfo **out,
+                                 size_t len) {
+  const int first_family = res->ai_family;
+  struct addrinfo *first = res;
+  struct addrinfo *other = res;
+  for (size_t i = 0; i < len; ++i) {
+    const bool want_first = (i % 2) == 0;
+    while (first != NULL && first->ai_family != first_family) {
+      first = first->ai_next;
     }
-    return n;
+    while (other != NULL && other->ai_family == first_family) {
+      other = other->ai_next;
+    }
+    struct addrinfo **pick = &first;
+    if ((want_first && first == NULL) || (!want_first && other != NULL)) {
+      pick = &other;
+    }
+    out[i] = *pick;
+    *pick = (*pick)->ai_next;
+  }
+}
+
+/**
+ * Start a non-blocking connect to the given address.
+ *
+ * @param[out] connected Set if the connection finished right away.
+ * @return The socket, -1 if the attempt failed.
+ */
+static int net_start_attempt(const struct addrinfo *rp,
+                             const struct net_options_t *opts,
+                             bool *connected) {
+  const int sock = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK,
+                          rp->ai_protocol);
+  if (sock == -1) {
+    return -1;
+  }
+  // buffer sizes and the like have to be set before the handshake.
+  (void)net_apply_options(sock, rp->ai_family, opts);
+#ifdef TCP_FASTOPEN_CONNECT
+  // connect returns right away and the SYN goes out with the first write.
+  if (opts->fast_open) {
+    (void)net_set_int_option(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1,
+                             "TCP_FASTOPEN_CONNECT");
   }
 #endif
-  return recv(info->socket, buf, buf_len, 0);
+  if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
+    *connected = true;
+    return sock;
+  }
+  if (errno != EINPROGRESS) {
+    close(sock);
+    return -1;
+  }
+  return sock;
 }
 
 /**
- * Write
+ * Race connection attempts to the given addresses (RFC 8305).
+ * A new attempt starts every attempt_delay_ms, or right away when one fails.
+ *
+ * @return The connected blocking socket, -1 on failure or timeout.
  */
-ssize_t net_write(struct net_info_t *info, const void *buf, size_t buf_len) {
-  if (info == NULL || buf == NULL) {
-    return false;
+static int net_happy_eyeballs(struct addrinfo *res,
+                              const struct net_options_t *opts) {
+  size_t len = 0;
+  for (struct addrinfo *rp = res; rp != NULL; rp = rp->ai_next) {
+    ++len;
   }
-#ifdef WEBC_USE_SSL
-  if (info->ssl != NULL) {
-    const ssize_t n = SSL_write(info->ssl, buf, buf_len);
-    if (n < 0) {
-      if (info->ssl != NULL && SSL_get_error(info->ssl, n) != SSL_ERROR_ZERO_RETURN) {
-        ERR_print_errors_fp(stderr);
+  struct addrinfo **addrs = malloc(sizeof(struct addrinfo *) * len);
+  struct pollfd *fds = malloc(sizeof(struct pollfd) * len);
+  if (addrs == NULL || fds == NULL) {
+    free(addrs);
+    free(fds);
+    return -1;
+  }
+  net_interleave_addrs(res, addrs, len);
+  const int64_t start = net_now_ms();
+  const int64_t deadline =
+      opts->connect_timeout_ms > 0 ? start + opts->connect_timeout_ms : -1;
+  int64_t next_attempt = start;
+  size_t next = 0;
+  size_t pending = 0;
+  int winner = -1;
+  while (winner == -1) {
+    int64_t now = net_now_ms();
+    if (deadline != -1 && now >= deadline) {
+      fprintf(stderr, "connect timed out.\n");
+      break;
+    }
+    if (next < len && now >= next_attempt) {
+      bool connected = false;
+      const int sock = net_start_attempt(addrs[next], opts, &connected);
+      ++next;
+      if (connected) {
+        winner = sock;
+        break;
+      }
+      if (sock != -1) {
+        fds[pending] = (struct pollfd){.fd = sock, .events = POLLOUT};
+        ++pending;
+        next_attempt = now + opts->attempt_delay_ms;
+      }
+      continue;
+    }
+    if (pending == 0 && next >= len) {
+      break;
+    }
+    int64_t wait = -1;
+    if (next < len) {
+      wait = next_attempt - now;
+    }
+    if (deadline != -1 && (wait == -1 || (deadline - now) < wait)) {
+      wait = deadline - now;
+    }
+    const int n = poll(fds, pending, (int)wait);
+    if (n == -1 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    for (size_t i = 0; n > 0 && i < pending;) {
+      if (fds[i].revents == 0) {
+        ++i;
+        continue;
       }
+      int err = 0;
+      socklen_t err_len = sizeof(err);
+      if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 &&
+          err == 0) {
+        winner = fds[i].fd;
+        fds[i] = fds[pending - 1];
+        --pending;
+        break;
+      }
+      // this address failed, don't wait out the delay for the next one.
+      close(fds[i].fd);
+      fds[i] = fds[pending - 1];
+      --pending;
+      next_attempt = net_now_ms();
     }
-    return n;
   }
-#endif
-  const ssize_t n = send(info->socket, buf, buf_len, 0);
-  if (n < 0) {
-    fprintf(stderr, "WebSocket client send failure.\n");
+  // cancel the attempts that lost the race.
+  for (size_t i = 0; i < pending; ++i) {
+    close(fds[i].fd);
   }
-  return n;
+  free(addrs);
+  free(fds);
+  if (winner != -1) {
+    const int flags = fcntl(winner, F_GETFL, 0);
+    (void)fcntl(winner, F_SETFL, flags & ~O_NONBLOCK);
+  }
+  return winner;
 }
 
 /**
- * Close
+ * Set the send/receive timeouts of the socket, 0 disables them.
  */
-void net_close(struct net_info_t *info) {
-  if (info == NULL)
+static void net_set_io_timeout(int sock, int64_t timeout_ms) {
+  const struct timeval tv = {
+      .tv_sec = timeout_ms / 1000,
+      .tv_usec = (timeout_ms % 1000) * 1000,
+  };
+  (void)setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  (void)setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Fill the Unix domain socket address for the path.
+ *
+ * @return True on success, false if the path doesn't fit.
+ */
+static bool net_unix_addr(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  const size_t len = strlen(path);
+  if (len == 0 || len >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "invalid Unix socket path: \"%s\".\n", path);
+    return false;
+  }
+  memcpy(addr->sun_path, path, len);
+  return true;
+}
+
+bool net_connect_unix(const char *path, const struct net_options_t *opts,
+                      struct net_info_t *out) {
+  struct net_options_t defaults;
+  if (opts == NULL) {
+    net_options_init(&defaults);
+    opts = &defaults;
+  }
+  struct sockaddr_un addr;
+  if (!net_unix_addr(path, &addr)) {
+    return false;
+  }
+  const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    fprintf(stderr, "failed to create Unix socket: %s\n", strerror(errno));
+    return false;
+  }
+  (void)net_apply_options(sock, AF_UNIX, opts);
+  if (opts->connect_timeout_ms > 0) {
+    // a full listen backlog blocks the connect.
+    net_set_io_timeout(sock, opts->connect_timeout_ms);
+  }
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    fprintf(stderr, "failed to connect to \"%s\": %s\n", path,
+            strerror(errno));
+    close(sock);
+    return false;
+  }
+  if (opts->connect_timeout_ms > 0) {
+    net_set_io_timeout(sock, 0);
+  }
+  memset(out, 0, sizeof(struct net_info_t));
+  out->socket = sock;
+  out->transport = &net_unix_transport;
+  out->rx_timestamps = opts->rx_timestamps;
+  return true;
+}
+
+#ifdef WEBC_USE_SSL
+/**
+ * Let reads skip OpenSSL once it has nothing left to process itself.
+ */
+static void net_check_ktls_recv(struct net_info_t *info) {
+  if (info->ktls_recv_wait &&
+      SSL_get_ex_data(info->ssl, ticket_count_index) == NULL) {
+    return;
+  }
+  // bytes OpenSSL already buffered have to be read through OpenSSL.
+  if (!SSL_has_pending(info->ssl)) {
+    info->ktls_recv_wait = false;
+    info->ktls_recv = true;
+  }
+}
+
+/**
+ * Check which directions OpenSSL handed to the kernel after the handshake.
+ */
+static void net_check_ktls(struct net_info_t *info) {
+  if ((SSL_get_options(info->ssl) & SSL_OP_ENABLE_KTLS) == 0) {
+    return;
+  }
+  info->ktls_send = BIO_get_ktls_send(SSL_get_wbio(info->ssl));
+  if (!BIO_get_ktls_recv(SSL_get_rbio(info->ssl))) {
+    return;
+  }
+  // TLS 1.3 tickets come after the handshake and have to reach OpenSSL, it
+  // reads them from the kernel until the first one arrived. Servers get no
+  // tickets.
+  info->ktls_recv_wait =
+      !SSL_is_server(info->ssl) && SSL_version(info->ssl) >= TLS1_3_VERSION;
+  net_check_ktls_recv(info);
+}
+#endif
+
+/**
+ * Run Happy Eyeballs over the resolved addresses.
+ *
+ * @return The connected socket, -1 if no address connected.
+ */
+static int net_connect_resolved(const struct dns_result_t *resolved,
+                                const struct net_options_t *opts) {
+  struct addrinfo addrs[DNS_MAX_ADDRS];
+  memset(addrs, 0, sizeof(addrs));
+  for (size_t i = 0; i < resolved->len; ++i) {
+    addrs[i].ai_family = resolved->addrs[i].family;
+    addrs[i].ai_socktype = resolved->addrs[i].socktype;
+    addrs[i].ai_protocol = resolved->addrs[i].protocol;
+    addrs[i].ai_addrlen = resolved->addrs[i].addr_len;
+    addrs[i].ai_addr = (struct sockaddr *)&resolved->addrs[i].addr;
+    addrs[i].ai_next = (i + 1) < resolved->len ? &addrs[i + 1] : NULL;
+  }
+  return net_happy_eyeballs(addrs, opts);
+}
+
+/**
+ * Check if two lookups returned the same addresses in the same order.
+ */
+static bool net_same_addrs(const struct dns_result_t *a,
+                             const struct dns_result_t *b) {
+  if (a->len != b->len) {
+    return false;
+  }
+  for (size_t i = 0; i < a->len; ++i) {
+    if (a->addrs[i].addr_len != b->addrs[i].addr_len ||
+        memcmp(&a->addrs[i].addr, &b->addrs[i].addr, a->addrs[i].addr_len) !=
+            0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Connect
+ */
+bool net_connect(const char *restrict host, const char *restrict port,
+                 struct net_info_t *out) {
+  return net_connect_with(host, port, NULL, out);
+}
+
+bool net_connect_with(const char *restrict host, const char *restrict port,
+                      const struct net_options_t *opts,
+                      struct net_info_t *out) {
+  if (host == NULL || port == NULL) {
+    return false;
+  }
+  struct net_options_t defaults;
+  if (opts == NULL) {
+    net_options_init(&defaults);
+    opts = &defaults;
+  }
+  const int64_t start = net_now_ms();
+  DEFER(net_connect_cleanup) struct net_result_t context = gen_net_result();
+  struct net_info_t result;
+  memset(&result, 0, sizeof(result));
+  result.socket = -1;
+  // resolved addresses are shared by every connection to the same host.
+  struct dns_result_t resolved;
+  const bool cached = dns_cache_lookup(host, port, &resolved);
+  if (!cached && !dns_resolve(host, port, &resolved)) {
+    return false;
+  }
+  int sock = net_connect_resolved(&resolved, opts);
+  if (sock == -1 && cached) {
+    // the cached addresses may be stale (e.g. the host moved), look the
+    // host up again and retry once if that changed anything.
+    dns_cache_remove(host, port);
+    struct dns_result_t fresh;
+    struct net_options_t retry_opts = *opts;
+    const int64_t elapsed = net_now_ms() - start;
+    const bool time_left = opts->connect_timeout_ms == 0 ||
+                           elapsed < opts->connect_timeout_ms;
+    if (time_left && dns_resolve(host, port, &fresh) &&
+        !net_same_addrs(&resolved, &fresh)) {
+      if (opts->connect_timeout_ms > 0) {
+        retry_opts.connect_timeout_ms -= elapsed;
+      }
+      sock = net_connect_resolved(&fresh, &retry_opts);
+    }
+  }
+  if (sock == -1) {
+    fprintf(stderr, "no valid socket connection found.\n");
+    return false;
+  }
+  result.socket = sock;
+  result.transport = &net_tcp_transport;
+  result.rx_timestamps = opts->rx_timestamps;
+  result.quick_ack = opts->quick_ack;
+  // set the context to the result for if an error triggers.
+  // setting it here lets us know we entered a successful connection if an error
+  // occurred.
+  context.ctx = &result;
+#ifdef WEBC_USE_SSL
+  struct net_tls_ctx_t *tls_ctx =
+      opts->tls_ctx != NULL ? opts->tls_ctx : default_client_ctx;
+  if (tls_ctx == NULL) {
+    fprintf(stderr, "no TLS context, call net_init_client or set tls_ctx.\n");
+    context.error_triggered = true;
+    return false;
+  }
+  result.ssl = SSL_new(tls_ctx->ssl_ctx);
+  result.transport = &net_tls_transport;
+  result.tls_records = opts->tls_records;
+  if (result.ssl == NULL) {
+    fprintf(stderr, "SSL could not be instantiated for client.\n");
+    context.error_triggered = true;
+    return false;
+  }
+  (void)SSL_set_fd(result.ssl, result.socket);
+  // optional feature so we don't flag as an error.
+  if (!SSL_set_tlsext_host_name(result.ssl, host)) {
+    fprintf(stderr, "SSL set host name failed.\n");
+  }
+  // resume the last session with this host:port when we have one.
+  char *session_key = malloc(NET_SESSION_KEY_MAX_LEN);
+  if (session_key != NULL) {
+    const int key_len = snprintf(session_key, NET_SESSION_KEY_MAX_LEN, "%s:%s",
+                                 host, port);
+    if (key_len <= 0 || key_len >= NET_SESSION_KEY_MAX_LEN ||
+        !SSL_set_ex_data(result.ssl, session_key_index, session_key)) {
+      free(session_key);
+      session_key = NULL;
+    }
+  }
+  bool early_data = false;
+  if (session_key != NULL) {
+    SSL_SESSION *session =
+        net_session_take(&tls_ctx->session_cache, session_key);
+    if (session != NULL) {
+      (void)SSL_set_session(result.ssl, session);
+      // only TLS 1.3 tickets from servers accepting early data allow 0-RTT.
+      early_data =
+          opts->early_data && SSL_SESSION_get_max_early_data(session) > 0;
+      SSL_SESSION_free(session);
+    }
+  }
+  if (opts->connect_timeout_ms > 0) {
+    // the handshake gets whatever is left of the deadline.
+    const int64_t remaining = opts->connect_timeout_ms - (net_now_ms() - start);
+    if (remaining <= 0) {
+      fprintf(stderr, "connect timed out.\n");
+      context.error_triggered = true;
+      return false;
+    }
+    net_set_io_timeout(result.socket, remaining);
+  }
+  if (opts->ktls) {
+    // has to be set before the handshake, OpenSSL switches once the keys
+    // are known and quietly stays in user space if it can't.
+    SSL_set_options(result.ssl, SSL_OP_ENABLE_KTLS);
+  }
+  net_set_tls_read_ahead(&result);
+  if (early_data) {
+    // the first write goes out as early data and finishes the handshake.
+    SSL_set_connect_state(result.ssl);
+    result.early_data_pending = true;
+    *out = result;
+    return true;
+  }
+  if (SSL_connect(result.ssl) != 1) {
+    fprintf(stderr, "SSL connect failed.\n");
+    if (session_key != NULL) {
+      // don't offer a session the server just refused again.
+      net_session_remove(&tls_ctx->session_cache, session_key);
+    }
+    context.error_triggered = true;
+    return false;
+  }
+  if (opts->connect_timeout_ms > 0) {
+    net_set_io_timeout(result.socket, 0);
+  }
+  net_check_ktls(&result);
+#else
+  (void)start;
+#endif
+  *out = result;
+  return true;
+}
+
+#ifdef WEBC_USE_SSL
+bool net_session_resumed(struct net_info_t *info) {
+  return info->ssl != NULL && SSL_session_reused(info->ssl) == 1;
+}
+#endif
+
+void net_listen_options_init(struct net_listen_options_t *opts) {
+  opts->backlog = SOMAXCONN;
+  opts->reuse_port = false;
+  opts->nonblocking = false;
+  opts->fast_open_queue = 0;
+#ifdef WEBC_USE_SSL
+  opts->tls_ctx = NULL;
+  opts->defer_handshake = false;
+  opts->ktls = false;
+#endif
+}
+
+/**
+ * Create a socket bound to the address and listening on it.
+ *
+ * @return The socket, -1 on failure.
+ */
+static int net_bind_listener(const struct addrinfo *rp,
+                             const struct net_listen_options_t *opts) {
+  const int sock = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC,
+                          rp->ai_protocol);
+  if (sock == -1) {
+    return -1;
+  }
+  // restarting shouldn't have to wait for old connections in TIME_WAIT.
+  if (!net_set_int_option(sock, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR")) {
+    close(sock);
+    return -1;
+  }
+  if (opts->reuse_port) {
+#ifdef SO_REUSEPORT
+    if (!net_set_int_option(sock, SOL_SOCKET, SO_REUSEPORT, 1,
+                            "SO_REUSEPORT")) {
+      close(sock);
+      return -1;
+    }
+#else
+    fprintf(stderr, "SO_REUSEPORT is not supported on this platform.\n");
+    close(sock);
+    return -1;
+#endif
+  }
+  if (opts->nonblocking && fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
+    close(sock);
+    return -1;
+  }
+#ifdef TCP_FASTOPEN
+  // not fatal, clients fall back to a regular handshake.
+  if (opts->fast_open_queue > 0) {
+    (void)net_set_int_option(sock, IPPROTO_TCP, TCP_FASTOPEN,
+                             opts->fast_open_queue, "TCP_FASTOPEN");
+  }
+#endif
+  if (bind(sock, rp->ai_addr, rp->ai_addrlen) == -1 ||
+      listen(sock, opts->backlog) == -1) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+bool net_listen(const char *restrict host, const char *restrict port,
+                const struct net_listen_options_t *opts,
+                struct net_listener_t *out) {
+  struct net_listen_options_t defaults;
+  if (opts == NULL) {
+    net_listen_options_init(&defaults);
+    opts = &defaults;
+  }
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  const int err = getaddrinfo(host, port, &hints, &res);
+  if (err != 0) {
+    fprintf(stderr, "failed to get address info - host:\"%s\", port:\"%s\".\n",
+            host != NULL ? host : "*", port);
+    fprintf(stderr, "error: %s\n", gai_strerror(err));
+    return false;
+  }
+  int sock = -1;
+  for (struct addrinfo *rp = res; rp != NULL && sock == -1; rp = rp->ai_next) {
+    sock = net_bind_listener(rp, opts);
+  }
+  freeaddrinfo(res);
+  if (sock == -1) {
+    fprintf(stderr, "failed to listen on port %s: %s\n", port, strerror(errno));
+    return false;
+  }
+  out->socket = sock;
+  out->nonblocking = opts->nonblocking;
+  out->transport = &net_tcp_transport;
+#ifdef WEBC_USE_SSL
+  out->tls_ctx = opts->tls_ctx != NULL ? opts->tls_ctx : default_server_ctx;
+  out->defer_handshake = opts->defer_handshake;
+  out->ktls = opts->ktls;
+#endif
+  return true;
+}
+
+#ifdef WEBC_USE_SSL
+/**
+ * Read the client's early data, kept for the first reads.
+ *
+ * @return True on success, false otherwise.
+ */
+static bool net_read_early_data(struct net_info_t *info) {
+  size_t cap = 0;
+  while (true) {
+    if (info->early_data_len == cap) {
+      const size_t new_cap = cap > 0 ? cap * 2 : BUFSIZ;
+      uint8_t *data = realloc(info->early_data, new_cap);
+      if (data == NULL) {
+        return false;
+      }
+      info->early_data = data;
+      cap = new_cap;
+    }
+    size_t n = 0;
+    const int ret =
+        SSL_read_early_data(info->ssl, &info->early_data[info->early_data_len],
+                            cap - info->early_data_len, &n);
+    if (ret == SSL_READ_EARLY_DATA_ERROR) {
+      return false;
+    }
+    info->early_data_len += n;
+    if (ret == SSL_READ_EARLY_DATA_FINISH) {
+      break;
+    }
+  }
+  if (info->early_data_len == 0) {
+    free(info->early_data);
+    info->early_data = NULL;
+  }
+  return true;
+}
+
+/**
+ * Copy buffered early data into the buffer.
+ *
+ * @return The number of bytes copied.
+ */
+static size_t net_take_early_data(struct net_info_t *info, void *buf,
+                                  size_t buf_len, bool consume) {
+  const size_t avail = info->early_data_len - info->early_data_off;
+  const size_t n = avail < buf_len ? avail : buf_len;
+  memcpy(buf, &info->early_data[info->early_data_off], n);
+  if (consume) {
+    info->early_data_off += n;
+    if (info->early_data_off == info->early_data_len) {
+      free(info->early_data);
+      info->early_data = NULL;
+      info->early_data_len = 0;
+      info->early_data_off = 0;
+    }
+  }
+  return n;
+}
+#endif
+
+int net_accept(struct net_listener_t *listener, struct net_info_t *out) {
+  if (listener == NULL || out == NULL) {
+    return -1;
+  }
+  int sock;
+  do {
+#ifdef __linux__
+    // one call instead of accept + two fcntl per connection.
+    sock = accept4(listener->socket, NULL, NULL,
+                   SOCK_CLOEXEC | (listener->nonblocking ? SOCK_NONBLOCK : 0));
+#else
+    sock = accept(listener->socket, NULL, NULL);
+    if (sock != -1 && listener->nonblocking &&
+        fcntl(sock, F_SETFL, O_NONBLOCK) == -1) {
+      close(sock);
+      return -1;
+    }
+#endif
+  } while (sock == -1 && errno == EINTR);
+  if (sock == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return NET_WOULD_BLOCK;
+    }
+    fprintf(stderr, "accept failed: %s\n", strerror(errno));
+    return -1;
+  }
+  struct net_info_t result;
+  memset(&result, 0, sizeof(result));
+  result.socket = sock;
+  result.transport = listener->transport;
+  result.nonblocking = listener->nonblocking;
+#ifdef WEBC_USE_SSL
+  if (listener->tls_ctx != NULL) {
+    result.ssl = SSL_new(listener->tls_ctx->ssl_ctx);
+    result.transport = &net_tls_transport;
+    if (result.ssl == NULL || !SSL_set_fd(result.ssl, sock)) {
+      ERR_print_errors_fp(stderr);
+      net_close(&result);
+      return -1;
+    }
+    if (listener->ktls) {
+      SSL_set_options(result.ssl, SSL_OP_ENABLE_KTLS);
+    }
+    net_set_tls_read_ahead(&result);
+    if (listener->defer_handshake) {
+      SSL_set_accept_state(result.ssl);
+      *out = result;
+      return 1;
+    }
+    // early data is only read on blocking listeners, otherwise OpenSSL
+    // rejects it and the client sends it again after the handshake.
+    if (!listener->nonblocking &&
+        SSL_CTX_get_max_early_data(listener->tls_ctx->ssl_ctx) > 0 &&
+        !net_read_early_data(&result)) {
+      fprintf(stderr, "SSL accept failed.\n");
+      ERR_print_errors_fp(stderr);
+      net_close(&result);
+      return -1;
+    }
+    const int ret = SSL_accept(result.ssl);
+    if (ret != 1) {
+      const int ssl_err = SSL_get_error(result.ssl, ret);
+      // a non-blocking handshake is finished by the first reads/writes.
+      if (!listener->nonblocking || (ssl_err != SSL_ERROR_WANT_READ &&
+                                     ssl_err != SSL_ERROR_WANT_WRITE)) {
+        fprintf(stderr, "SSL accept failed.\n");
+        ERR_print_errors_fp(stderr);
+        net_close(&result);
+        return -1;
+      }
+    } else {
+      net_check_ktls(&result);
+    }
+  }
+#endif
+  *out = result;
+  return 1;
+}
+
+#ifdef WEBC_USE_SSL
+bool net_handshake(struct net_info_t *info, unsigned int timeout_ms) {
+  if (info->ssl == NULL || SSL_is_init_finished(info->ssl)) {
+    return true;
+  }
+  const int flags = fcntl(info->socket, F_GETFL);
+  if (flags == -1) {
+    return false;
+  }
+  // the handshake runs to completion, the flag is restored afterwards.
+  const bool nonblocking = (flags & O_NONBLOCK) != 0;
+  if (nonblocking && fcntl(info->socket, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+    return false;
+  }
+  if (timeout_ms > 0) {
+    net_set_io_timeout(info->socket, timeout_ms);
+  }
+  bool ok = SSL_CTX_get_max_early_data(SSL_get_SSL_CTX(info->ssl)) == 0 ||
+            net_read_early_data(info);
+  ok = ok && SSL_accept(info->ssl) == 1;
+  if (ok) {
+    net_check_ktls(info);
+  } else {
+    fprintf(stderr, "SSL accept failed.\n");
+    ERR_print_errors_fp(stderr);
+  }
+  if (timeout_ms > 0) {
+    net_set_io_timeout(info->socket, 0);
+  }
+  if (nonblocking) {
+    (void)fcntl(info->socket, F_SETFL, flags);
+  }
+  return ok;
+}
+#endif
+
+bool net_listen_unix(const char *path, const struct net_listen_options_t *opts,
+                     struct net_listener_t *out) {
+  struct net_listen_options_t defaults;
+  if (opts == NULL) {
+    net_listen_options_init(&defaults);
+    opts = &defaults;
+  }
+  struct sockaddr_un addr;
+  if (!net_unix_addr(path, &addr)) {
+    return false;
+  }
+  // a socket file left behind by an earlier run would make bind fail.
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    (void)unlink(path);
+  }
+  const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) {
+    fprintf(stderr, "failed to create Unix socket: %s\n", strerror(errno));
+    return false;
+  }
+  if ((opts->nonblocking && fcntl(sock, F_SETFL, O_NONBLOCK) == -1) ||
+      bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(sock, opts->backlog) == -1) {
+    fprintf(stderr, "failed to listen on \"%s\": %s\n", path, strerror(errno));
+    close(sock);
+    return false;
+  }
+  out->socket = sock;
+  out->nonblocking = opts->nonblocking;
+  out->transport = &net_unix_transport;
+#ifdef WEBC_USE_SSL
+  // local peers don't need TLS unless it is asked for explicitly.
+  out->tls_ctx = opts->tls_ctx;
+  out->defer_handshake = opts->defer_handshake;
+  // the kernel only does TLS on TCP sockets.
+  out->ktls = false;
+#endif
+  return true;
+}
+
+void net_listener_close(struct net_listener_t *listener) {
+  if (listener == NULL || listener->socket == -1) {
     return;
+  }
+  close(listener->socket);
+  listener->socket = -1;
+}
+
+#ifdef WEBC_USE_SSL
+/**
+ * Translate the result of an SSL read/write call.
+ */
+static ssize_t net_ssl_result(struct net_info_t *info, int n) {
+  if (n > 0) {
+    return n;
+  }
+  const int err = SSL_get_error(info->ssl, n);
+  if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+    return NET_WOULD_BLOCK;
+  }
+  if (err != SSL_ERROR_ZERO_RETURN) {
+    ERR_print_errors_fp(stderr);
+  }
+  return n;
+}
+
+/**
+ * Read decrypted bytes into the buffer.
+ * Records OpenSSL already decrypted are drained as well so the caller gets
+ * as much as possible per call without another socket read.
+ */
+static ssize_t net_ssl_read(struct net_info_t *info, void *buf,
+                            size_t buf_len) {
+  size_t total = 0;
+  do {
+    size_t n = 0;
+    if (SSL_read_ex(info->ssl, (uint8_t *)buf + total, buf_len - total, &n) !=
+        1) {
+      if (total > 0) {
+        break;
+      }
+      return net_ssl_result(info, 0);
+    }
+    total += n;
+    // a read ends with its record. Further records OpenSSL read ahead are
+    // taken as well, unless the last one is incomplete and the socket
+    // blocks.
+  } while (total < buf_len && info->nonblocking &&
+           SSL_has_pending(info->ssl));
+  return total;
+}
+#endif
+
+/**
+ * Translate the result of a plain socket read/write call.
+ */
+static ssize_t net_socket_result(ssize_t n) {
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return NET_WOULD_BLOCK;
+  }
+  return n;
+}
+
+/**
+ * Take the receive timestamps out of the control messages of a recvmsg.
+ */
+static void net_parse_rx_time(struct net_info_t *info, struct msghdr *msg) {
+  memset(&info->rx_time, 0, sizeof(struct net_rx_time_t));
+#ifdef SO_TIMESTAMPING
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_TIMESTAMPING) {
+      // software, deprecated, raw hardware.
+      struct timespec ts[3];
+      memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+      info->rx_time.software = ts[0];
+      info->rx_time.hardware = ts[2];
+    }
+  }
+#else
+  (void)msg;
+#endif
+}
+
+/**
+ * Receive from the socket and record the kernel timestamps of the data.
+ */
+static ssize_t net_recv_timestamped(struct net_info_t *info, void *buf,
+                                    size_t buf_len, int flags) {
+  char cmsg_buf[CMSG_SPACE(sizeof(struct timespec) * 3)];
+  struct iovec iov = {.iov_base = buf, .iov_len = buf_len};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = cmsg_buf,
+      .msg_controllen = sizeof(cmsg_buf),
+  };
+  const ssize_t n = net_socket_result(recvmsg(info->socket, &msg, flags));
+  if (n > 0) {
+    net_parse_rx_time(info, &msg);
+  }
+  return n;
+}
+
+#if defined(WEBC_USE_SSL) && defined(TLS_GET_RECORD_TYPE)
+/**
+ * Receive application data from a kTLS socket.
+ * The kernel reports the type of each record in a control message, records
+ * other than application data fail plain recv calls.
+ * Alerts are treated as the end of the connection. Handshake records (a
+ * late ticket or a KeyUpdate) fail the read: OpenSSL no longer sees the
+ * stream, so tickets can't be cached and a KeyUpdate would leave the
+ * kernel with a stale key.
+ */
+static ssize_t net_ktls_recv(struct net_info_t *info, void *buf,
+                             size_t buf_len, int flags) {
+  char cmsg_buf[CMSG_SPACE(sizeof(unsigned char)) +
+                CMSG_SPACE(sizeof(struct timespec) * 3)];
+  struct iovec iov = {.iov_base = buf, .iov_len = buf_len};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = cmsg_buf,
+      .msg_controllen = sizeof(cmsg_buf),
+  };
+  const ssize_t n = net_socket_result(recvmsg(info->socket, &msg, flags));
+  if (n < 0) {
+    return n;
+  }
+  if (info->rx_timestamps && n > 0) {
+    net_parse_rx_time(info, &msg);
+  }
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  while (cmsg != NULL && (cmsg->cmsg_level != SOL_TLS ||
+                          cmsg->cmsg_type != TLS_GET_RECORD_TYPE)) {
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+  }
+  if (cmsg == NULL) {
+    return n;
+  }
+  const unsigned char record_type = *CMSG_DATA(cmsg);
+  if (record_type == NET_TLS_RECORD_APP_DATA) {
+    return n;
+  }
+  if (record_type == NET_TLS_RECORD_ALERT) {
+    return 0;
+  }
+  fprintf(stderr, "TLS handshake record after kTLS receive offload.\n");
+  return -1;
+}
+#endif
+
+static ssize_t net_socket_peek(struct net_info_t *info, void *buf,
+                               size_t buf_len) {
+  const ssize_t n =
+      net_socket_result(recv(info->socket, buf, buf_len, MSG_PEEK));
+  if (n == -1) {
+    fprintf(stderr, "WebSocket recv failed.\n");
+  }
+  return n;
+}
+
+static ssize_t net_socket_read(struct net_info_t *info, void *buf,
+                               size_t buf_len) {
+  const ssize_t n =
+      info->rx_timestamps
+          ? net_recv_timestamped(info, buf, buf_len, 0)
+          : net_socket_result(recv(info->socket, buf, buf_len, 0));
+  if (n > 0) {
+    net_quick_ack(info);
+  }
+  return n;
+}
+
+static ssize_t net_socket_write(struct net_info_t *info, const void *buf,
+                                size_t buf_len) {
+  const ssize_t n =
+      net_socket_result(send(info->socket, buf, buf_len, MSG_NOSIGNAL));
+  if (n == -1) {
+    fprintf(stderr, "WebSocket client send failure.\n");
+  }
+  return n;
+}
+
+static bool net_socket_set_nonblocking(struct net_info_t *info, bool enable) {
+  const int flags = fcntl(info->socket, F_GETFL, 0);
+  if (flags == -1) {
+    return false;
+  }
+  const int new_flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  return fcntl(info->socket, F_SETFL, new_flags) == 0;
+}
+
+static void net_socket_close(struct net_info_t *info) { close(info->socket); }
+
+const struct net_transport_t net_tcp_transport = {
+    .name = "tcp",
+    .peek = net_socket_peek,
+    .read = net_socket_read,
+    .write = net_socket_write,
+    .set_nonblocking = net_socket_set_nonblocking,
+    .close = net_socket_close,
+};
+
+const struct net_transport_t net_unix_transport = {
+    .name = "unix",
+    .peek = net_socket_peek,
+    .read = net_socket_read,
+    .write = net_socket_write,
+    .set_nonblocking = net_socket_set_nonblocking,
+    .close = net_socket_close,
+};
+
 #ifdef WEBC_USE_SSL
+static ssize_t net_tls_peek(struct net_info_t *info, void *buf,
+                            size_t buf_len) {
+  if (info->early_data != NULL) {
+    return net_take_early_data(info, buf, buf_len, false);
+  }
+#ifdef TLS_GET_RECORD_TYPE
+  if (info->ktls_recv) {
+    return net_ktls_recv(info, buf, buf_len, MSG_PEEK);
+  }
+#endif
+  const ssize_t n = net_ssl_result(info, SSL_peek(info->ssl, buf, buf_len));
+  if (info->ktls_recv_wait) {
+    net_check_ktls_recv(info);
+  }
+  return n;
+}
+
+static ssize_t net_tls_read(struct net_info_t *info, void *buf,
+                            size_t buf_len) {
+  if (info->early_data != NULL) {
+    return net_take_early_data(info, buf, buf_len, true);
+  }
+#ifdef TLS_GET_RECORD_TYPE
+  if (info->ktls_recv) {
+    const ssize_t n = net_ktls_recv(info, buf, buf_len, 0);
+    if (n > 0) {
+      net_quick_ack(info);
+    }
+    return n;
+  }
+#endif
+  // OpenSSL reads the socket itself, peek to get the stamp of the bytes it
+  // reads next. Buffered records keep the stamp of the read they came with.
+  if (info->rx_timestamps && !SSL_has_pending(info->ssl) &&
+      SSL_is_init_finished(info->ssl) &&
+      (SSL_get_shutdown(info->ssl) & SSL_RECEIVED_SHUTDOWN) == 0) {
+    uint8_t byte;
+    // OpenSSL would find the socket empty as well.
+    if (net_recv_timestamped(info, &byte, sizeof(byte), MSG_PEEK) ==
+        NET_WOULD_BLOCK) {
+      return NET_WOULD_BLOCK;
+    }
+  }
+  const ssize_t n = net_ssl_read(info, buf, buf_len);
+  if (info->ktls_recv_wait) {
+    net_check_ktls_recv(info);
+  }
+  if (n > 0) {
+    net_quick_ack(info);
+  }
+  return n;
+}
+
+/**
+ * Send the buffer as early data and finish the handshake.
+ * Data the server rejected is sent again over the established connection.
+ */
+static ssize_t net_write_early(struct net_info_t *info, const void *buf,
+                               size_t buf_len) {
+  info->early_data_pending = false;
+  size_t written = 0;
+  const uint32_t max_early =
+      SSL_SESSION_get_max_early_data(SSL_get0_session(info->ssl));
+  const bool sent_early =
+      buf_len <= max_early &&
+      SSL_write_early_data(info->ssl, buf, buf_len, &written) == 1;
+  if (SSL_connect(info->ssl) != 1) {
+    fprintf(stderr, "SSL connect failed.\n");
+    ERR_print_errors_fp(stderr);
+    // don't offer a session the server just refused again.
+    net_session_forget(info->ssl);
+    return -1;
+  }
+  // the connect deadline ends with the handshake.
+  net_set_io_timeout(info->socket, 0);
+  net_check_ktls(info);
+  if (!sent_early ||
+      SSL_get_early_data_status(info->ssl) != SSL_EARLY_DATA_ACCEPTED) {
+    written = 0;
+  }
+  while (written < buf_len) {
+    const ssize_t n = net_write(info, (const uint8_t *)buf + written,
+                                buf_len - written);
+    if (n <= 0) {
+      return n;
+    }
+    written += n;
+  }
+  return written;
+}
+
+/**
+ * Pick the record size for the next write, small records let the peer
+ * decrypt the first bytes of a burst without waiting for a full 16 KB.
+ */
+static void net_size_records(struct net_info_t *info, size_t len) {
+  if (info->tls_records == NET_TLS_RECORDS_SMALL) {
+    net_set_record_size(info, NET_TLS_SMALL_RECORD);
+    return;
+  }
+  const int64_t now = net_now_ms();
+  if (now - info->last_write_ms > NET_TLS_IDLE_RESET_MS) {
+    info->burst_bytes = 0;
+  }
+  info->last_write_ms = now;
+  net_set_record_size(info, info->burst_bytes < NET_TLS_BOOST_BYTES
+                                ? NET_TLS_SMALL_RECORD
+                                : SSL3_RT_MAX_PLAIN_LENGTH);
+  info->burst_bytes += len;
+}
+
+static ssize_t net_tls_write(struct net_info_t *info, const void *buf,
+                             size_t buf_len) {
+  if (info->early_data_pending) {
+    return net_write_early(info, buf, buf_len);
+  }
+  // with kTLS the kernel encrypts whatever goes through the socket.
+  if (info->ktls_send) {
+    return net_socket_write(info, buf, buf_len);
+  }
+  if (info->tls_records != NET_TLS_RECORDS_FULL) {
+    net_size_records(info, buf_len);
+  }
+  return net_ssl_result(info, SSL_write(info->ssl, buf, buf_len));
+}
+
+static void net_tls_close(struct net_info_t *info) {
   if (info->ssl != NULL) {
     SSL_shutdown(info->ssl);
     SSL_free(info->ssl);
     info->ssl = NULL;
   }
-#endif
+  info->ktls_send = false;
+  info->ktls_recv = false;
+  info->ktls_recv_wait = false;
+  info->early_data_pending = false;
+  free(info->early_data);
+  info->early_data = NULL;
+  info->early_data_len = 0;
+  info->early_data_off = 0;
   close(info->socket);
 }
+
+const struct net_transport_t net_tls_transport = {
+    .name = "tls",
+    .peek = net_tls_peek,
+    .read = net_tls_read,
+    .write = net_tls_write,
+    .set_nonblocking = net_socket_set_nonblocking,
+    .close = net_tls_close,
+};
+#endif
+
+/**
+ * One direction of an in-memory pipe.
+ */
+struct net_pipe_buf_t {
+  uint8_t *data;
+  size_t off;
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * In-memory pipe shared by both ends, guarded by lock.
+ */
+struct net_pipe_t {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // bufs[i] is read by end i and written by the other end.
+  struct net_pipe_buf_t bufs[2];
+  bool closed[2];
+  unsigned int refs;
+};
+
+/**
+ * State of one end of a pipe.
+ */
+struct net_pipe_end_t {
+  struct net_pipe_t *pipe;
+  int side;
+  bool nonblocking;
+};
+
+static ssize_t net_pipe_recv(struct net_info_t *info, void *buf,
+                             size_t buf_len, bool consume) {
+  struct net_pipe_end_t *end = info->transport_data;
+  struct net_pipe_t *pipe = end->pipe;
+  struct net_pipe_buf_t *in = &pipe->bufs[end->side];
+  pthread_mutex_lock(&pipe->lock);
+  while (in->len == 0 && !pipe->closed[!end->side] && !end->nonblocking) {
+    pthread_cond_wait(&pipe->cond, &pipe->lock);
+  }
+  if (in->len == 0) {
+    pthread_mutex_unlock(&pipe->lock);
+    return pipe->closed[!end->side] ? 0 : NET_WOULD_BLOCK;
+  }
+  const size_t n = in->len < buf_len ? in->len : buf_len;
+  memcpy(buf, &in->data[in->off], n);
+  if (consume) {
+    in->off += n;
+    in->len -= n;
+    if (in->len == 0) {
+      in->off = 0;
+    }
+  }
+  pthread_mutex_unlock(&pipe->lock);
+  return n;
+}
+
+static ssize_t net_pipe_peek(struct net_info_t *info, void *buf,
+                             size_t buf_len) {
+  return net_pipe_recv(info, buf, buf_len, false);
+}
+
+static ssize_t net_pipe_read(struct net_info_t *info, void *buf,
+                             size_t buf_len) {
+  return net_pipe_recv(info, buf, buf_len, true);
+}
+
+static ssize_t net_pipe_write(struct net_info_t *info, const void *buf,
+                              size_t buf_len) {
+  struct net_pipe_end_t *end = info->transport_data;
+  struct net_pipe_t *pipe = end->pipe;
+  struct net_pipe_buf_t *out = &pipe->bufs[!end->side];
+  pthread_mutex_lock(&pipe->lock);
+  if (pipe->closed[!end->side]) {
+    pthread_mutex_unlock(&pipe->lock);
+    fprintf(stderr, "WebSocket client send failure.\n");
+    return -1;
+  }
+  if (out->off > 0) {
+    memmove(out->data, &out->data[out->off], out->len);
+    out->off = 0;
+  }
+  if (out->len + buf_len > out->cap) {
+    size_t new_cap = out->cap > 0 ? out->cap : BUFSIZ;
+    while (new_cap < out->len + buf_len) {
+      new_cap *= 2;
+    }
+    uint8_t *data = realloc(out->data, new_cap);
+    if (data == NULL) {
+      pthread_mutex_unlock(&pipe->lock);
+      return -1;
+    }
+    out->data = data;
+    out->cap = new_cap;
+  }
+  memcpy(&out->data[out->len], buf, buf_len);
+  out->len += buf_len;
+  pthread_cond_broadcast(&pipe->cond);
+  pthread_mutex_unlock(&pipe->lock);
+  return buf_len;
+}
+
+static bool net_pipe_set_nonblocking(struct net_info_t *info, bool enable) {
+  struct net_pipe_end_t *end = info->transport_data;
+  end->nonblocking = enable;
+  return true;
+}
+
+static void net_pipe_close(struct net_info_t *info) {
+  struct net_pipe_end_t *end = info->transport_data;
+  if (end == NULL) {
+    return;
+  }
+  struct net_pipe_t *pipe = end->pipe;
+  pthread_mutex_lock(&pipe->lock);
+  pipe->closed[end->side] = true;
+  pthread_cond_broadcast(&pipe->cond);
+  const bool last = --pipe->refs == 0;
+  pthread_mutex_unlock(&pipe->lock);
+  if (last) {
+    free(pipe->bufs[0].data);
+    free(pipe->bufs[1].data);
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->cond);
+    free(pipe);
+  }
+  free(end);
+  info->transport_data = NULL;
+}
+
+const struct net_transport_t net_pipe_transport = {
+    .name = "pipe",
+    .peek = net_pipe_peek,
+    .read = net_pipe_read,
+    .write = net_pipe_write,
+    .set_nonblocking = net_pipe_set_nonblocking,
+    .close = net_pipe_close,
+};
+
+bool net_pipe(struct net_info_t *a, struct net_info_t *b) {
+  struct net_pipe_t *pipe = calloc(1, sizeof(struct net_pipe_t));
+  struct net_pipe_end_t *ends[2] = {
+      calloc(1, sizeof(struct net_pipe_end_t)),
+      calloc(1, sizeof(struct net_pipe_end_t)),
+  };
+  if (pipe == NULL || ends[0] == NULL || ends[1] == NULL) {
+    free(pipe);
+    free(ends[0]);
+    free(ends[1]);
+    return false;
+  }
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_cond_init(&pipe->cond, NULL);
+  pipe->refs = 2;
+  struct net_info_t *infos[2] = {a, b};
+  for (int i = 0; i < 2; ++i) {
+    ends[i]->pipe = pipe;
+    ends[i]->side = i;
+    memset(infos[i], 0, sizeof(struct net_info_t));
+    infos[i]->socket = -1;
+    infos[i]->transport = &net_pipe_transport;
+    infos[i]->transport_data = ends[i];
+  }
+  return true;
+}
+
+static const struct net_transport_t *net_transport(struct net_info_t *info) {
+  return info->transport != NULL ? info->transport : &net_tcp_transport;
+}
+
+ssize_t net_peek(struct net_info_t *info, void *buf, size_t buf_len) {
+  if (info == NULL || buf == NULL) {
+    return false;
+  }
+  return net_transport(info)->peek(info, buf, buf_len);
+}
+
+ssize_t net_read(struct net_info_t *info, void *buf, size_t buf_len) {
+  if (info == NULL || buf == NULL) {
+    return false;
+  }
+  return net_transport(info)->read(info, buf, buf_len);
+}
+
+/**
+ * Write
+ */
+ssize_t net_write(struct net_info_t *info, const void *buf, size_t buf_len) {
+  if (info == NULL || buf == NULL) {
+    return false;
+  }
+  return net_transport(info)->write(info, buf, buf_len);
+}
+
+bool net_set_nonblocking(struct net_info_t *info, bool enable) {
+  if (info == NULL || !net_transport(info)->set_nonblocking(info, enable)) {
+    return false;
+  }
+  info->nonblocking = enable;
+#ifdef WEBC_USE_SSL
+  net_set_tls_read_ahead(info);
+#endif
+  return true;
+}
+
+void net_quick_ack(struct net_info_t *info) {
+#ifdef TCP_QUICKACK
+  if (info->quick_ack) {
+    (void)net_set_int_option(info->socket, IPPROTO_TCP, TCP_QUICKACK, 1,
+                             "TCP_QUICKACK");
+  }
+#else
+  (void)info;
+#endif
+}
+
+/**
+ * Close
+ */
+void net_close(struct net_info_t *info) {
+  if (info == NULL)
+    return;
+  net_transport(info)->close(info);
+}
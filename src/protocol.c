@@ -1,76 +1,127 @@
 #include "headers/protocol.h"
 #include "headers/simd.h"
 #include "unicode_str.h"
+#include <endian.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define _SHIFT_LEN(x, n) (((uint64_t)x) << n)
+/**
+ * Index into the length tables for the given 7 bit payload length code.
+ * 0 for 0-125, 1 for 126 (16 bit length), 2 for 127 (64 bit length).
+ */
+#define _LEN_CODE_INDEX(code) (((code) >= 126) + ((code) == 127))
+/**
+ * Index into the length tables for the given payload length.
+ */
+#define _PAYLOAD_LEN_INDEX(len) (((len) > 125) + ((len) > 0xFFFF))
+
+/**
+ * Extended payload length byte count per length index.
+ */
+static const uint8_t ws_ext_len_table[3] = {0, 2, 8};
+/**
+ * Mask of the payload length bits written to the extended length per index.
+ */
+static const uint64_t ws_ext_mask_table[3] = {0, 0xFFFF, UINT64_MAX};
 
 bool ws_frame_init(struct ws_frame_t *frame) {
   memset(frame, 0, sizeof(struct ws_frame_t));
   return true;
 }
 
-static enum ws_frame_error_t ws_frame_extended_len(struct ws_frame_t *frame,
-                                                   uint8_t *buf, size_t len,
-                                                   size_t *offset) {
-  uint8_t extend_len = 0;
-  switch (frame->payload_len) {
-  case 126:
-    extend_len = 2;
-    break;
-  case 127:
-    extend_len = 8;
-    break;
-  default:
-    break;
-  }
+/**
+ * Decode the payload length from the given header buffer.
+ * The extended length is pulled in with a single unaligned load and byte
+ * swapped, the 7 bit code selects which value is used.
+ */
+static enum ws_frame_error_t ws_frame_decode_len(const uint8_t *buf,
+                                                 size_t len,
+                                                 uint64_t *payload_len,
+                                                 size_t *header_len) {
+  const uint8_t code = buf[1] & 0x7F;
+  const uint8_t idx = _LEN_CODE_INDEX(code);
   // plus 2 for the initial 2 bytes
-  if (len < (extend_len + 2)) {
+  const size_t ext_header_len = 2 + ws_ext_len_table[idx];
+  if (len < ext_header_len) {
     return WS_FRAME_ERROR_LEN;
   }
-  switch (extend_len) {
-  case 2: {
-    frame->payload_len = _SHIFT_LEN(buf[3], 0) | _SHIFT_LEN(buf[2], 8);
-    break;
-  }
-  case 8: {
-    frame->payload_len = (_SHIFT_LEN(buf[9], 0) | _SHIFT_LEN(buf[8], 8) |
-                          _SHIFT_LEN(buf[7], 16) | _SHIFT_LEN(buf[6], 24) |
-                          _SHIFT_LEN(buf[5], 32) | _SHIFT_LEN(buf[4], 40) |
-                          _SHIFT_LEN(buf[3], 48) | _SHIFT_LEN(buf[2], 56));
-    break;
-  }
+  uint64_t raw = 0;
+  if (len >= 10) {
+    memcpy(&raw, &buf[2], sizeof(raw));
+  } else {
+    memcpy(&raw, &buf[2], len - 2);
   }
-  *offset += extend_len;
+  raw = be64toh(raw);
+  const uint64_t lens[3] = {code, raw >> 48, raw};
+  *payload_len = lens[idx];
+  *header_len = ext_header_len + ((buf[1] >> 7) * 4);
   return WS_FRAME_SUCCESS;
 }
 
-static enum ws_frame_error_t
-ws_frame_write_len(struct ws_frame_t *frame, byte_array *out, size_t *offset) {
-  size_t idx = *offset;
-  switch (frame->info.flags.payload_len) {
-  case 126: {
-    out->byte_data[idx] = (frame->payload.len >> 8) & 0xFF;
-    out->byte_data[idx + 1] = (frame->payload.len) & 0xFF;
-    *offset = idx + 2;
-    break;
+size_t ws_frame_write_header(uint8_t *out, uint8_t codes, bool mask,
+                             const uint8_t masking_key[4],
+                             uint64_t payload_len) {
+  const uint8_t idx = _PAYLOAD_LEN_INDEX(payload_len);
+  const uint8_t ext = ws_ext_len_table[idx];
+  const uint64_t len_codes[3] = {payload_len, 126, 127};
+  const uint8_t info = (uint8_t)len_codes[idx] | ((uint8_t)mask << 7);
+  uint32_t mask_value = 0;
+  memcpy(&mask_value, masking_key, sizeof(mask_value));
+  mask_value = be32toh(mask_value) & -(uint32_t)mask;
+#ifdef __SIZEOF_INT128__
+  // compose the whole header as a big endian 128 bit value and store it in
+  // two 8 byte writes.
+  const unsigned __int128 header =
+      ((unsigned __int128)codes << 120) | ((unsigned __int128)info << 112) |
+      ((unsigned __int128)(payload_len & ws_ext_mask_table[idx])
+       << (112 - (8 * ext))) |
+      ((unsigned __int128)mask_value << (80 - (8 * ext)));
+  const uint64_t hi = htobe64((uint64_t)(header >> 64));
+  const uint64_t lo = htobe64((uint64_t)header);
+  memcpy(out, &hi, sizeof(hi));
+  memcpy(&out[8], &lo, sizeof(lo));
+#else
+  out[0] = codes;
+  out[1] = info;
+  const uint64_t ext_value = htobe64(payload_len & ws_ext_mask_table[idx]);
+  memcpy(&out[2], ((const uint8_t *)&ext_value) + (8 - ext), ext);
+  const uint32_t be_mask = htobe32(mask_value);
+  memcpy(&out[2 + ext], &be_mask, sizeof(be_mask));
+#endif
+  return 2 + ext + ((size_t)mask * 4);
+}
+
+enum ws_frame_error_t ws_frame_desc_read(struct ws_frame_desc_t *desc,
+                                         const uint8_t *buf, size_t len) {
+  if (len < 2) {
+    return WS_FRAME_ERROR_LEN;
+  }
+  uint64_t payload_len = 0;
+  size_t header_len = 0;
+  enum ws_frame_error_t err =
+      ws_frame_decode_len(buf, len, &payload_len, &header_len);
+  if (err != WS_FRAME_SUCCESS) {
+    return err;
+  }
+  if (len < header_len) {
+    return WS_FRAME_ERROR_LEN;
   }
-  case 127: {
-    out->byte_data[idx] = (frame->payload.len >> 56) & 0xFF;
-    out->byte_data[idx + 1] = (frame->payload.len >> 48) & 0xFF;
-    out->byte_data[idx + 2] = (frame->payload.len >> 40) & 0xFF;
-    out->byte_data[idx + 3] = (frame->payload.len >> 32) & 0xFF;
-    out->byte_data[idx + 4] = (frame->payload.len >> 24) & 0xFF;
-    out->byte_data[idx + 5] = (frame->payload.len >> 16) & 0xFF;
-    out->byte_data[idx + 6] = (frame->payload.len >> 8) & 0xFF;
-    out->byte_data[idx + 7] = (frame->payload.len) & 0xFF;
-    *offset = idx + 8;
-    break;
+  if (payload_len > UINT32_MAX) {
+    return WS_FRAME_INVALID;
   }
+  desc->codes = buf[0];
+  desc->flags = buf[1] & WS_FRAME_DESC_MASKED;
+  desc->header_len = header_len;
+  desc->reserved = 0;
+  memset(desc->masking_key, 0, 4);
+  if (desc->flags & WS_FRAME_DESC_MASKED) {
+    memcpy(desc->masking_key, &buf[header_len - 4], 4);
   }
+  desc->offset = header_len;
+  desc->len = payload_len;
   return WS_FRAME_SUCCESS;
 }
 
@@ -114,26 +165,12 @@ static enum ws_frame_error_t ws_frame_handle_payload(bool mask,
 
 size_t ws_frame_output_size(struct ws_frame_t *frame) {
   // 2 comes from the first two bytes
-  size_t out_len = 2 + frame->payload.len;
-  if (frame->info.flags.mask) {
-    out_len += 4;
-  }
-  if (frame->payload.len <= 125) {
-    return out_len;
-  } else if (frame->payload.len <= 65536) {
-    return out_len + 2;
-  }
-  return out_len + 8;
+  return 2 + ws_ext_len_table[_PAYLOAD_LEN_INDEX(frame->payload.len)] +
+         ((size_t)frame->info.flags.mask * 4) + frame->payload.len;
 }
 
 uint8_t ws_frame_payload_byte_len(struct ws_frame_t *frame) {
-  switch (frame->info.flags.payload_len) {
-  case 126:
-    return 2;
-  case 127:
-    return 8;
-  }
-  return 0;
+  return ws_ext_len_table[_LEN_CODE_INDEX(frame->info.flags.payload_len)];
 }
 
 enum ws_frame_error_t ws_frame_read(struct ws_frame_t *frame, uint8_t *buf,
@@ -145,7 +182,8 @@ enum ws_frame_error_t ws_frame_read(struct ws_frame_t *frame, uint8_t *buf,
   if (err != WS_FRAME_SUCCESS) {
     return err;
   }
-  return ws_frame_read_body(frame, &buf[2], len - 2);
+  const size_t offset = 2 + ws_frame_payload_byte_len(frame);
+  return ws_frame_read_body(frame, &buf[offset], len - offset);
 }
 
 enum ws_frame_error_t ws_frame_read_header(struct ws_frame_t *frame,
@@ -155,9 +193,9 @@ enum ws_frame_error_t ws_frame_read_header(struct ws_frame_t *frame,
   }
   frame->codes.value = buf[0];
   frame->info.value = buf[1];
-  frame->payload_len = frame->info.flags.payload_len;
-  size_t offset = 2;
-  enum ws_frame_error_t err = ws_frame_extended_len(frame, buf, len, &offset);
+  size_t header_len = 0;
+  enum ws_frame_error_t err =
+      ws_frame_decode_len(buf, len, &frame->payload_len, &header_len);
   if (err != WS_FRAME_SUCCESS) {
     fprintf(stderr, "extended len failed.\n");
     return err;
@@ -192,33 +230,18 @@ enum ws_frame_error_t ws_frame_read_body(struct ws_frame_t *frame, uint8_t *buf,
 enum ws_frame_error_t ws_frame_write(struct ws_frame_t *frame,
                                      byte_array *out) {
   size_t out_len = ws_frame_output_size(frame);
-  if (!byte_array_init(out, out_len)) {
+  // the header is written with full width stores, make sure the buffer has
+  // room for them even with tiny payloads.
+  if (!byte_array_init(out, out_len + WS_FRAME_HEADER_STORE_LEN)) {
     return WS_FRAME_MALLOC_ERROR;
   }
   out->len = out_len;
-  size_t offset = 2;
-  out->byte_data[0] = frame->codes.value;
-  if (frame->payload.len <= 125) {
-    frame->info.flags.payload_len = frame->payload.len;
-  } else if (frame->payload.len < 65536) {
-    frame->info.flags.payload_len = 126;
-  } else {
-    frame->info.flags.payload_len = 127;
-  }
-  out->byte_data[1] = frame->info.value;
-  enum ws_frame_error_t err = ws_frame_write_len(frame, out, &offset);
-  if (err != WS_FRAME_SUCCESS) {
-    byte_array_free(out);
-    return err;
-  }
-  if (frame->info.flags.mask) {
-    out->byte_data[offset] = frame->masking_key[0];
-    out->byte_data[offset + 1] = frame->masking_key[1];
-    out->byte_data[offset + 2] = frame->masking_key[2];
-    out->byte_data[offset + 3] = frame->masking_key[3];
-    offset += 4;
-  }
-  // ensure property matches actual length
+  const size_t offset =
+      ws_frame_write_header(out->byte_data, frame->codes.value,
+                            frame->info.flags.mask, frame->masking_key,
+                            frame->payload.len);
+  // ensure properties match what was written
+  frame->info.value = out->byte_data[1];
   frame->payload_len = frame->payload.len;
   if (out->len < (offset + frame->payload_len)) {
     byte_array_free(out);
@@ -229,12 +252,46 @@ enum ws_frame_error_t ws_frame_write(struct ws_frame_t *frame,
                                  frame->payload.byte_data, frame->payload.len);
 }
 
+enum ws_frame_error_t ws_frame_append(byte_array *out, uint8_t codes,
+                                      bool mask, uint8_t masking_key[4],
+                                      uint8_t *payload, size_t len) {
+  if (len > 0 && payload == NULL) {
+    return WS_FRAME_INVALID;
+  }
+  // room for the full width header stores plus the payload.
+  const size_t needed = out->len + WS_FRAME_HEADER_STORE_LEN + len;
+  if (out->byte_data == NULL || out->cap < needed) {
+    size_t new_cap = out->cap > 0 ? out->cap : 64;
+    while (new_cap < needed) {
+      new_cap *= 2;
+    }
+    uint8_t *data = realloc(out->byte_data, new_cap);
+    if (data == NULL) {
+      return WS_FRAME_MALLOC_ERROR;
+    }
+    out->byte_data = data;
+    out->cap = new_cap;
+  }
+  const size_t offset = out->len + ws_frame_write_header(&out->byte_data[out->len],
+                                                         codes, mask,
+                                                         masking_key, len);
+  enum ws_frame_error_t err = ws_frame_handle_payload(
+      mask, masking_key, &out->byte_data[offset], payload, len);
+  if (err != WS_FRAME_SUCCESS) {
+    return err;
+  }
+  out->len = offset + len;
+  return WS_FRAME_SUCCESS;
+}
+
 void ws_frame_free(struct ws_frame_t *frame) {
   if (frame == NULL) {
     return;
   }
+  if (frame->payload.byte_data != NULL) {
+    byte_array_free(&frame->payload);
+  }
   memset(frame, 0, sizeof(struct ws_frame_t));
-  byte_array_free(&frame->payload);
 }
 
 void ws_frame_print(struct ws_frame_t *frame) {
@@ -256,3 +313,21 @@ void ws_frame_print(struct ws_frame_t *frame) {
   printf("\n");
   printf("---end frame:\n");
 }
+
+void ws_frame_desc_print(const struct ws_frame_desc_t *desc) {
+  printf("---frame desc:\n");
+  printf("fin:%d\n", ws_frame_desc_fin(desc));
+  printf("rsv1:%d\n", ws_frame_desc_rsv1(desc));
+  printf("rsv2:%d\n", ws_frame_desc_rsv2(desc));
+  printf("rsv3:%d\n", ws_frame_desc_rsv3(desc));
+  printf("opcode:%d\n", ws_frame_desc_opcode(desc));
+  printf("mask:%d\n", ws_frame_desc_masked(desc));
+  printf("header_len:%d\n", desc->header_len);
+  printf("offset:%u\n", desc->offset);
+  printf("len:%u\n", desc->len);
+  if (ws_frame_desc_masked(desc)) {
+    printf("mask: [%d, %d, %d, %d]\n", desc->masking_key[0],
+           desc->masking_key[1], desc->masking_key[2], desc->masking_key[3]);
+  }
+  printf("---end frame desc:\n");
+}
@@ -1,162 +1,271 @@
 #include "headers/reader.h"
 #include "headers/net.h"
 #include "headers/protocol.h"
+#include "headers/simd.h"
 #include "queue.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <time.h>
+
+#define FRAME_INITIAL_CAP 8
+#define PAYLOAD_INITIAL_CAP 256
+// amount of free space to make available in the receive buffer per read.
+#define RX_CHUNK_LEN 16384
 
 struct ws_reader_t {
-  struct simple_queue_t *frame_queue;
+  /**
+   * Descriptors of the pending fragmented frames.
+   */
+  struct ws_frame_desc_t *frames;
+  size_t frame_len;
+  size_t frame_cap;
+  /**
+   * Unmasked payloads of the pending fragmented frames, back to back.
+   * The frame descriptors point into this buffer.
+   */
+  byte_array payload;
+  /**
+   * Bytes received from the connection that have not been parsed yet.
+   * Only holds a partial frame between calls.
+   */
+  byte_array rx;
   struct simple_queue_t *msg_queue;
   bool is_open;
+  /**
+   * Receive timestamps of the bytes being parsed.
+   */
+  struct net_rx_time_t rx_time;
 };
 
-static void construct_msg_from_frames(struct ws_reader_t *reader) {
-  if (reader == NULL || !reader->is_open) {
-    return;
+/**
+ * Ensure the byte array can hold at least cap bytes.
+ */
+static bool reserve_bytes(byte_array *arr, size_t cap) {
+  if (arr->byte_data != NULL && arr->cap >= cap) {
+    return true;
   }
-  struct ws_message_t *msg = malloc(sizeof(struct ws_message_t));
-  if (!ws_message_init(msg)) {
-    fprintf(stderr, "message init failed.\n");
-    free(msg);
-    return;
+  size_t new_cap = arr->cap > 0 ? arr->cap : PAYLOAD_INITIAL_CAP;
+  while (new_cap < cap) {
+    new_cap *= 2;
   }
-  size_t frame_count = simple_queue_len(reader->frame_queue);
-  for (; frame_count > 0; --frame_count) {
-    struct ws_frame_t *frame = NULL;
-    if (!simple_queue_pop(reader->frame_queue, (void**)&frame)){
-      fprintf(stderr, "popping frame queue failed.\n");
-      free(frame);
-      ws_message_free(msg);
-      free(msg);
-      return;
-    }
-    if (frame->codes.flags.opcode != OPCODE_CONT) {
-      msg->type = frame->codes.flags.opcode;
-    }
-    for (size_t i = 0; i < frame->payload.len; ++i) {
-      if (!byte_array_insert(&msg->body, frame->payload.byte_data[i])) {
-        fprintf(stderr, "concat msg failed\n");
-        free(frame);
-        ws_message_free(msg);
-        free(msg);
-        return;
-      }
+  uint8_t *data = realloc(arr->byte_data, new_cap);
+  if (data == NULL) {
+    return false;
+  }
+  arr->byte_data = data;
+  arr->cap = new_cap;
+  return true;
+}
+
+static bool push_frame(struct ws_reader_t *reader,
+                       const struct ws_frame_desc_t *desc) {
+  if (reader->frame_len == reader->frame_cap) {
+    const size_t new_cap =
+        reader->frame_cap > 0 ? reader->frame_cap * 2 : FRAME_INITIAL_CAP;
+    struct ws_frame_desc_t *frames =
+        realloc(reader->frames, sizeof(struct ws_frame_desc_t) * new_cap);
+    if (frames == NULL) {
+      return false;
     }
-    free(frame);
+    reader->frames = frames;
+    reader->frame_cap = new_cap;
+  }
+  reader->frames[reader->frame_len] = *desc;
+  reader->frame_len++;
+  return true;
+}
+
+static bool push_msg(struct ws_reader_t *reader, enum ws_opcode_t type,
+                     byte_array body) {
+  struct ws_message_t *msg = malloc(sizeof(struct ws_message_t));
+  if (msg == NULL) {
+    byte_array_free(&body);
+    return false;
   }
-  if (!simple_queue_push(reader->msg_queue, msg)) {
+  msg->type = type;
+  msg->body = body;
+  msg->rx_time = reader->rx_time;
+  memset(&msg->dispatch_time, 0, sizeof(struct timespec));
+  if (!reader->is_open || !simple_queue_push(reader->msg_queue, msg)) {
     fprintf(stderr, "msg queue failed\n");
     ws_message_free(msg);
     free(msg);
-    return;
+    return false;
   }
+  return true;
+}
+
+static bool construct_msg_from_frames(struct ws_reader_t *reader) {
+  if (reader == NULL || !reader->is_open || reader->frame_len == 0) {
+    return false;
+  }
+  // the pending payload buffer already holds the message body so hand it
+  // over to the message.
+  const enum ws_opcode_t type = ws_frame_desc_opcode(&reader->frames[0]);
+  byte_array body = reader->payload;
+  memset(&reader->payload, 0, sizeof(byte_array));
+  reader->frame_len = 0;
+  return push_msg(reader, type, body);
 }
 
 struct ws_reader_t* ws_reader_create() {
   struct ws_reader_t *result = malloc(sizeof(struct ws_reader_t));
-  result->frame_queue = simple_queue_create();
+  result->frames = NULL;
+  result->frame_len = 0;
+  result->frame_cap = 0;
+  memset(&result->payload, 0, sizeof(byte_array));
+  memset(&result->rx, 0, sizeof(byte_array));
   result->msg_queue = simple_queue_create();
   result->is_open = true;
+  memset(&result->rx_time, 0, sizeof(struct net_rx_time_t));
   return result;
 }
 
-bool ws_reader_handle(struct ws_reader_t *reader, struct net_info_t *info) {
-  if (info == NULL) {
-    return false;
+/**
+ * Handle a complete frame whose payload is in the given buffer.
+ */
+static bool ws_reader_handle_frame(struct ws_reader_t *reader,
+                                   struct ws_frame_desc_t *desc,
+                                   uint8_t *payload) {
+  const enum ws_opcode_t opcode = ws_frame_desc_opcode(desc);
+  const bool masked = ws_frame_desc_masked(desc);
+  if (opcode >= OPCODE_CLOSE) {
+    byte_array body;
+    memset(&body, 0, sizeof(byte_array));
+    if (desc->len > 0) {
+      if (!byte_array_init(&body, desc->len)) {
+        return false;
+      }
+      body.len = desc->len;
+      if (masked) {
+        (void)apply_mask_to_buffer(desc->masking_key, body.byte_data, payload,
+                                   desc->len);
+      } else {
+        memcpy(body.byte_data, payload, desc->len);
+      }
+    }
+    return push_msg(reader, opcode, body);
   }
-  // 10 for possible 8 byte payload value
-  uint8_t header[10] = {0};
-#ifdef DEBUG
-  printf("peeking from socket\n");
-#endif
-  ssize_t n = net_peek(info, header, 10);
-  if (n <= -1) {
+  if (!reserve_bytes(&reader->payload, reader->payload.len + desc->len)) {
+    fprintf(stderr, "payload buffer allocation failed.\n");
     return false;
-  } else if (n == 0) {
-    return true;
   }
-#ifdef DEBUG
-  printf("header=%s\n", header);
-#endif
-  struct ws_frame_t *frame = malloc(sizeof(struct ws_frame_t));;
-  if (!ws_frame_init(frame)) {
-    return false;
+  desc->offset = reader->payload.len;
+  uint8_t *dest = &reader->payload.byte_data[desc->offset];
+  if (masked) {
+    (void)apply_mask_to_buffer(desc->masking_key, dest, payload, desc->len);
+  } else if (desc->len > 0) {
+    memcpy(dest, payload, desc->len);
   }
-  enum ws_frame_error_t err = ws_frame_read_header(frame, header, n);
-  if (err != WS_FRAME_SUCCESS) {
-    ws_frame_free(frame);
-    free(frame);
+  reader->payload.len += desc->len;
+  if (!reader->is_open || !push_frame(reader, desc)) {
     return false;
   }
-#ifdef DEBUG
-  ws_frame_print(frame);
-#endif
-  size_t payload_offset = 2 + ws_frame_payload_byte_len(frame);
-  size_t msg_len = payload_offset + frame->payload_len;
-  if (frame->info.flags.mask) {
-    msg_len += 4;
+  if (ws_frame_desc_fin(desc)) {
+    return construct_msg_from_frames(reader);
   }
-  uint8_t *buffer = malloc((sizeof(uint8_t)*msg_len+1));
+  return true;
+}
+
+/**
+ * Parse every complete frame out of the receive buffer.
+ * A trailing partial frame is moved to the front of the buffer.
+ */
+static bool ws_reader_parse(struct ws_reader_t *reader) {
+  byte_array *rx = &reader->rx;
+  size_t offset = 0;
+  while (offset < rx->len) {
+    uint8_t *buf = &rx->byte_data[offset];
+    const size_t avail = rx->len - offset;
+    struct ws_frame_desc_t desc;
+    const enum ws_frame_error_t err = ws_frame_desc_read(&desc, buf, avail);
+    if (err == WS_FRAME_ERROR_LEN) {
+      // header is not complete yet.
+      break;
+    }
+    if (err != WS_FRAME_SUCCESS) {
+      fprintf(stderr, "read header failed with code: %d\n", err);
+      return false;
+    }
+    const size_t frame_len = desc.header_len + (size_t)desc.len;
+    if (avail < frame_len) {
+      // make sure the rest of the frame fits once it arrives.
+      if (!reserve_bytes(rx, rx->len + (frame_len - avail))) {
+        return false;
+      }
+      break;
+    }
 #ifdef DEBUG
-  printf("reading from socket\n");
+    ws_frame_desc_print(&desc);
 #endif
-  n = net_read(info, buffer, msg_len);
-  if (n <= -1 && frame->codes.flags.opcode == OPCODE_CLOSE) {
-    frame->payload.byte_data = NULL;
-    frame->payload.len = 0;
-    frame->payload_len = 0;
-    struct ws_message_t *msg = malloc(sizeof(struct ws_message_t));
-    msg->type = frame->codes.flags.opcode;
-    msg->body = frame->payload;
-    if (!reader->is_open || !simple_queue_push(reader->msg_queue, msg)) {
-      free(msg);
-      ws_frame_free(frame);
-      free(frame);
+    if (!ws_reader_handle_frame(reader, &desc, &buf[desc.header_len])) {
       return false;
     }
+    offset += frame_len;
+  }
+  if (offset > 0) {
+    if (offset < rx->len) {
+      memmove(rx->byte_data, &rx->byte_data[offset], rx->len - offset);
+    }
+    rx->len -= offset;
+  }
+  return true;
+}
+
+ssize_t ws_reader_fill(struct ws_reader_t *reader, struct net_info_t *info) {
+  if (info == NULL || !reader->is_open) {
+    return -1;
+  }
+  if (!reserve_bytes(&reader->rx, reader->rx.len + RX_CHUNK_LEN)) {
+    fprintf(stderr, "receive buffer allocation failed.\n");
+    return -1;
+  }
+  const ssize_t n = net_read(info, &reader->rx.byte_data[reader->rx.len],
+                             reader->rx.cap - reader->rx.len);
+  if (n <= 0) {
+    return n;
+  }
+  reader->rx.len += n;
+  reader->rx_time = info->rx_time;
+  if (!ws_reader_parse(reader)) {
+    return -1;
+  }
+  return n;
+}
+
+bool ws_reader_feed(struct ws_reader_t *reader, const uint8_t *buf,
+                    size_t len) {
+  if (!reader->is_open) {
+    return false;
+  }
+  if (len == 0) {
     return true;
   }
-  if (((size_t)n) != msg_len) {
-    fprintf(stderr, "socket read did not match message length: n=%ld; msg_len:%zu\n", n, msg_len);
-    ws_frame_free(frame);
-    free(frame);
+  if (!reserve_bytes(&reader->rx, reader->rx.len + len)) {
+    fprintf(stderr, "receive buffer allocation failed.\n");
     return false;
   }
-#ifdef DEBUG
-  printf("payload_offset:%zu msg_len-poffset:%zu, char:%c\n", payload_offset, msg_len-payload_offset, buffer[payload_offset]);
-  printf("buffer: %s\n", buffer);
-#endif
-  err = ws_frame_read_body(frame, &buffer[payload_offset], msg_len - payload_offset);
-  if (err != WS_FRAME_SUCCESS) {
-    fprintf(stderr, "read body failed with code: %d\n", err);
-    ws_frame_free(frame);
+  memcpy(&reader->rx.byte_data[reader->rx.len], buf, len);
+  reader->rx.len += len;
+  // bytes read elsewhere come without timestamps.
+  memset(&reader->rx_time, 0, sizeof(struct net_rx_time_t));
+  return ws_reader_parse(reader);
+}
+
+bool ws_reader_handle(struct ws_reader_t *reader, struct net_info_t *info) {
+  if (info == NULL) {
     return false;
   }
-  if (frame->codes.flags.fin) {
-    if (frame->codes.flags.opcode >= OPCODE_CLOSE) {
-      struct ws_message_t *msg = malloc(sizeof(struct ws_message_t));
-      msg->type = frame->codes.flags.opcode;
-      msg->body = frame->payload;
-      frame->payload.byte_data = NULL;
-      if (!reader->is_open || !simple_queue_push(reader->msg_queue, msg)) {
-        free(msg);
-        ws_frame_free(frame);
-        free(frame);
-        return false;
-      }
-    } else {
-      if (!reader->is_open || !simple_queue_push(reader->frame_queue, frame)) {
-        ws_frame_free(frame);
-        free(frame);
-        return false;
-      }
-      construct_msg_from_frames(reader);
+  // read big chunks into the receive buffer until a message is complete,
+  // frames split across reads (or TLS records) are finished from there.
+  while (simple_queue_len(reader->msg_queue) == 0) {
+    const ssize_t n = ws_reader_fill(reader, info);
+    if (n == 0 || n == NET_WOULD_BLOCK) {
+      return true;
     }
-  } else {
-    if (!reader->is_open || !simple_queue_push(reader->frame_queue, frame)) {
-      ws_frame_free(frame);
-      free(frame);
+    if (n < 0) {
       return false;
     }
   }
@@ -167,6 +276,9 @@ struct ws_message_t* ws_reader_next_msg(struct ws_reader_t *reader) {
   if (reader->is_open && !simple_queue_pop(reader->msg_queue, (void**)&result)) {
     return NULL;
   }
+  if (result != NULL) {
+    clock_gettime(CLOCK_REALTIME, &result->dispatch_time);
+  }
   return result;
 }
 
@@ -174,8 +286,21 @@ void ws_reader_destroy(struct ws_reader_t **reader) {
   if (*reader == NULL) {
     return;
   }
-  simple_queue_destroy(&(*reader)->frame_queue);
+  struct ws_message_t *msg = NULL;
+  while (simple_queue_pop((*reader)->msg_queue, (void **)&msg)) {
+    ws_message_free(msg);
+    free(msg);
+  }
   simple_queue_destroy(&(*reader)->msg_queue);
+  if ((*reader)->frames != NULL) {
+    free((*reader)->frames);
+  }
+  if ((*reader)->payload.byte_data != NULL) {
+    byte_array_free(&(*reader)->payload);
+  }
+  if ((*reader)->rx.byte_data != NULL) {
+    byte_array_free(&(*reader)->rx);
+  }
   (*reader)->is_open = false;
   free(*reader);
   *reader = NULL;
@@ -183,6 +308,8 @@ void ws_reader_destroy(struct ws_reader_t **reader) {
 
 bool ws_message_init(struct ws_message_t *msg) {
   msg->type = OPCODE_CONT;
+  memset(&msg->rx_time, 0, sizeof(struct net_rx_time_t));
+  memset(&msg->dispatch_time, 0, sizeof(struct timespec));
   return byte_array_init(&msg->body, 1);
 };
 void ws_message_free(struct ws_message_t *msg) {
@@ -193,4 +320,3 @@ void ws_message_free(struct ws_message_t *msg) {
     byte_array_free(&msg->body);
   }
 }
-
@@ -0,0 +1,76 @@
+#include "headers/server.h"
+#include "headers/encode.h"
+#include "headers/http.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "string_ops.h"
+
+#define WS_SERVER_SWITCHING                                                    \
+  "HTTP/1.1 101 Switching Protocols\r\n"                                       \
+  "Upgrade: websocket\r\n"                                                     \
+  "Connection: Upgrade\r\n"                                                    \
+  "Sec-WebSocket-Accept: "
+#define WS_SERVER_BAD_REQUEST                                                  \
+  "HTTP/1.1 400 Bad Request\r\n"                                               \
+  "Connection: close\r\n"                                                      \
+  "Content-Length: 0\r\n\r\n"
+
+static bool ws_server_write_all(struct net_info_t *info, const char *buf,
+                                size_t len) {
+  size_t offset = 0;
+  while (offset < len) {
+    const ssize_t n = net_write(info, &buf[offset], len - offset);
+    if (n <= 0) {
+      return false;
+    }
+    offset += n;
+  }
+  return true;
+}
+
+bool ws_server_upgrade(struct net_info_t *info, char **path, byte_array *rest) {
+  char buf[WS_SERVER_MAX_REQUEST];
+  size_t len = 0;
+  struct http_upgrade_request_t req;
+  enum http_parse_result_t result = HTTP_PARSE_INCOMPLETE;
+  while (result == HTTP_PARSE_INCOMPLETE && len < sizeof(buf)) {
+    const ssize_t n = net_read(info, &buf[len], sizeof(buf) - len);
+    if (n <= 0) {
+      fprintf(stderr, "WebSocket server failed to read the upgrade request.\n");
+      return false;
+    }
+    len += n;
+    result = http_upgrade_request_parse(&req, buf, len);
+  }
+  if (result != HTTP_PARSE_OK) {
+    fprintf(stderr, "WebSocket server received an invalid upgrade request.\n");
+    (void)ws_server_write_all(info, WS_SERVER_BAD_REQUEST,
+                              strlen(WS_SERVER_BAD_REQUEST));
+    return false;
+  }
+  char accept[WS_ACCEPT_NOONCE_LEN + 1];
+  const size_t accept_len = generate_accept_noonce(
+      &buf[req.key.offset], req.key.len, accept, sizeof(accept));
+  if (accept_len == 0) {
+    return false;
+  }
+  char response[sizeof(WS_SERVER_SWITCHING) + sizeof(accept) + 4];
+  const int response_len = snprintf(response, sizeof(response),
+                                    WS_SERVER_SWITCHING "%s\r\n\r\n", accept);
+  if (!ws_server_write_all(info, response, response_len)) {
+    fprintf(stderr, "WebSocket server failed to send the upgrade response.\n");
+    return false;
+  }
+  const size_t rest_len = len - req.header_len;
+  if (!byte_array_init(rest, rest_len)) {
+    return false;
+  }
+  memcpy(rest->byte_data, &buf[req.header_len], rest_len);
+  rest->len = rest_len;
+  if (path != NULL) {
+    *path = str_dup(&buf[req.path.offset], req.path.len);
+  }
+  return true;
+}
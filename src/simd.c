@@ -191,3 +191,272 @@ enum ws_frame_error_t apply_mask_to_buffer(uint8_t masking_key[4],
 #endif
   return result;
 }
+
+static enum ws_frame_error_t
+apply_mask_in_place_serial(const uint8_t masking_key[4], uint8_t *buf,
+                           size_t len, size_t offset) {
+  for (size_t index = offset; index < len; index++) {
+    buf[index] ^= masking_key[index & 3];
+  }
+  return WS_FRAME_SUCCESS;
+}
+
+#if (defined(__i386__) || defined(__x86_64__) || defined(__aarch64__) ||       \
+     (defined(__arm__) && defined(__ARM_ARCH_7A__))) &&                        \
+    !defined(DISABLE_SIMD) && (defined(__clang__) || defined(__GNUC__))
+#define SIMD_VECTOR_EXT_SUPPORTED 1
+
+static enum ws_frame_error_t
+apply_mask_in_place_simd(const uint8_t masking_key[4], uint8_t *buf,
+                         size_t len) {
+  const uint8_t m1 = masking_key[0];
+  const uint8_t m2 = masking_key[1];
+  const uint8_t m3 = masking_key[2];
+  const uint8_t m4 = masking_key[3];
+  // repeat the mask 4 times.
+  const v16u8 mask_simd = {m1, m2, m3, m4, m1, m2, m3, m4,
+                           m1, m2, m3, m4, m1, m2, m3, m4};
+  size_t offset = 0;
+  while ((offset + 16) <= len) {
+    v16u8 vec;
+    memcpy(&vec, &buf[offset], sizeof(vec));
+    vec ^= mask_simd;
+    memcpy(&buf[offset], &vec, sizeof(vec));
+    offset += 16;
+  }
+  // convert the remaining bytes.
+  return apply_mask_in_place_serial(masking_key, buf, len, offset);
+}
+
+#endif
+
+enum ws_frame_error_t apply_mask_in_place(const uint8_t masking_key[4],
+                                          uint8_t *buf, size_t len) {
+#ifdef SIMD_VECTOR_EXT_SUPPORTED
+  return apply_mask_in_place_simd(masking_key, buf, len);
+#else
+  return apply_mask_in_place_serial(masking_key, buf, len, 0);
+#endif
+}
+
+/**
+ * Base64 alphabet used for encoding.
+ */
+static const char base64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Convert a base64 character to its 6 bit value, 0xFF if invalid.
+ */
+static inline uint8_t base64_decode_char(uint8_t c) {
+  if (c >= 'A' && c <= 'Z') {
+    return c - 'A';
+  }
+  if (c >= 'a' && c <= 'z') {
+    return c - 'a' + 26;
+  }
+  if (c >= '0' && c <= '9') {
+    return c - '0' + 52;
+  }
+  if (c == '+') {
+    return 62;
+  }
+  if (c == '/') {
+    return 63;
+  }
+  return 0xFF;
+}
+
+static size_t base64_encode_blocks_serial(char *restrict dest,
+                                          const uint8_t *restrict src,
+                                          size_t len, size_t offset) {
+  size_t out = (offset / 3) * 4;
+  for (; (offset + 3) <= len; offset += 3) {
+    const uint32_t group = ((uint32_t)src[offset] << 16) |
+                           ((uint32_t)src[offset + 1] << 8) |
+                           (uint32_t)src[offset + 2];
+    dest[out] = base64_table[(group >> 18) & 0x3F];
+    dest[out + 1] = base64_table[(group >> 12) & 0x3F];
+    dest[out + 2] = base64_table[(group >> 6) & 0x3F];
+    dest[out + 3] = base64_table[group & 0x3F];
+    out += 4;
+  }
+  return offset;
+}
+
+static bool base64_decode_blocks_serial(uint8_t *restrict dest,
+                                        const char *restrict src, size_t len,
+                                        size_t offset) {
+  size_t out = (offset / 4) * 3;
+  for (; (offset + 4) <= len; offset += 4) {
+    const uint8_t s0 = base64_decode_char(src[offset]);
+    const uint8_t s1 = base64_decode_char(src[offset + 1]);
+    const uint8_t s2 = base64_decode_char(src[offset + 2]);
+    const uint8_t s3 = base64_decode_char(src[offset + 3]);
+    if ((s0 | s1 | s2 | s3) & 0xC0) {
+      return false;
+    }
+    dest[out] = (s0 << 2) | (s1 >> 4);
+    dest[out + 1] = (s1 << 4) | (s2 >> 2);
+    dest[out + 2] = (s2 << 6) | s3;
+    out += 3;
+  }
+  return true;
+}
+
+#ifdef SIMD_VECTOR_EXT_SUPPORTED
+
+/**
+ * Rearrange the lanes of a v16u8, lane i of the result is lane indices[i] of
+ * vec. The indices have to be constants.
+ */
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 12)
+#define v16u8_shuffle(vec, ...) __builtin_shufflevector(vec, vec, __VA_ARGS__)
+#else
+#define v16u8_shuffle(vec, ...) __builtin_shuffle(vec, (v16u8){__VA_ARGS__})
+#endif
+
+/**
+ * Encode 12 bytes at a time into 16 characters.
+ * Every 3 byte group is shuffled into per-lane high/low pairs so the 6 bit
+ * values and the alphabet translation can be computed for all 16 lanes at
+ * once.
+ */
+static size_t base64_encode_blocks_simd(char *restrict dest,
+                                        const uint8_t *restrict src,
+                                        size_t len) {
+  const v16u8 lshift = {0, 4, 2, 0, 0, 4, 2, 0, 0, 4, 2, 0, 0, 4, 2, 0};
+  const v16u8 rshift = {2, 4, 6, 0, 2, 4, 6, 0, 2, 4, 6, 0, 2, 4, 6, 0};
+  size_t offset = 0;
+  size_t out = 0;
+  while ((offset + 12) <= len) {
+    // lanes 12 to 15 stay zero and fill the gaps in the shuffles.
+    v16u8 bytes = {0};
+    memcpy(&bytes, &src[offset], 12);
+    const v16u8 hi = v16u8_shuffle(bytes, 12, 0, 1, 2, 12, 3, 4, 5, 12, 6, 7,
+                                   8, 12, 9, 10, 11);
+    const v16u8 lo = v16u8_shuffle(bytes, 0, 1, 2, 12, 3, 4, 5, 12, 6, 7, 8,
+                                   12, 9, 10, 11, 12);
+    const v16u8 sextets = ((hi << lshift) | (lo >> rshift)) & 0x3F;
+    // translate 6 bit values into the alphabet by adding the offset of the
+    // range each value falls into.
+    v16u8 result = sextets + 'A';
+    result += (v16u8)(sextets >= 26) & 6;
+    result += (v16u8)(sextets >= 52) & (uint8_t)-75;
+    result += (v16u8)(sextets >= 62) & (uint8_t)-15;
+    result += (v16u8)(sextets >= 63) & 3;
+    memcpy(&dest[out], &result, sizeof(result));
+    offset += 12;
+    out += 16;
+  }
+  // convert the remaining bytes.
+  return base64_encode_blocks_serial(dest, src, len, offset);
+}
+
+/**
+ * Decode 16 characters at a time into 12 bytes.
+ * Each output byte is made of two neighbouring 6 bit values, which are
+ * shuffled into place and combined for all lanes at once.
+ */
+static bool base64_decode_blocks_simd(uint8_t *restrict dest,
+                                      const char *restrict src, size_t len) {
+  const v16u8 lshift = {2, 4, 6, 2, 4, 6, 2, 4, 6, 2, 4, 6, 0, 0, 0, 0};
+  const v16u8 rshift = {4, 2, 0, 4, 2, 0, 4, 2, 0, 4, 2, 0, 0, 0, 0, 0};
+  size_t offset = 0;
+  size_t out = 0;
+  while ((offset + 16) <= len) {
+    v16u8 chars;
+    memcpy(&chars, &src[offset], sizeof(chars));
+    const v16u8 upper = (v16u8)((chars >= 'A') & (chars <= 'Z'));
+    const v16u8 lower = (v16u8)((chars >= 'a') & (chars <= 'z'));
+    const v16u8 digit = (v16u8)((chars >= '0') & (chars <= '9'));
+    const v16u8 plus = (v16u8)(chars == '+');
+    const v16u8 slash = (v16u8)(chars == '/');
+    const v16u8 invalid = ~(upper | lower | digit | plus | slash);
+    uint64_t invalid_words[2];
+    memcpy(invalid_words, &invalid, sizeof(invalid_words));
+    if ((invalid_words[0] | invalid_words[1]) != 0) {
+      return false;
+    }
+    const v16u8 sextets = (upper & (chars - 'A')) |
+                          (lower & (chars - ('a' - 26))) |
+                          (digit & (chars + (52 - '0'))) | (plus & 62) |
+                          (slash & 63);
+    // output byte k of a group takes its high bits from sextet k and its low
+    // bits from sextet k + 1, lanes 12 to 15 are not stored.
+    const v16u8 hi = v16u8_shuffle(sextets, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+                                   14, 0, 0, 0, 0);
+    const v16u8 lo = v16u8_shuffle(sextets, 1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14,
+                                   15, 0, 0, 0, 0);
+    const v16u8 bytes = (hi << lshift) | (lo >> rshift);
+    memcpy(&dest[out], &bytes, 12);
+    offset += 16;
+    out += 12;
+  }
+  // convert the remaining characters.
+  return base64_decode_blocks_serial(dest, src, len, offset);
+}
+
+#endif
+
+size_t base64_encode_blocks(char *restrict dest, const uint8_t *restrict src,
+                            size_t len) {
+#ifdef SIMD_VECTOR_EXT_SUPPORTED
+  return base64_encode_blocks_simd(dest, src, len);
+#else
+  return base64_encode_blocks_serial(dest, src, len, 0);
+#endif
+}
+
+bool base64_decode_blocks(uint8_t *restrict dest, const char *restrict src,
+                          size_t len) {
+#ifdef SIMD_VECTOR_EXT_SUPPORTED
+  return base64_decode_blocks_simd(dest, src, len);
+#else
+  return base64_decode_blocks_serial(dest, src, len, 0);
+#endif
+}
+
+static size_t find_next_byte_serial(const uint8_t *buf, size_t len,
+                                    uint8_t target, size_t offset) {
+  for (; offset < len; ++offset) {
+    if (buf[offset] == target) {
+      return offset;
+    }
+  }
+  return len;
+}
+
+#ifdef SIMD_VECTOR_EXT_SUPPORTED
+
+/**
+ * Compare 16 bytes at a time and only fall back to a byte scan for the block
+ * that contains a match.
+ */
+static size_t find_next_byte_simd(const uint8_t *buf, size_t len,
+                                  uint8_t target) {
+  size_t offset = 0;
+  while ((offset + 16) <= len) {
+    v16u8 vec;
+    memcpy(&vec, &buf[offset], sizeof(vec));
+    const v16u8 matches = (v16u8)(vec == target);
+    uint64_t match_words[2];
+    memcpy(match_words, &matches, sizeof(match_words));
+    if ((match_words[0] | match_words[1]) != 0) {
+      return find_next_byte_serial(buf, offset + 16, target, offset);
+    }
+    offset += 16;
+  }
+  // check the remaining bytes.
+  return find_next_byte_serial(buf, len, target, offset);
+}
+
+#endif
+
+size_t find_next_byte(const uint8_t *buf, size_t len, uint8_t target) {
+#ifdef SIMD_VECTOR_EXT_SUPPORTED
+  return find_next_byte_simd(buf, len, target);
+#else
+  return find_next_byte_serial(buf, len, target, 0);
+#endif
+}
@@ -0,0 +1,500 @@
+#include "headers/standby.h"
+#include "headers/net.h"
+#include "headers/websocket.h"
+#include "string_ops.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// delay between background connect attempts, doubled up to the max.
+#define STANDBY_RETRY_MIN_MS 100
+#define STANDBY_RETRY_MAX_MS 2000
+
+/**
+ * A connection of the pair and its liveness.
+ */
+struct ws_standby_conn_t {
+  struct ws_client_t *client;
+  // index into the endpoint urls.
+  size_t endpoint;
+  int64_t last_rx_ms;
+  int64_t last_ping_ms;
+};
+
+struct ws_standby_t {
+  char *urls[2];
+  size_t url_len;
+  struct ws_standby_options_t opts;
+  on_message_callback *cb;
+  on_promote_callback *promote_cb;
+  void *context;
+  struct ws_standby_conn_t active;
+  struct ws_standby_conn_t standby;
+  unsigned int failovers;
+  /**
+   * Background connect state, guarded by lock.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  bool thread_started;
+  bool connecting;
+  bool stopping;
+  size_t fresh_endpoint;
+  struct ws_client_t *fresh;
+  // written by the connect thread to wake up ws_standby_run_once.
+  int wake_fds[2];
+};
+
+static int64_t standby_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void standby_client_free(struct ws_client_t *client) {
+  if (client == NULL) {
+    return;
+  }
+  ws_client_free(client);
+  free(client);
+}
+
+/**
+ * Connect a new client to the endpoint, blocking.
+ *
+ * @return The connected client, NULL on failure.
+ */
+static struct ws_client_t *standby_open(struct ws_standby_t *standby,
+                                        size_t endpoint) {
+  const char *url = standby->urls[endpoint];
+  struct ws_client_t *client = malloc(sizeof(struct ws_client_t));
+  if (client == NULL) {
+    return NULL;
+  }
+  if (!ws_client_from_str(url, strlen(url), client)) {
+    standby_client_free(client);
+    return NULL;
+  }
+  client->net_options = standby->opts.net_options;
+  if (!ws_client_connect(client)) {
+    standby_client_free(client);
+    return NULL;
+  }
+  return client;
+}
+
+static void *standby_connect_main(void *arg) {
+  struct ws_standby_t *standby = arg;
+  pthread_mutex_lock(&standby->lock);
+  const size_t endpoint = standby->fresh_endpoint;
+  pthread_mutex_unlock(&standby->lock);
+  unsigned int delay_ms = STANDBY_RETRY_MIN_MS;
+  struct ws_client_t *client = NULL;
+  while (true) {
+    client = standby_open(standby, endpoint);
+    pthread_mutex_lock(&standby->lock);
+    if (client != NULL || standby->stopping) {
+      break;
+    }
+    // back off without holding up ws_standby_destroy.
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += delay_ms / 1000;
+    until.tv_nsec += (long)(delay_ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+      until.tv_sec += 1;
+      until.tv_nsec -= 1000000000;
+    }
+    while (!standby->stopping &&
+           pthread_cond_timedwait(&standby->cond, &standby->lock, &until) !=
+               ETIMEDOUT) {
+    }
+    const bool stopping = standby->stopping;
+    pthread_mutex_unlock(&standby->lock);
+    if (stopping) {
+      return NULL;
+    }
+    delay_ms = delay_ms * 2 > STANDBY_RETRY_MAX_MS ? STANDBY_RETRY_MAX_MS
+                                                   : delay_ms * 2;
+  }
+  if (standby->stopping) {
+    pthread_mutex_unlock(&standby->lock);
+    standby_client_free(client);
+    return NULL;
+  }
+  standby->fresh = client;
+  standby->connecting = false;
+  pthread_mutex_unlock(&standby->lock);
+  const uint8_t byte = 1;
+  (void)write(standby->wake_fds[1], &byte, sizeof(byte));
+  return NULL;
+}
+
+/**
+ * Start connecting a new connection in the background unless one is
+ * already on its way.
+ */
+static void standby_start_connect(struct ws_standby_t *standby,
+                                  size_t endpoint) {
+  pthread_mutex_lock(&standby->lock);
+  if (standby->connecting || standby->fresh != NULL) {
+    pthread_mutex_unlock(&standby->lock);
+    return;
+  }
+  pthread_mutex_unlock(&standby->lock);
+  // the previous thread already handed over its connection.
+  if (standby->thread_started) {
+    pthread_join(standby->thread, NULL);
+    standby->thread_started = false;
+  }
+  pthread_mutex_lock(&standby->lock);
+  standby->connecting = true;
+  standby->fresh_endpoint = endpoint;
+  pthread_mutex_unlock(&standby->lock);
+  if (pthread_create(&standby->thread, NULL, standby_connect_main, standby) !=
+      0) {
+    fprintf(stderr, "failed to start the standby connect thread.\n");
+    pthread_mutex_lock(&standby->lock);
+    standby->connecting = false;
+    pthread_mutex_unlock(&standby->lock);
+    return;
+  }
+  standby->thread_started = true;
+}
+
+/**
+ * The endpoint the next standby should use, the one the active connection
+ * isn't on when there are two.
+ */
+static size_t standby_next_endpoint(struct ws_standby_t *standby) {
+  return standby->active.client != NULL
+             ? (standby->active.endpoint + 1) % standby->url_len
+             : 0;
+}
+
+static bool standby_adopt(struct ws_standby_conn_t *conn,
+                          struct ws_client_t *client, size_t endpoint) {
+  if (!ws_client_set_nonblocking(client, true)) {
+    standby_client_free(client);
+    return false;
+  }
+  const int64_t now = standby_now_ms();
+  conn->client = client;
+  conn->endpoint = endpoint;
+  conn->last_rx_ms = now;
+  conn->last_ping_ms = now;
+  return true;
+}
+
+/**
+ * Make the connection active and tell the user.
+ */
+static void standby_promote(struct ws_standby_t *standby,
+                            struct ws_standby_conn_t *conn) {
+  standby->active = *conn;
+  memset(conn, 0, sizeof(struct ws_standby_conn_t));
+  if (standby->promote_cb != NULL) {
+    standby->promote_cb(standby->active.client, standby->context);
+  }
+}
+
+/**
+ * Take the connection made in the background, if any.
+ * It becomes the active connection when there is none, the standby
+ * otherwise.
+ */
+static void standby_collect(struct ws_standby_t *standby) {
+  uint8_t buf[16];
+  while (read(standby->wake_fds[0], buf, sizeof(buf)) > 0) {
+  }
+  pthread_mutex_lock(&standby->lock);
+  struct ws_client_t *client = standby->fresh;
+  const size_t endpoint = standby->fresh_endpoint;
+  standby->fresh = NULL;
+  pthread_mutex_unlock(&standby->lock);
+  if (client == NULL) {
+    return;
+  }
+  struct ws_standby_conn_t conn;
+  memset(&conn, 0, sizeof(conn));
+  if (!standby_adopt(&conn, client, endpoint)) {
+    standby_start_connect(standby, endpoint);
+    return;
+  }
+  if (standby->active.client == NULL) {
+    standby_promote(standby, &conn);
+    // still need a standby behind it.
+    standby_start_connect(standby, standby_next_endpoint(standby));
+  } else {
+    standby->standby = conn;
+  }
+}
+
+/**
+ * Close the active connection and promote the standby.
+ *
+ * @return True if a standby took over, false otherwise.
+ */
+static bool standby_failover(struct ws_standby_t *standby) {
+  standby_client_free(standby->active.client);
+  memset(&standby->active, 0, sizeof(struct ws_standby_conn_t));
+  const bool promoted = standby->standby.client != NULL;
+  if (promoted) {
+    standby_promote(standby, &standby->standby);
+    ++standby->failovers;
+  }
+  standby_start_connect(standby, standby_next_endpoint(standby));
+  return promoted;
+}
+
+static bool standby_discard(struct ws_client_t *client,
+                            struct ws_message_t *msg, void *context) {
+  (void)client;
+  (void)msg;
+  (void)context;
+  return true;
+}
+
+/**
+ * Handle the poll events of a connection.
+ * Only received bytes count as a sign of life, a connection that is just
+ * writable gets its pending writes flushed without a read.
+ */
+static enum ws_client_status_t standby_handle(struct ws_standby_conn_t *conn,
+                                              short revents,
+                                              on_message_callback *cb,
+                                              void *context, int64_t now) {
+  if (revents == 0) {
+    return WS_CLIENT_OK;
+  }
+  if (revents == POLLOUT) {
+    return ws_client_flush(conn->client) ? WS_CLIENT_OK : WS_CLIENT_ERROR;
+  }
+  const uint64_t rx_bytes = ws_client_rx_bytes(conn->client);
+  const enum ws_client_status_t status =
+      ws_client_process(conn->client, cb, context);
+  if (ws_client_rx_bytes(conn->client) != rx_bytes) {
+    conn->last_rx_ms = now;
+  }
+  return status;
+}
+
+/**
+ * Ping the connection when it has been idle for the ping interval.
+ *
+ * @return False if the connection should be treated as failed.
+ */
+static bool standby_keepalive(struct ws_standby_t *standby,
+                              struct ws_standby_conn_t *conn, int64_t now) {
+  if (standby->opts.dead_after_ms > 0 &&
+      now - conn->last_rx_ms >= standby->opts.dead_after_ms) {
+    return false;
+  }
+  if (now - conn->last_rx_ms < standby->opts.ping_interval_ms ||
+      now - conn->last_ping_ms < standby->opts.ping_interval_ms) {
+    return true;
+  }
+  conn->last_ping_ms = now;
+  byte_array body;
+  memset(&body, 0, sizeof(byte_array));
+  return ws_client_write(conn->client, OPCODE_PING, body);
+}
+
+/**
+ * Time until the next ping or dead check is due for the connection.
+ */
+static int64_t standby_next_due(struct ws_standby_t *standby,
+                                const struct ws_standby_conn_t *conn,
+                                int64_t now) {
+  if (conn->client == NULL) {
+    return INT64_MAX;
+  }
+  const int64_t last =
+      conn->last_ping_ms > conn->last_rx_ms ? conn->last_ping_ms
+                                            : conn->last_rx_ms;
+  int64_t due = last + standby->opts.ping_interval_ms - now;
+  if (standby->opts.dead_after_ms > 0) {
+    const int64_t dead = conn->last_rx_ms + standby->opts.dead_after_ms - now;
+    due = dead < due ? dead : due;
+  }
+  return due > 0 ? due : 0;
+}
+
+void ws_standby_options_init(struct ws_standby_options_t *opts) {
+  opts->ping_interval_ms = WS_STANDBY_PING_INTERVAL_MS;
+  opts->dead_after_ms = WS_STANDBY_DEAD_AFTER_MS;
+  net_options_init(&opts->net_options);
+  opts->net_options.connect_timeout_ms = WS_STANDBY_CONNECT_TIMEOUT_MS;
+}
+
+struct ws_standby_t *ws_standby_create(const char *url, const char *standby_url,
+                                       const struct ws_standby_options_t *opts,
+                                       on_message_callback cb,
+                                       on_promote_callback promote_cb,
+                                       void *context) {
+  struct ws_standby_t *result = calloc(1, sizeof(struct ws_standby_t));
+  if (result == NULL) {
+    return NULL;
+  }
+  if (pipe(result->wake_fds) == -1) {
+    free(result);
+    return NULL;
+  }
+  (void)fcntl(result->wake_fds[0], F_SETFL, O_NONBLOCK);
+  (void)fcntl(result->wake_fds[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&result->lock, NULL);
+  pthread_cond_init(&result->cond, NULL);
+  if (opts != NULL) {
+    result->opts = *opts;
+  } else {
+    ws_standby_options_init(&result->opts);
+  }
+  result->urls[0] = str_dup(url, strlen(url));
+  result->url_len = 1;
+  if (standby_url != NULL) {
+    result->urls[1] = str_dup(standby_url, strlen(standby_url));
+    result->url_len = 2;
+  }
+  result->cb = cb;
+  result->promote_cb = promote_cb;
+  result->context = context;
+  if (result->urls[0] == NULL ||
+      (standby_url != NULL && result->urls[1] == NULL)) {
+    ws_standby_destroy(&result);
+    return NULL;
+  }
+  return result;
+}
+
+bool ws_standby_connect(struct ws_standby_t *standby) {
+  if (standby->active.client != NULL) {
+    return true;
+  }
+  struct ws_client_t *client = standby_open(standby, 0);
+  if (client == NULL) {
+    return false;
+  }
+  struct ws_standby_conn_t conn;
+  memset(&conn, 0, sizeof(conn));
+  if (!standby_adopt(&conn, client, 0)) {
+    return false;
+  }
+  standby_promote(standby, &conn);
+  standby_start_connect(standby, standby_next_endpoint(standby));
+  return true;
+}
+
+enum ws_client_status_t ws_standby_run_once(struct ws_standby_t *standby,
+                                            int timeout_ms) {
+  standby_collect(standby);
+  int64_t now = standby_now_ms();
+  const int64_t active_due = standby_next_due(standby, &standby->active, now);
+  const int64_t standby_due = standby_next_due(standby, &standby->standby, now);
+  const int64_t due = active_due < standby_due ? active_due : standby_due;
+  if (due != INT64_MAX && (timeout_ms < 0 || due < timeout_ms)) {
+    timeout_ms = (int)due;
+  }
+  struct pollfd fds[3];
+  memset(fds, 0, sizeof(fds));
+  fds[0].fd = standby->wake_fds[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = standby->active.client != NULL
+                  ? ws_client_get_fd(standby->active.client)
+                  : -1;
+  fds[1].events = POLLIN;
+  fds[2].fd = standby->standby.client != NULL
+                  ? ws_client_get_fd(standby->standby.client)
+                  : -1;
+  fds[2].events = POLLIN;
+  if (standby->active.client != NULL &&
+      ws_client_has_pending(standby->active.client)) {
+    fds[1].events |= POLLOUT;
+  }
+  if (standby->standby.client != NULL &&
+      ws_client_has_pending(standby->standby.client)) {
+    fds[2].events |= POLLOUT;
+  }
+  if (poll(fds, 3, timeout_ms) == -1 && errno != EINTR) {
+    return WS_CLIENT_ERROR;
+  }
+  now = standby_now_ms();
+
+  // the standby first so a failing active connection finds it up to date.
+  if (standby->standby.client != NULL) {
+    const bool alive = standby_handle(&standby->standby, fds[2].revents,
+                                      standby_discard, NULL,
+                                      now) == WS_CLIENT_OK;
+    if (!alive || !standby_keepalive(standby, &standby->standby, now)) {
+      standby_client_free(standby->standby.client);
+      const size_t endpoint = standby->standby.endpoint;
+      memset(&standby->standby, 0, sizeof(struct ws_standby_conn_t));
+      standby_start_connect(standby, endpoint);
+    }
+  }
+  if (standby->active.client != NULL) {
+    enum ws_client_status_t status =
+        standby_handle(&standby->active, fds[1].revents, standby->cb,
+                       standby->context, now);
+    if (status == WS_CLIENT_STOPPED) {
+      return status;
+    }
+    if (status == WS_CLIENT_OK &&
+        !standby_keepalive(standby, &standby->active, now)) {
+      status = WS_CLIENT_ERROR;
+    }
+    if (status != WS_CLIENT_OK && !standby_failover(standby)) {
+      return status;
+    }
+  }
+  if (fds[0].revents != 0) {
+    standby_collect(standby);
+  }
+  return WS_CLIENT_OK;
+}
+
+struct ws_client_t *ws_standby_active(struct ws_standby_t *standby) {
+  return standby->active.client;
+}
+
+bool ws_standby_ready(struct ws_standby_t *standby) {
+  return standby->standby.client != NULL;
+}
+
+unsigned int ws_standby_failovers(struct ws_standby_t *standby) {
+  return standby->failovers;
+}
+
+void ws_standby_destroy(struct ws_standby_t **standby) {
+  if (standby == NULL || *standby == NULL) {
+    return;
+  }
+  struct ws_standby_t *s = *standby;
+  pthread_mutex_lock(&s->lock);
+  s->stopping = true;
+  pthread_cond_signal(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  // a connect in progress finishes (bounded by its timeout) first.
+  if (s->thread_started) {
+    pthread_join(s->thread, NULL);
+  }
+  standby_client_free(s->fresh);
+  standby_client_free(s->active.client);
+  standby_client_free(s->standby.client);
+  close(s->wake_fds[0]);
+  close(s->wake_fds[1]);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->cond);
+  free(s->urls[0]);
+  free(s->urls[1]);
+  free(s);
+  *standby = NULL;
+}
@@ -0,0 +1,395 @@
+#include "headers/tls.h"
+#include "headers/net.h"
+
+#ifdef WEBC_USE_SSL
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct tls_engine_t {
+  SSL *ssl;
+  /**
+   * Ciphertext fed in, read by OpenSSL. Owned by ssl.
+   */
+  BIO *in;
+  /**
+   * Ciphertext written by OpenSSL, taken by the caller. Owned by ssl.
+   */
+  BIO *out;
+  /**
+   * Result of a failed read that came after decrypted data, returned by the
+   * next read.
+   */
+  ssize_t read_error;
+  bool has_read_error;
+};
+
+static struct tls_engine_t *tls_engine_create(struct net_tls_ctx_t *tls_ctx) {
+  struct tls_engine_t *result = calloc(1, sizeof(struct tls_engine_t));
+  if (result == NULL) {
+    return NULL;
+  }
+  result->ssl = SSL_new(net_tls_ctx_get(tls_ctx));
+  result->in = BIO_new(BIO_s_mem());
+  result->out = BIO_new(BIO_s_mem());
+  if (result->ssl == NULL || result->in == NULL || result->out == NULL) {
+    ERR_print_errors_fp(stderr);
+    BIO_free(result->in);
+    BIO_free(result->out);
+    SSL_free(result->ssl);
+    free(result);
+    return NULL;
+  }
+  // an empty input buffer means "wait for more" instead of end of file.
+  BIO_set_mem_eof_return(result->in, -1);
+  SSL_set_bio(result->ssl, result->in, result->out);
+  return result;
+}
+
+struct tls_engine_t *tls_engine_create_client(struct net_tls_ctx_t *tls_ctx,
+                                              const char *host) {
+  struct tls_engine_t *result = tls_engine_create(tls_ctx);
+  if (result == NULL) {
+    return NULL;
+  }
+  SSL_set_connect_state(result->ssl);
+  // optional feature so we don't flag as an error.
+  if (host != NULL && !SSL_set_tlsext_host_name(result->ssl, host)) {
+    fprintf(stderr, "SSL set host name failed.\n");
+  }
+  return result;
+}
+
+struct tls_engine_t *tls_engine_create_server(struct net_tls_ctx_t *tls_ctx) {
+  struct tls_engine_t *result = tls_engine_create(tls_ctx);
+  if (result == NULL) {
+    return NULL;
+  }
+  SSL_set_accept_state(result->ssl);
+  return result;
+}
+
+/**
+ * Translate the result of an SSL call on memory BIOs.
+ */
+static ssize_t tls_engine_result(struct tls_engine_t *engine, int ret) {
+  const int err = SSL_get_error(engine->ssl, ret);
+  if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_ZERO_RETURN) {
+    // nothing failed, don't leave anything for the next SSL_get_error.
+    ERR_clear_error();
+    return err == SSL_ERROR_WANT_READ ? NET_WOULD_BLOCK : 0;
+  }
+  ERR_print_errors_fp(stderr);
+  return -1;
+}
+
+bool tls_engine_feed(struct tls_engine_t *engine, const uint8_t *buf,
+                     size_t len) {
+  size_t written = 0;
+  return len == 0 || (BIO_write_ex(engine->in, buf, len, &written) == 1 &&
+                      written == len);
+}
+
+int tls_engine_handshake(struct tls_engine_t *engine) {
+  const int ret = SSL_do_handshake(engine->ssl);
+  if (ret == 1) {
+    return 1;
+  }
+  const ssize_t result = tls_engine_result(engine, ret);
+  return result == NET_WOULD_BLOCK ? NET_WOULD_BLOCK : -1;
+}
+
+bool tls_engine_is_ready(struct tls_engine_t *engine) {
+  return SSL_is_init_finished(engine->ssl) == 1;
+}
+
+ssize_t tls_engine_read(struct tls_engine_t *engine, void *buf,
+                        size_t buf_len) {
+  if (engine->has_read_error) {
+    engine->has_read_error = false;
+    return engine->read_error;
+  }
+  size_t total = 0;
+  // drain every record that is already buffered in one call.
+  while (total < buf_len) {
+    size_t n = 0;
+    const int ret =
+        SSL_read_ex(engine->ssl, (uint8_t *)buf + total, buf_len - total, &n);
+    if (ret != 1) {
+      const ssize_t result = tls_engine_result(engine, ret);
+      if (total == 0) {
+        return result;
+      }
+      // return the data first, a close_notify or an alert comes next.
+      if (result != NET_WOULD_BLOCK) {
+        engine->read_error = result;
+        engine->has_read_error = true;
+      }
+      break;
+    }
+    total += n;
+  }
+  return total;
+}
+
+ssize_t tls_engine_peek(struct tls_engine_t *engine, void *buf,
+                        size_t buf_len) {
+  if (engine->has_read_error) {
+    return engine->read_error;
+  }
+  size_t n = 0;
+  const int ret = SSL_peek_ex(engine->ssl, buf, buf_len, &n);
+  if (ret != 1) {
+    return tls_engine_result(engine, ret);
+  }
+  return n;
+}
+
+ssize_t tls_engine_write(struct tls_engine_t *engine, const void *buf,
+                         size_t buf_len) {
+  size_t written = 0;
+  // the output buffer grows as needed so the whole buffer is consumed once
+  // the handshake is done.
+  const int ret = SSL_write_ex(engine->ssl, buf, buf_len, &written);
+  if (ret != 1) {
+    return tls_engine_result(engine, ret);
+  }
+  return written;
+}
+
+size_t tls_engine_pending(struct tls_engine_t *engine) {
+  return BIO_ctrl_pending(engine->out);
+}
+
+size_t tls_engine_take(struct tls_engine_t *engine, uint8_t *buf,
+                       size_t buf_len) {
+  size_t n = 0;
+  if (buf_len == 0 || BIO_read_ex(engine->out, buf, buf_len, &n) != 1) {
+    return 0;
+  }
+  return n;
+}
+
+void tls_engine_shutdown(struct tls_engine_t *engine) {
+  (void)SSL_shutdown(engine->ssl);
+}
+
+void tls_engine_destroy(struct tls_engine_t **engine) {
+  if (engine == NULL || *engine == NULL) {
+    return;
+  }
+  // frees both BIOs as well.
+  SSL_free((*engine)->ssl);
+  free(*engine);
+  *engine = NULL;
+}
+
+/**
+ * State of a connection wrapped by tls_engine_wrap.
+ */
+struct tls_wrap_t {
+  struct tls_engine_t *engine;
+  /**
+   * The wrapped connection, carries the ciphertext.
+   */
+  struct net_info_t inner;
+  /**
+   * Ciphertext taken from the engine and not written to inner yet.
+   */
+  uint8_t *out;
+  size_t out_off;
+  size_t out_len;
+  size_t out_cap;
+  /**
+   * Plaintext consumed by a write whose records would block, returned by
+   * the retry once they are sent.
+   */
+  size_t write_done;
+};
+
+/**
+ * Send the engine's pending records, all of them in one write when the
+ * wrapped transport takes it.
+ *
+ * @return 1 once everything is sent, NET_WOULD_BLOCK, -1 on failure.
+ */
+static ssize_t tls_wrap_flush(struct tls_wrap_t *wrap) {
+  for (;;) {
+    if (wrap->out_off == wrap->out_len) {
+      const size_t pending = tls_engine_pending(wrap->engine);
+      if (pending == 0) {
+        return 1;
+      }
+      if (pending > wrap->out_cap) {
+        uint8_t *out = realloc(wrap->out, pending);
+        if (out == NULL) {
+          return -1;
+        }
+        wrap->out = out;
+        wrap->out_cap = pending;
+      }
+      wrap->out_len = tls_engine_take(wrap->engine, wrap->out, pending);
+      wrap->out_off = 0;
+    }
+    const ssize_t n = net_write(&wrap->inner, &wrap->out[wrap->out_off],
+                                wrap->out_len - wrap->out_off);
+    if (n <= 0) {
+      return n == NET_WOULD_BLOCK ? NET_WOULD_BLOCK : -1;
+    }
+    wrap->out_off += n;
+  }
+}
+
+/**
+ * Read the next ciphertext from the wrapped transport into the engine.
+ *
+ * @return The number of bytes fed, 0 if the wrapped connection closed,
+ *  NET_WOULD_BLOCK, -1 on failure.
+ */
+static ssize_t tls_wrap_fill(struct net_info_t *info, struct tls_wrap_t *wrap) {
+  uint8_t buf[SSL3_RT_MAX_PACKET_SIZE];
+  const ssize_t n = net_read(&wrap->inner, buf, sizeof(buf));
+  if (n <= 0) {
+    return n;
+  }
+  info->rx_time = wrap->inner.rx_time;
+  return tls_engine_feed(wrap->engine, buf, n) ? n : -1;
+}
+
+/**
+ * Drive the handshake until it is done or the wrapped transport would
+ * block.
+ *
+ * @return 1 once the handshake is done, NET_WOULD_BLOCK, -1 on failure.
+ */
+static ssize_t tls_wrap_handshake(struct net_info_t *info,
+                                  struct tls_wrap_t *wrap) {
+  while (!tls_engine_is_ready(wrap->engine)) {
+    const int ret = tls_engine_handshake(wrap->engine);
+    // records that would block go out with the next flush.
+    if (ret == -1 || tls_wrap_flush(wrap) == -1) {
+      return -1;
+    }
+    if (ret == 1) {
+      break;
+    }
+    const ssize_t n = tls_wrap_fill(info, wrap);
+    if (n <= 0) {
+      if (n == 0) {
+        fprintf(stderr, "TLS connection closed during the handshake.\n");
+      }
+      return n == NET_WOULD_BLOCK ? NET_WOULD_BLOCK : -1;
+    }
+  }
+  return 1;
+}
+
+static ssize_t tls_wrap_recv(struct net_info_t *info, void *buf,
+                             size_t buf_len, bool consume) {
+  struct tls_wrap_t *wrap = info->transport_data;
+  const ssize_t ready = tls_wrap_handshake(info, wrap);
+  if (ready != 1) {
+    return ready;
+  }
+  for (;;) {
+    const ssize_t n = consume ? tls_engine_read(wrap->engine, buf, buf_len)
+                              : tls_engine_peek(wrap->engine, buf, buf_len);
+    if (n != NET_WOULD_BLOCK) {
+      return n;
+    }
+    // records may answer what was read, e.g. a KeyUpdate.
+    if (tls_wrap_flush(wrap) == -1) {
+      return -1;
+    }
+    const ssize_t fed = tls_wrap_fill(info, wrap);
+    if (fed <= 0) {
+      return fed;
+    }
+  }
+}
+
+static ssize_t tls_wrap_peek(struct net_info_t *info, void *buf,
+                             size_t buf_len) {
+  return tls_wrap_recv(info, buf, buf_len, false);
+}
+
+static ssize_t tls_wrap_read(struct net_info_t *info, void *buf,
+                             size_t buf_len) {
+  return tls_wrap_recv(info, buf, buf_len, true);
+}
+
+static ssize_t tls_wrap_write(struct net_info_t *info, const void *buf,
+                              size_t buf_len) {
+  struct tls_wrap_t *wrap = info->transport_data;
+  const ssize_t ready = tls_wrap_handshake(info, wrap);
+  if (ready != 1) {
+    return ready;
+  }
+  const ssize_t flushed = tls_wrap_flush(wrap);
+  if (flushed != 1) {
+    return flushed;
+  }
+  if (wrap->write_done > 0) {
+    // the retry of a write whose records are sent now.
+    const size_t n = wrap->write_done;
+    wrap->write_done = 0;
+    return n;
+  }
+  const ssize_t n = tls_engine_write(wrap->engine, buf, buf_len);
+  if (n <= 0) {
+    return n;
+  }
+  const ssize_t sent = tls_wrap_flush(wrap);
+  if (sent == NET_WOULD_BLOCK) {
+    wrap->write_done = n;
+  }
+  return sent == 1 ? n : sent;
+}
+
+static bool tls_wrap_set_nonblocking(struct net_info_t *info, bool enable) {
+  struct tls_wrap_t *wrap = info->transport_data;
+  return net_set_nonblocking(&wrap->inner, enable);
+}
+
+static void tls_wrap_close(struct net_info_t *info) {
+  struct tls_wrap_t *wrap = info->transport_data;
+  if (wrap == NULL) {
+    return;
+  }
+  if (tls_engine_is_ready(wrap->engine)) {
+    tls_engine_shutdown(wrap->engine);
+    // best effort, the peer may be gone already.
+    (void)tls_wrap_flush(wrap);
+  }
+  tls_engine_destroy(&wrap->engine);
+  net_close(&wrap->inner);
+  free(wrap->out);
+  free(wrap);
+  info->transport_data = NULL;
+}
+
+const struct net_transport_t tls_engine_transport = {
+    .name = "tls-engine",
+    .peek = tls_wrap_peek,
+    .read = tls_wrap_read,
+    .write = tls_wrap_write,
+    .set_nonblocking = tls_wrap_set_nonblocking,
+    .close = tls_wrap_close,
+};
+
+bool tls_engine_wrap(struct net_info_t *info, struct tls_engine_t *engine) {
+  struct tls_wrap_t *wrap = calloc(1, sizeof(struct tls_wrap_t));
+  if (wrap == NULL) {
+    return false;
+  }
+  wrap->engine = engine;
+  wrap->inner = *info;
+  info->transport = &tls_engine_transport;
+  info->transport_data = wrap;
+  return true;
+}
+
+#endif
@@ -31,6 +31,9 @@ const char *lib_version() { return APP_HASH; }
 
 #define WS_PREFIX "ws://"
 #define WSS_PREFIX "wss://"
+#define WS_UNIX_PREFIX "ws+unix://"
+// Host header sent over Unix domain sockets.
+#define WS_UNIX_HOST "localhost"
 #define PORT_SEP ':'
 #define PATH_SEP '/'
 #define PROTOCOL "HTTP/1.1"
@@ -43,6 +46,16 @@ struct __ws_client_internal_t {
   // noonce is 16 byte random value for initial handshake
   uint8_t noonce[NOONCE_LEN];
   bool loop_flag;
+  // set when the socket is non-blocking and driven by an event loop.
+  bool nonblocking;
+  // set when writes only go to the pending buffer and the owner of the
+  // connection sends them, e.g. batched through io_uring.
+  bool defer_writes;
+  // encoded frames waiting to be written, e.g. queued before the handshake
+  // finished.
+  byte_array pending;
+  // bytes handed to the reader by ws_client_process[_bytes].
+  uint64_t rx_bytes;
 };
 
 #ifdef DEBUG
@@ -81,7 +94,131 @@ static bool ws_check_internals(struct ws_client_t *client) {
  */
 static bool ws_client_recv(struct ws_client_t *client, byte_array *out);
 
+/**
+ * Allocate the internal client data if it does not exist yet.
+ */
+static bool ws_client_ensure_internal(struct ws_client_t *client) {
+  if (client->__internal != NULL) {
+    return true;
+  }
+  struct __ws_client_internal_t *local =
+      malloc(sizeof(struct __ws_client_internal_t));
+  if (local == NULL) {
+    return false;
+  }
+  memset(local, 0, sizeof(struct __ws_client_internal_t));
+  local->info.socket = -1;
+  local->reader = ws_reader_create();
+  local->loop_flag = false;
+  client->__internal = local;
+  return true;
+}
+
+/**
+ * Close the connection and free the internal client data.
+ */
+static void ws_client_release_internal(struct ws_client_t *client) {
+  if (client->__internal == NULL) {
+    return;
+  }
+  struct __ws_client_internal_t *local = client->__internal;
+  client->__internal = NULL;
+
+  net_close(&local->info);
+  if (local->reader != NULL) {
+    ws_reader_destroy(&local->reader);
+  }
+  if (local->pending.byte_data != NULL) {
+    byte_array_free(&local->pending);
+  }
+  free(local);
+}
+
+/**
+ * Close a connection that failed during connect or the upgrade.
+ * Messages queued with ws_client_queue_msg stay in the pending buffer so a
+ * later ws_client_connect sends them.
+ */
+static void ws_client_fail_connect(struct ws_client_t *client) {
+  struct __ws_client_internal_t *local = client->__internal;
+  if (local == NULL) {
+    return;
+  }
+  net_close(&local->info);
+  memset(&local->info, 0, sizeof(struct net_info_t));
+  local->info.socket = -1;
+  // drop anything received from the failed connection.
+  if (local->reader != NULL) {
+    ws_reader_destroy(&local->reader);
+  }
+  local->reader = ws_reader_create();
+  if (local->reader == NULL) {
+    ws_client_release_internal(client);
+  }
+}
+
+/**
+ * Encode a client frame and append it to the given buffer.
+ */
+static bool ws_client_encode(enum ws_opcode_t type, byte_array *body,
+                             byte_array *out) {
+  // client is required to use a mask
+  uint8_t masking_key[4];
+  (void)populate_rand(masking_key, 4);
+  // TODO when we support fragmenting messages, make fin conditional
+  const uint8_t codes = WS_FRAME_FIN | (type & WS_FRAME_OPCODE_MASK);
+  return ws_frame_append(out, codes, true, masking_key, body->byte_data,
+                         body->len) == WS_FRAME_SUCCESS;
+}
+
+/**
+ * Append bytes to the end of the byte array, growing it as needed.
+ */
+static bool append_bytes(byte_array *arr, const uint8_t *buf, size_t len) {
+  if (arr->cap < arr->len + len) {
+    size_t new_cap = arr->cap > 0 ? arr->cap : BUFSIZ;
+    while (new_cap < arr->len + len) {
+      new_cap *= 2;
+    }
+    uint8_t *data = realloc(arr->byte_data, new_cap);
+    if (data == NULL) {
+      return false;
+    }
+    arr->byte_data = data;
+    arr->cap = new_cap;
+  }
+  memcpy(&arr->byte_data[arr->len], buf, len);
+  arr->len += len;
+  return true;
+}
+
+/**
+ * Find the length of the HTTP header block including the blank line.
+ *
+ * @return The header length, 0 if the block is not complete.
+ */
+static size_t http_header_len(const uint8_t *buf, size_t len) {
+  for (size_t i = 3; i < len; ++i) {
+    if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' &&
+        buf[i - 3] == '\r') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
 static bool ws_client_write_blob(struct ws_client_t *client, byte_array *msg) {
+  if (client->__internal->nonblocking || client->__internal->defer_writes) {
+    // keep the message ordered behind anything still waiting to be written.
+    if (!append_bytes(&client->__internal->pending, msg->byte_data,
+                      msg->len)) {
+      return false;
+    }
+    if (client->__internal->defer_writes) {
+      return true;
+    }
+    return ws_client_flush(client);
+  }
   ssize_t n = net_write(&client->__internal->info, msg->byte_data, msg->len);
   if (n == -1) {
     fprintf(stderr, "WebSocket client send failure.\n");
@@ -101,10 +238,9 @@ static bool set_handshake_headers(struct http_request_t *req,
     return false;
   }
   populate_rand(client->__internal->noonce, NOONCE_LEN);
-  size_t noonce_len = 0;
-  char AUTO_C *noonce =
-      base64_encode(client->__internal->noonce, NOONCE_LEN, &noonce_len);
-  if (noonce == NULL || noonce_len == 0) {
+  char noonce[BASE64_ENCODE_LEN(NOONCE_LEN) + 1];
+  if (base64_encode_buf(client->__internal->noonce, NOONCE_LEN, noonce,
+                        sizeof(noonce)) == 0) {
     fprintf(stderr, "Noonce could not be created.\n");
     return false;
   }
@@ -158,8 +294,10 @@ static char *initial_handshake(struct ws_client_t *client) {
 bool ws_client_init(struct ws_client_t *client) {
   client->host = NULL;
   client->path = NULL;
+  client->unix_path = NULL;
   client->port = 80;
   client->version = 13;
+  net_options_init(&client->net_options);
   client->__internal = NULL;
 #ifdef WEBC_USE_SSL
   client->use_tls = false;
@@ -167,6 +305,32 @@ bool ws_client_init(struct ws_client_t *client) {
   return true;
 }
 
+/**
+ * Parse the part of a ws+unix URL after the scheme: the socket path,
+ * optionally followed by ':' and the request path.
+ */
+static bool ws_client_from_unix_str(const char *rest, size_t len,
+                                    struct ws_client_t *client) {
+  size_t path_start = len;
+  for (size_t i = 0; i + 1 < len; ++i) {
+    if (rest[i] == PORT_SEP && rest[i + 1] == PATH_SEP) {
+      path_start = i;
+      break;
+    }
+  }
+  if (path_start == 0) {
+    fprintf(stderr, "URL is missing the Unix socket path.\n");
+    return false;
+  }
+  client->unix_path = str_dup(rest, path_start);
+  client->host = str_dup(WS_UNIX_HOST, strlen(WS_UNIX_HOST));
+  if (path_start < len) {
+    // skip the ':' separator.
+    client->path = str_dup(&rest[path_start + 1], len - path_start - 1);
+  }
+  return client->unix_path != NULL && client->host != NULL;
+}
+
 /**
  * Create WebSocket client from the given URL.
  *
@@ -179,11 +343,20 @@ bool ws_client_from_str(const char *url, size_t len,
                         struct ws_client_t *client) {
   client->host = NULL;
   client->path = NULL;
+  client->unix_path = NULL;
   client->port = 80;
   client->version = 13;
+  net_options_init(&client->net_options);
+  client->__internal = NULL;
 #ifdef WEBC_USE_SSL
   client->use_tls = false;
 #endif
+  const size_t unix_prefix_len = strlen(WS_UNIX_PREFIX);
+  if (len > unix_prefix_len &&
+      strncmp(WS_UNIX_PREFIX, url, unix_prefix_len) == 0) {
+    return ws_client_from_unix_str(&url[unix_prefix_len],
+                                   len - unix_prefix_len, client);
+  }
   const size_t ws_prefix_len = strlen(WS_PREFIX);
   if (len <= ws_prefix_len) {
     fprintf(stderr, "URL len was the same size or shorter than the expected "
@@ -252,20 +425,39 @@ bool ws_client_connect(struct ws_client_t *client) {
   }
   struct net_info_t result;
   memset(&result, 0, sizeof(result));
-  char AUTO_C *port_str = to_str(client->port);
-  if (!net_connect(client->host, port_str, &result)) {
-    fprintf(stderr, "WebSocket client could not connect.");
+  if (client->unix_path != NULL) {
+    if (!net_connect_unix(client->unix_path, &client->net_options, &result)) {
+      fprintf(stderr, "WebSocket client could not connect.");
+      return false;
+    }
+  } else {
+    char AUTO_C *port_str = to_str(client->port);
+    if (!net_connect_with(client->host, port_str, &client->net_options,
+                          &result)) {
+      fprintf(stderr, "WebSocket client could not connect.");
+      return false;
+    }
+  }
+  return ws_client_upgrade(client, &result);
+}
+
+bool ws_client_upgrade(struct ws_client_t *client, struct net_info_t *info) {
+  if (client->host == NULL) {
+    fprintf(stderr, "WebSocket client's host was null.\n");
+    net_close(info);
     return false;
   }
-  client->__internal = malloc(sizeof(struct __ws_client_internal_t));
-  client->__internal->info = result;
-  client->__internal->reader = ws_reader_create();
-  client->__internal->loop_flag = false;
+  // internals may already exist from messages queued before connecting.
+  if (!ws_client_ensure_internal(client)) {
+    fprintf(stderr, "WebSocket client failed to allocate internals.\n");
+    net_close(info);
+    return false;
+  }
+  client->__internal->info = *info;
   char AUTO_C *req = initial_handshake(client);
   if (req == NULL) {
     fprintf(stderr, "WebSocket client failed to create handshake.\n");
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
 #ifdef DEBUG
@@ -274,15 +466,15 @@ bool ws_client_connect(struct ws_client_t *client) {
   ssize_t n = net_write(&client->__internal->info, req, strlen(req));
   if (n == -1) {
     fprintf(stderr, "message wasn't sent\n");
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
   byte_array DEFER(byte_array_free) response;
+  // freed on every return, including when the receive fails.
+  memset(&response, 0, sizeof(byte_array));
   if (!ws_client_recv(client, &response)) {
     fprintf(stderr, "WebSocket client failed to connect.\n");
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
 #ifdef DEBUG
@@ -291,31 +483,33 @@ bool ws_client_connect(struct ws_client_t *client) {
   struct http_response_t DEFER(http_response_free) resp;
   if (!http_response_init(&resp)) {
     fprintf(stderr, "failed to initialize HTTP response structure.\n");
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
-  char AUTO_C *resp_cstr = malloc((sizeof(char) * response.len) + 1);
-  memcpy(resp_cstr, response.byte_data, response.len);
-  resp_cstr[response.len] = '\0';
-  if (!http_response_from_str(&resp, resp_cstr, response.len)) {
+  // the server may send frames right behind the upgrade response, only the
+  // header block belongs to the HTTP parser.
+  size_t header_len = http_header_len(response.byte_data, response.len);
+  if (header_len == 0) {
+    header_len = response.len;
+  }
+  char AUTO_C *resp_cstr = malloc((sizeof(char) * header_len) + 1);
+  memcpy(resp_cstr, response.byte_data, header_len);
+  resp_cstr[header_len] = '\0';
+  if (!http_response_from_str(&resp, resp_cstr, header_len)) {
     fprintf(stderr, "failed to parse HTTP response message.\n");
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
   if (resp.message.status_code >= 300) {
     fprintf(stderr, "WebSocket Client connection failed with code: %d\n",
             resp.message.status_code);
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
   char *recv_noonce = NULL;
   if (!http_response_get_header(&resp, "sec-websocket-accept", &recv_noonce)) {
     fprintf(stderr, "failed to get HTTP response header value.\n");
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
     return false;
   }
   if (recv_noonce == NULL ||
@@ -323,8 +517,26 @@ bool ws_client_connect(struct ws_client_t *client) {
                              recv_noonce, strlen(recv_noonce))) {
     fprintf(stderr, "WebSocket Client connection was rejected.\n%s\n",
             resp.message.status_text);
-    net_close(&client->__internal->info);
-    free(client->__internal);
+    ws_client_fail_connect(client);
+    return false;
+  }
+  if (!ws_reader_feed(client->__internal->reader,
+                      &response.byte_data[header_len],
+                      response.len - header_len)) {
+    fprintf(stderr, "WebSocket client failed to read initial frames.\n");
+    ws_client_fail_connect(client);
+    return false;
+  }
+  // send everything queued during the handshake in one write.
+  const size_t queued = client->__internal->pending.len;
+  if (!ws_client_flush(client)) {
+    fprintf(stderr, "WebSocket client failed to send queued messages.\n");
+    // a partly sent frame can't be resent on a new connection.
+    if (client->__internal->pending.len == queued) {
+      ws_client_fail_connect(client);
+    } else {
+      ws_client_release_internal(client);
+    }
     return false;
   }
   return true;
@@ -362,6 +574,11 @@ bool ws_client_next_msg(struct ws_client_t *client, struct ws_message_t **out) {
   if (!is_valid) {
     return false;
   }
+  // messages may already be parsed from a previous read.
+  *out = ws_reader_next_msg(client->__internal->reader);
+  if (*out != NULL) {
+    return true;
+  }
   if (!ws_reader_handle(client->__internal->reader,
                         &client->__internal->info)) {
     return false;
@@ -382,6 +599,38 @@ static void free_ws_message(struct ws_message_t **msg) {
   *msg = NULL;
 }
 
+/**
+ * Handle a message the way every listener does: answer pings, stop on close
+ * and hand data messages to the callback.
+ */
+static enum ws_client_status_t ws_client_dispatch(struct ws_client_t *client,
+                                                  struct ws_message_t *msg,
+                                                  on_message_callback cb,
+                                                  void *context) {
+  switch (msg->type) {
+  case OPCODE_CLOSE:
+    return WS_CLIENT_CLOSED;
+  case OPCODE_PING: {
+    if (!ws_client_write(client, OPCODE_PONG, msg->body)) {
+      fprintf(stderr, "writing pong failed.\n");
+      return WS_CLIENT_ERROR;
+    }
+    break;
+  }
+  case OPCODE_BIN:
+    /* fall through */
+  case OPCODE_TEXT: {
+    if (!cb(client, msg, context)) {
+      return WS_CLIENT_STOPPED;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  return WS_CLIENT_OK;
+}
+
 bool ws_client_on_msg(struct ws_client_t *client, on_message_callback cb,
                       void *context) {
   if (client->__internal == NULL) {
@@ -407,30 +656,12 @@ bool ws_client_on_msg(struct ws_client_t *client, on_message_callback cb,
       running = false;
       break;
     }
-    switch (msg->type) {
-    case OPCODE_CLOSE: {
-      running = false;
+    const enum ws_client_status_t status =
+        ws_client_dispatch(client, msg, cb, context);
+    if (status == WS_CLIENT_CLOSED) {
       close_sock = true;
-      break;
-    }
-    case OPCODE_PING: {
-      if (!ws_client_write(client, OPCODE_PONG, msg->body)) {
-        fprintf(stderr, "writing pong failed.\n");
-        running = false;
-      }
-      break;
-    }
-    case OPCODE_BIN:
-      /* fall through */
-    case OPCODE_TEXT: {
-      if (!cb(client, msg, context)) {
-        running = false;
-      }
-      break;
-    }
-    default:
-      break;
     }
+    running = status == WS_CLIENT_OK;
     // if we didn't set the running flag to false check if the loop flag was set
     if (running) {
       running = client->__internal->loop_flag;
@@ -442,41 +673,177 @@ bool ws_client_on_msg(struct ws_client_t *client, on_message_callback cb,
   return true;
 }
 
-bool ws_client_write(struct ws_client_t *client, enum ws_opcode_t type,
-                     byte_array body) {
-  struct ws_frame_t DEFER(ws_frame_free) frame;
-  // always returns true
-  (void)ws_frame_init(&frame);
-  frame.codes.flags.opcode = type;
-  // TODO when we support fragmenting messages, make this conditional
-  frame.codes.flags.fin = 1;
-  // client is required to use a mask
-  frame.info.flags.mask = 1;
-  // always true
-  (void)populate_rand(frame.masking_key, 4);
-  if (body.len > 0) {
-    if (!byte_array_init(&frame.payload, body.len)) {
-      return false;
+int ws_client_get_fd(struct ws_client_t *client) {
+  if (client->__internal == NULL) {
+    return -1;
+  }
+  return client->__internal->info.socket;
+}
+
+bool ws_client_set_nonblocking(struct ws_client_t *client, bool enable) {
+  if (client->__internal == NULL) {
+    return false;
+  }
+  if (!net_set_nonblocking(&client->__internal->info, enable)) {
+    return false;
+  }
+  client->__internal->nonblocking = enable;
+  return true;
+}
+
+bool ws_client_defer_writes(struct ws_client_t *client, bool enable) {
+  if (client->__internal == NULL) {
+    return false;
+  }
+  client->__internal->defer_writes = enable;
+  return true;
+}
+
+bool ws_client_take_pending(struct ws_client_t *client, byte_array *out) {
+  if (client->__internal == NULL || client->__internal->pending.len == 0) {
+    return false;
+  }
+  *out = client->__internal->pending;
+  memset(&client->__internal->pending, 0, sizeof(byte_array));
+  return true;
+}
+
+bool ws_client_has_pending(struct ws_client_t *client) {
+  return client->__internal != NULL && client->__internal->pending.len > 0;
+}
+
+/**
+ * Dispatch every message the reader has already parsed.
+ */
+static enum ws_client_status_t
+ws_client_dispatch_queued(struct ws_client_t *client, on_message_callback cb,
+                          void *context) {
+  struct ws_reader_t *reader = client->__internal->reader;
+  while (true) {
+    struct ws_message_t DEFER(free_ws_message) *msg = ws_reader_next_msg(reader);
+    if (msg == NULL) {
+      return WS_CLIENT_OK;
     }
-    if (frame.payload.cap != body.len) {
-      // TODO send better error message
-      return false;
+    const enum ws_client_status_t status =
+        ws_client_dispatch(client, msg, cb, context);
+    if (status == WS_CLIENT_CLOSED) {
+      // echo the close frame before the caller tears the connection down.
+      (void)ws_client_write(client, OPCODE_CLOSE, msg->body);
     }
-    if (memcpy(frame.payload.byte_data, body.byte_data, frame.payload.cap) ==
-        NULL) {
-      return false;
+    if (status != WS_CLIENT_OK) {
+      return status;
+    }
+  }
+}
+
+enum ws_client_status_t ws_client_process(struct ws_client_t *client,
+                                          on_message_callback cb,
+                                          void *context) {
+  if (!ws_check_internals(client)) {
+    return WS_CLIENT_ERROR;
+  }
+  // finish writes that were cut short by a full socket buffer.
+  if (!ws_client_flush(client)) {
+    return WS_CLIENT_ERROR;
+  }
+  bool readable = true;
+  while (true) {
+    const enum ws_client_status_t status =
+        ws_client_dispatch_queued(client, cb, context);
+    if (status != WS_CLIENT_OK || !readable) {
+      return status;
+    }
+    const ssize_t n =
+        ws_reader_fill(client->__internal->reader, &client->__internal->info);
+    if (n == NET_WOULD_BLOCK) {
+      readable = false;
+    } else if (n == 0) {
+      return WS_CLIENT_CLOSED;
+    } else if (n < 0) {
+      return WS_CLIENT_ERROR;
+    } else {
+      client->__internal->rx_bytes += (uint64_t)n;
+    }
+    if (!client->__internal->nonblocking) {
+      // a blocking socket would stall on the next read, stop after one.
+      readable = false;
     }
-    frame.payload.len = frame.payload.cap;
   }
-  byte_array DEFER(byte_array_free) out;
+}
+
+enum ws_client_status_t ws_client_process_bytes(struct ws_client_t *client,
+                                                const uint8_t *buf, size_t len,
+                                                on_message_callback cb,
+                                                void *context) {
+  if (!ws_check_internals(client)) {
+    return WS_CLIENT_ERROR;
+  }
+  if (!ws_reader_feed(client->__internal->reader, buf, len)) {
+    return WS_CLIENT_ERROR;
+  }
+  client->__internal->rx_bytes += len;
+  if (len > 0) {
+    // the bytes came off the socket without net_read, e.g. from io_uring.
+    net_quick_ack(&client->__internal->info);
+  }
+  return ws_client_dispatch_queued(client, cb, context);
+}
+
+uint64_t ws_client_rx_bytes(struct ws_client_t *client) {
+  return client->__internal != NULL ? client->__internal->rx_bytes : 0;
+}
+
+bool ws_client_write(struct ws_client_t *client, enum ws_opcode_t type,
+                     byte_array body) {
+  byte_array out;
   memset(&out, 0, sizeof(byte_array));
-  enum ws_frame_error_t err = ws_frame_write(&frame, &out);
-  if (err != WS_FRAME_SUCCESS) {
+  if (!ws_client_encode(type, &body, &out)) {
+    if (out.byte_data != NULL) {
+      byte_array_free(&out);
+    }
+    return false;
+  }
+  const bool result = ws_client_write_blob(client, &out);
+  byte_array_free(&out);
+  return result;
+}
+
+bool ws_client_queue_msg(struct ws_client_t *client, enum ws_opcode_t type,
+                         byte_array body) {
+  if (!ws_client_ensure_internal(client)) {
     return false;
   }
-  if (!ws_client_write_blob(client, &out)) {
+  return ws_client_encode(type, &body, &client->__internal->pending);
+}
+
+bool ws_client_flush(struct ws_client_t *client) {
+  if (client->__internal == NULL) {
     return false;
   }
+  byte_array *pending = &client->__internal->pending;
+  size_t offset = 0;
+  while (offset < pending->len) {
+    const ssize_t n = net_write(&client->__internal->info,
+                                &pending->byte_data[offset],
+                                pending->len - offset);
+    if (n == NET_WOULD_BLOCK) {
+      // keep the rest for when the socket is writable again.
+      memmove(pending->byte_data, &pending->byte_data[offset],
+              pending->len - offset);
+      pending->len -= offset;
+      return true;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "WebSocket client send failure.\n");
+      // only keep what was not sent.
+      memmove(pending->byte_data, &pending->byte_data[offset],
+              pending->len - offset);
+      pending->len -= offset;
+      return false;
+    }
+    offset += n;
+  }
+  pending->len = 0;
   return true;
 }
 
@@ -521,14 +888,9 @@ void ws_client_free(struct ws_client_t *client) {
     free(client->path);
     client->path = NULL;
   }
-  if (client->__internal != NULL) {
-    struct __ws_client_internal_t *local = client->__internal;
-    client->__internal = NULL;
-
-    net_close(&local->info);
-    if (local->reader != NULL) {
-      ws_reader_destroy(&local->reader);
-    }
-    free(local);
+  if (client->unix_path != NULL) {
+    free(client->unix_path);
+    client->unix_path = NULL;
   }
+  ws_client_release_internal(client);
 }
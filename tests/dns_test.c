@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "headers/dns.h"
+#include "tests/test.h"
+
+#include <dlfcn.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define REQUESTS 200
+#define LOOKUP_THREADS 8
+
+static atomic_uint answered = 0;
+static atomic_uint dropped = 0;
+static atomic_uint lookups = 0;
+static atomic_bool slow_lookups = false;
+
+/**
+ * Count the resolver's getaddrinfo calls, optionally keeping each one in
+ * flight for a while.
+ */
+int getaddrinfo(const char *restrict node, const char *restrict service,
+                const struct addrinfo *restrict hints,
+                struct addrinfo **restrict res) {
+  typedef int(getaddrinfo_fn)(const char *restrict, const char *restrict,
+                              const struct addrinfo *restrict,
+                              struct addrinfo **restrict);
+  getaddrinfo_fn *next = (getaddrinfo_fn *)dlsym(RTLD_NEXT, "getaddrinfo");
+  atomic_fetch_add(&lookups, 1);
+  if (atomic_load(&slow_lookups)) {
+    usleep(100000);
+  }
+  return next(node, service, hints, res);
+}
+
+static void on_resolved(const struct dns_result_t *result, void *context) {
+  (void)context;
+  if (result == NULL) {
+    atomic_fetch_add(&dropped, 1);
+    return;
+  }
+  CHECK(result->len > 0);
+  atomic_fetch_add(&answered, 1);
+}
+
+static void test_cache_remove() {
+  struct dns_result_t result;
+  CHECK(dns_resolve("localhost", "80", &result));
+  CHECK(result.len > 0);
+  CHECK(dns_cache_lookup("localhost", "80", &result));
+  // other ports of the same host stay cached.
+  CHECK(dns_resolve("localhost", "81", &result));
+  dns_cache_remove("localhost", "80");
+  CHECK(!dns_cache_lookup("localhost", "80", &result));
+  CHECK(dns_cache_lookup("localhost", "81", &result));
+  dns_cache_clear();
+}
+
+static pthread_barrier_t lookup_barrier;
+
+static void *lookup_main(void *arg) {
+  bool *ok = arg;
+  struct dns_result_t result;
+  pthread_barrier_wait(&lookup_barrier);
+  *ok = dns_resolve("localhost", "80", &result) && result.len > 0;
+  return NULL;
+}
+
+static void test_concurrent_lookups() {
+  // no cache, every caller that misses the shared lookup would resolve.
+  dns_cache_set_ttl(0);
+  atomic_store(&lookups, 0);
+  atomic_store(&slow_lookups, true);
+  pthread_t threads[LOOKUP_THREADS];
+  bool ok[LOOKUP_THREADS];
+  pthread_barrier_init(&lookup_barrier, NULL, LOOKUP_THREADS);
+  for (int i = 0; i < LOOKUP_THREADS; ++i) {
+    ok[i] = false;
+    CHECK(pthread_create(&threads[i], NULL, lookup_main, &ok[i]) == 0);
+  }
+  for (int i = 0; i < LOOKUP_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+    CHECK(ok[i]);
+  }
+  pthread_barrier_destroy(&lookup_barrier);
+  CHECK(atomic_load(&lookups) == 1);
+  atomic_store(&slow_lookups, false);
+
+  // a finished lookup is not shared with later callers.
+  struct dns_result_t result;
+  CHECK(dns_resolve("localhost", "80", &result));
+  CHECK(atomic_load(&lookups) == 2);
+  dns_cache_set_ttl(DNS_CACHE_TTL_MS);
+}
+
+static void *submit_main(void *arg) {
+  unsigned int *queued = arg;
+  for (unsigned int i = 0; i < REQUESTS; ++i) {
+    if (dns_resolve_async("localhost", "80", on_resolved, NULL)) {
+      ++*queued;
+    }
+  }
+  return NULL;
+}
+
+static void test_shutdown_while_resolving() {
+  unsigned int queued = 0;
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, submit_main, &queued) == 0);
+  // shutdowns race the submitting thread, every request is either refused,
+  // answered or dropped with a NULL result.
+  for (int i = 0; i < 50; ++i) {
+    dns_shutdown();
+  }
+  pthread_join(thread, NULL);
+  dns_shutdown();
+  CHECK(atomic_load(&answered) + atomic_load(&dropped) == queued);
+
+  // the resolver starts again after a shutdown.
+  const unsigned int before = atomic_load(&answered);
+  CHECK(dns_resolve_async("localhost", "80", on_resolved, NULL));
+  for (int i = 0; i < 1000 && atomic_load(&answered) == before; ++i) {
+    usleep(1000);
+  }
+  CHECK(atomic_load(&answered) == before + 1);
+  dns_shutdown();
+}
+
+int main(void) {
+  test_cache_remove();
+  test_concurrent_lookups();
+  test_shutdown_while_resolving();
+  return TEST_RESULT();
+}
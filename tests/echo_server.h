@@ -0,0 +1,113 @@
+#ifndef CSTD_WEBSOCKET_TEST_ECHO_SERVER_H
+#define CSTD_WEBSOCKET_TEST_ECHO_SERVER_H
+
+/**
+ * WebSocket echo server for the tests, serving one connection (a pipe end or
+ * a socket) on its own thread.
+ * TEXT and BIN messages are echoed back, PINGs are answered with a PONG and a
+ * CLOSE is echoed before the connection is closed.
+ */
+
+#include "headers/net.h"
+#include "headers/protocol.h"
+#include "headers/reader.h"
+#include "headers/server.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct test_echo_t {
+  /**
+   * The server end of the connection, closed when the thread exits.
+   */
+  struct net_info_t info;
+  pthread_t thread;
+  /**
+   * Set once the upgrade was answered.
+   */
+  bool upgraded;
+  /**
+   * Number of messages received.
+   */
+  unsigned int messages;
+};
+
+static bool test_echo_write(struct net_info_t *info, enum ws_opcode_t type,
+                            const byte_array *body) {
+  byte_array out;
+  memset(&out, 0, sizeof(byte_array));
+  uint8_t key[4] = {0};
+  bool ok = ws_frame_append(&out, WS_FRAME_FIN | type, false, key,
+                            body->byte_data, body->len) == WS_FRAME_SUCCESS;
+  size_t offset = 0;
+  while (ok && offset < out.len) {
+    const ssize_t n = net_write(info, &out.byte_data[offset], out.len - offset);
+    ok = n > 0;
+    offset += ok ? (size_t)n : 0;
+  }
+  free(out.byte_data);
+  return ok;
+}
+
+static void *test_echo_main(void *arg) {
+  struct test_echo_t *echo = arg;
+  byte_array rest;
+  memset(&rest, 0, sizeof(byte_array));
+  echo->upgraded = ws_server_upgrade(&echo->info, NULL, &rest);
+  struct ws_reader_t *reader = ws_reader_create();
+  bool running = echo->upgraded && reader != NULL &&
+                 ws_reader_feed(reader, rest.byte_data, rest.len);
+  free(rest.byte_data);
+  while (running) {
+    struct ws_message_t *msg = ws_reader_next_msg(reader);
+    if (msg == NULL) {
+      // a blocking read that completes no message means the peer closed.
+      if (!ws_reader_handle(reader, &echo->info) ||
+          (msg = ws_reader_next_msg(reader)) == NULL) {
+        break;
+      }
+    }
+    ++echo->messages;
+    switch (msg->type) {
+    case OPCODE_TEXT:
+    case OPCODE_BIN:
+      running = test_echo_write(&echo->info, msg->type, &msg->body);
+      break;
+    case OPCODE_PING:
+      running = test_echo_write(&echo->info, OPCODE_PONG, &msg->body);
+      break;
+    case OPCODE_CLOSE:
+      (void)test_echo_write(&echo->info, OPCODE_CLOSE, &msg->body);
+      running = false;
+      break;
+    default:
+      break;
+    }
+    ws_message_free(msg);
+    free(msg);
+  }
+  if (reader != NULL) {
+    ws_reader_destroy(&reader);
+  }
+  net_close(&echo->info);
+  return NULL;
+}
+
+/**
+ * Serve echo->info, which must be set by the caller, on a new thread.
+ */
+static bool test_echo_start(struct test_echo_t *echo) {
+  echo->upgraded = false;
+  echo->messages = 0;
+  return pthread_create(&echo->thread, NULL, test_echo_main, echo) == 0;
+}
+
+/**
+ * Wait for the server to finish, i.e. the client closed or sent a CLOSE.
+ */
+static void test_echo_join(struct test_echo_t *echo) {
+  pthread_join(echo->thread, NULL);
+}
+
+#endif
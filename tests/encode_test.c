@@ -0,0 +1,124 @@
+#include "headers/encode.h"
+#include "tests/test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_ROUND_TRIP_LEN 64
+
+static const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * Byte at a time encoder the block encoders are checked against.
+ */
+static void reference_encode(const uint8_t *buf, size_t len, char *out) {
+  size_t out_len = 0;
+  for (size_t i = 0; i < len; i += 3) {
+    const size_t n = (len - i) < 3 ? (len - i) : 3;
+    uint32_t group = (uint32_t)buf[i] << 16;
+    if (n > 1) {
+      group |= (uint32_t)buf[i + 1] << 8;
+    }
+    if (n > 2) {
+      group |= buf[i + 2];
+    }
+    out[out_len] = base64_alphabet[(group >> 18) & 0x3F];
+    out[out_len + 1] = base64_alphabet[(group >> 12) & 0x3F];
+    out[out_len + 2] = n > 1 ? base64_alphabet[(group >> 6) & 0x3F] : '=';
+    out[out_len + 3] = n > 2 ? base64_alphabet[group & 0x3F] : '=';
+    out_len += 4;
+  }
+  out[out_len] = '\0';
+}
+
+static void test_sha1(const char *input, const char *expected_hex) {
+  uint8_t digest[SHA1_DIGEST_LEN];
+  sha1_digest((const uint8_t *)input, strlen(input), digest);
+  char hex[(SHA1_DIGEST_LEN * 2) + 1];
+  for (size_t i = 0; i < SHA1_DIGEST_LEN; ++i) {
+    snprintf(&hex[i * 2], 3, "%02x", digest[i]);
+  }
+  CHECK(strcmp(hex, expected_hex) == 0);
+}
+
+static void test_accept_noonce() {
+  // the sample handshake from RFC 6455 section 1.3.
+  const char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
+  const char expected[] = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+  char accept[WS_ACCEPT_NOONCE_LEN + 1];
+  CHECK(generate_accept_noonce(key, strlen(key), accept, sizeof(accept)) ==
+        WS_ACCEPT_NOONCE_LEN);
+  CHECK(strcmp(accept, expected) == 0);
+
+  uint8_t nonce[BASE64_DECODE_LEN(sizeof(key) - 1)];
+  CHECK(base64_decode_buf(key, strlen(key), nonce, sizeof(nonce)) == 16);
+  CHECK(memcmp(nonce, "the sample nonce", 16) == 0);
+  CHECK(check_response_noonce(nonce, 16, (char *)expected, strlen(expected)));
+  char wrong[] = "s3pPLMBiTxaQ9kYGzzhZRbK+xOp=";
+  CHECK(!check_response_noonce(nonce, 16, wrong, strlen(wrong)));
+}
+
+static void test_base64_round_trip(size_t len) {
+  uint8_t buf[MAX_ROUND_TRIP_LEN] = {0};
+  for (size_t i = 0; i < len; ++i) {
+    // every lane of a block sees different bits.
+    buf[i] = (uint8_t)((i * 151) + (len * 7) + 13);
+  }
+  char encoded[BASE64_ENCODE_LEN(MAX_ROUND_TRIP_LEN) + 1];
+  const size_t encoded_len =
+      base64_encode_buf(buf, len, encoded, sizeof(encoded));
+  uint8_t decoded[BASE64_DECODE_LEN(BASE64_ENCODE_LEN(MAX_ROUND_TRIP_LEN))];
+  if (len == 0) {
+    CHECK(encoded_len == 0);
+    CHECK(base64_decode_buf("", 0, decoded, sizeof(decoded)) == 0);
+    return;
+  }
+  CHECK(encoded_len == BASE64_ENCODE_LEN(len));
+  char expected[BASE64_ENCODE_LEN(MAX_ROUND_TRIP_LEN) + 1];
+  reference_encode(buf, len, expected);
+  CHECK(strcmp(encoded, expected) == 0);
+  CHECK(base64_decode_buf(encoded, encoded_len, decoded, sizeof(decoded)) ==
+        len);
+  CHECK(memcmp(decoded, buf, len) == 0);
+
+  // a bad character anywhere is caught, in the vector blocks as well as
+  // the last group.
+  for (size_t i = 0; i < encoded_len && encoded[i] != '='; i += 5) {
+    const char saved = encoded[i];
+    encoded[i] = '*';
+    CHECK(base64_decode_buf(encoded, encoded_len, decoded, sizeof(decoded)) ==
+          0);
+    encoded[i] = saved;
+  }
+}
+
+static void test_base64_alphabet() {
+  // 48 bytes covering every 6 bit value in order, one per character.
+  uint8_t buf[48];
+  for (size_t i = 0; i < 16; ++i) {
+    const uint32_t group = ((uint32_t)(i * 4) << 18) |
+                           ((uint32_t)((i * 4) + 1) << 12) |
+                           ((uint32_t)((i * 4) + 2) << 6) | ((i * 4) + 3);
+    buf[i * 3] = (group >> 16) & 0xFF;
+    buf[(i * 3) + 1] = (group >> 8) & 0xFF;
+    buf[(i * 3) + 2] = group & 0xFF;
+  }
+  char encoded[BASE64_ENCODE_LEN(48) + 1];
+  CHECK(base64_encode_buf(buf, sizeof(buf), encoded, sizeof(encoded)) == 64);
+  CHECK(strcmp(encoded, base64_alphabet) == 0);
+}
+
+int main(void) {
+  test_sha1("", "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+  test_sha1("abc", "a9993e364706816aba3e25717850c26c9cd0d89d");
+  // the padding spills into a second block.
+  test_sha1("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+  test_accept_noonce();
+  test_base64_alphabet();
+  for (size_t len = 0; len <= MAX_ROUND_TRIP_LEN; ++len) {
+    test_base64_round_trip(len);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,151 @@
+#include "headers/handshake.h"
+#include "headers/server.h"
+#include "tests/test.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLIENTS 4
+#define SERVED 3
+
+/**
+ * Unix socket server answering upgrades, the first one only once the gate
+ * is opened so the single worker stays busy with it.
+ */
+struct test_gate_t {
+  struct net_listener_t listener;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool open;
+  unsigned int accepted;
+  struct net_info_t conns[SERVED];
+};
+
+static void *test_gate_main(void *arg) {
+  struct test_gate_t *gate = arg;
+  for (unsigned int i = 0; i < SERVED; ++i) {
+    struct net_info_t *info = &gate->conns[i];
+    if (net_accept(&gate->listener, info) != 1) {
+      break;
+    }
+    pthread_mutex_lock(&gate->lock);
+    ++gate->accepted;
+    pthread_cond_broadcast(&gate->cond);
+    while (!gate->open) {
+      pthread_cond_wait(&gate->cond, &gate->lock);
+    }
+    pthread_mutex_unlock(&gate->lock);
+    byte_array rest;
+    memset(&rest, 0, sizeof(byte_array));
+    CHECK(ws_server_upgrade(info, NULL, &rest));
+    free(rest.byte_data);
+  }
+  return NULL;
+}
+
+struct test_order_t {
+  unsigned int ids[CLIENTS];
+  unsigned int len;
+  unsigned int failed;
+};
+
+struct test_job_t {
+  struct ws_client_t client;
+  unsigned int id;
+  struct test_order_t *order;
+};
+
+static void on_connected(struct ws_client_t *client, bool ok, void *context) {
+  struct test_job_t *job = context;
+  job->order->ids[job->order->len++] = job->id;
+  job->order->failed += ok ? 0 : 1;
+  ws_client_free(client);
+}
+
+static void test_order_and_queue_full(const char *path) {
+  struct test_gate_t gate;
+  memset(&gate, 0, sizeof(struct test_gate_t));
+  pthread_mutex_init(&gate.lock, NULL);
+  pthread_cond_init(&gate.cond, NULL);
+  CHECK(net_listen_unix(path, NULL, &gate.listener));
+  CHECK(pthread_create(&gate.thread, NULL, test_gate_main, &gate) == 0);
+
+  char url[128];
+  snprintf(url, sizeof(url), "ws+unix://%s:/ws", path);
+  struct test_order_t order;
+  memset(&order, 0, sizeof(struct test_order_t));
+  static struct test_job_t jobs[CLIENTS];
+  for (unsigned int i = 0; i < CLIENTS; ++i) {
+    CHECK(ws_client_from_str(url, strlen(url), &jobs[i].client));
+    jobs[i].id = i;
+    jobs[i].order = &order;
+  }
+
+  // one worker and room for two waiting handshakes.
+  struct ws_handshake_pool_t *pool = ws_handshake_pool_create(1, 2);
+  CHECK(pool != NULL);
+  if (pool == NULL) {
+    return;
+  }
+  CHECK(ws_handshake_pool_connect(pool, &jobs[0].client, on_connected,
+                                  &jobs[0]));
+  // the worker is stuck in the first upgrade once the server accepted it.
+  pthread_mutex_lock(&gate.lock);
+  while (gate.accepted == 0) {
+    pthread_cond_wait(&gate.cond, &gate.lock);
+  }
+  pthread_mutex_unlock(&gate.lock);
+  CHECK(ws_handshake_pool_connect(pool, &jobs[1].client, on_connected,
+                                  &jobs[1]));
+  CHECK(ws_handshake_pool_connect(pool, &jobs[2].client, on_connected,
+                                  &jobs[2]));
+  CHECK(!ws_handshake_pool_connect(pool, &jobs[3].client, on_connected,
+                                   &jobs[3]));
+  CHECK(ws_handshake_pool_pending(pool) == 3);
+  CHECK(ws_handshake_pool_dispatch(pool) == 0);
+
+  pthread_mutex_lock(&gate.lock);
+  gate.open = true;
+  pthread_cond_broadcast(&gate.cond);
+  pthread_mutex_unlock(&gate.lock);
+  struct pollfd pfd = {ws_handshake_pool_fd(pool), POLLIN, 0};
+  for (int i = 0; i < 100 && order.len < SERVED; ++i) {
+    if (poll(&pfd, 1, 100) > 0) {
+      (void)ws_handshake_pool_dispatch(pool);
+    }
+  }
+  // callbacks run in submit order, the rejected client never ran.
+  CHECK(order.len == SERVED);
+  for (unsigned int i = 0; i < order.len; ++i) {
+    CHECK(order.ids[i] == i);
+  }
+  CHECK(order.failed == 0);
+  CHECK(ws_handshake_pool_pending(pool) == 0);
+  ws_handshake_pool_destroy(&pool);
+  CHECK(pool == NULL);
+
+  pthread_join(gate.thread, NULL);
+  for (unsigned int i = 0; i < SERVED; ++i) {
+    net_close(&gate.conns[i]);
+  }
+  ws_client_free(&jobs[3].client);
+  net_listener_close(&gate.listener);
+  pthread_mutex_destroy(&gate.lock);
+  pthread_cond_destroy(&gate.cond);
+}
+
+int main(void) {
+  signal(SIGPIPE, SIG_IGN);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/webc_handshake_test_%d.sock",
+           (int)getpid());
+  test_order_and_queue_full(path);
+  unlink(path);
+  return TEST_RESULT();
+}
@@ -0,0 +1,161 @@
+#include "headers/http.h"
+#include "headers/net.h"
+#include "headers/server.h"
+#include "headers/websocket.h"
+#include "tests/test.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VALID_REQUEST                                                          \
+  "GET /ws HTTP/1.1\r\n"                                                       \
+  "Host: localhost:3000\r\n"                                                   \
+  "Upgrade: websocket\r\n"                                                     \
+  "Connection: keep-alive, Upgrade\r\n"                                        \
+  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"                            \
+  "Sec-WebSocket-Version: 13\r\n"                                              \
+  "Sec-WebSocket-Protocol: chat\r\n"                                           \
+  "\r\n"
+
+static bool span_is(const char *buf, struct http_span_t span,
+                    const char *value) {
+  return span.len == strlen(value) &&
+         memcmp(&buf[span.offset], value, span.len) == 0;
+}
+
+static enum http_parse_result_t parse(const char *str) {
+  struct http_upgrade_request_t r;
+  return http_upgrade_request_parse(&r, str, strlen(str));
+}
+
+static void test_complete() {
+  // trailing frame bytes are not part of the request.
+  const char buf[] = VALID_REQUEST "\x81\x80";
+  struct http_upgrade_request_t r;
+  CHECK(http_upgrade_request_parse(&r, buf, sizeof(buf) - 1) == HTTP_PARSE_OK);
+  CHECK(r.method == HTTP_GET);
+  CHECK(span_is(buf, r.path, "/ws"));
+  CHECK(span_is(buf, r.protocol, "HTTP/1.1"));
+  CHECK(span_is(buf, r.host, "localhost:3000"));
+  CHECK(span_is(buf, r.key, "dGhlIHNhbXBsZSBub25jZQ=="));
+  CHECK(span_is(buf, r.version, "13"));
+  CHECK(span_is(buf, r.ws_protocol, "chat"));
+  CHECK(r.extensions.len == 0);
+  CHECK(r.header_len == strlen(VALID_REQUEST));
+}
+
+static void test_incomplete() {
+  const char *request = VALID_REQUEST;
+  const size_t len = strlen(request);
+  struct http_upgrade_request_t r;
+  // every prefix of a valid request needs more data.
+  for (size_t i = 0; i < len; ++i) {
+    CHECK(http_upgrade_request_parse(&r, request, i) == HTTP_PARSE_INCOMPLETE);
+  }
+}
+
+static void test_invalid() {
+  // wrong method.
+  CHECK(parse("POST /ws HTTP/1.1\r\nHost: a\r\nUpgrade: websocket\r\n"
+              "Connection: Upgrade\r\n"
+              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+              "Sec-WebSocket-Version: 13\r\n\r\n") == HTTP_PARSE_INVALID);
+  // missing Upgrade header.
+  CHECK(parse("GET /ws HTTP/1.1\r\nHost: a\r\nConnection: Upgrade\r\n"
+              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+              "Sec-WebSocket-Version: 13\r\n\r\n") == HTTP_PARSE_INVALID);
+  // unsupported version.
+  CHECK(parse("GET /ws HTTP/1.1\r\nHost: a\r\nUpgrade: websocket\r\n"
+              "Connection: Upgrade\r\n"
+              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+              "Sec-WebSocket-Version: 8\r\n\r\n") == HTTP_PARSE_INVALID);
+  // key is not 16 bytes.
+  CHECK(parse("GET /ws HTTP/1.1\r\nHost: a\r\nUpgrade: websocket\r\n"
+              "Connection: Upgrade\r\nSec-WebSocket-Key: c2hvcnQ=\r\n"
+              "Sec-WebSocket-Version: 13\r\n\r\n") == HTTP_PARSE_INVALID);
+  // bare \r without \n.
+  CHECK(parse("GET /ws HTTP/1.1\rHost: a\r\n\r\n") == HTTP_PARSE_INVALID);
+  // header without a colon.
+  CHECK(parse("GET /ws HTTP/1.1\r\nHost a\r\n\r\n") == HTTP_PARSE_INVALID);
+}
+
+struct server_result_t {
+  struct net_info_t info;
+  bool ok;
+  char *path;
+  byte_array rest;
+};
+
+static void *serve_upgrade(void *arg) {
+  struct server_result_t *result = arg;
+  memset(&result->rest, 0, sizeof(byte_array));
+  result->ok = ws_server_upgrade(&result->info, &result->path, &result->rest);
+  return NULL;
+}
+
+static void test_server_upgrade() {
+  struct net_info_t client_end;
+  struct server_result_t server = {0};
+  CHECK(net_pipe(&client_end, &server.info));
+  pthread_t thread;
+  pthread_create(&thread, NULL, serve_upgrade, &server);
+
+  struct ws_client_t client;
+  const char *url = "ws://localhost:3000/chat";
+  CHECK(ws_client_from_str(url, strlen(url), &client));
+  // queued messages go out right behind the request.
+  byte_array body = {(uint8_t *)"hi", 2, 2};
+  CHECK(ws_client_queue_msg(&client, OPCODE_TEXT, body));
+  CHECK(ws_client_upgrade(&client, &client_end));
+  pthread_join(thread, NULL);
+  CHECK(server.ok);
+  CHECK(server.path != NULL && strcmp(server.path, "/chat") == 0);
+
+  // the queued frame may be split from the request, read it if needed.
+  if (server.rest.len == 0) {
+    uint8_t buf[64];
+    const ssize_t n = net_read(&server.info, buf, sizeof(buf));
+    CHECK(n > 0);
+    if (n > 0) {
+      free(server.rest.byte_data);
+      byte_array_init(&server.rest, n);
+      memcpy(server.rest.byte_data, buf, n);
+      server.rest.len = n;
+    }
+  }
+  // masked text frame with a 2 byte payload.
+  CHECK(server.rest.len == 8);
+  CHECK(server.rest.len > 1 && server.rest.byte_data[0] == 0x81 &&
+        server.rest.byte_data[1] == 0x82);
+
+  free(server.path);
+  free(server.rest.byte_data);
+  net_close(&server.info);
+  ws_client_free(&client);
+}
+
+static void test_server_reject() {
+  struct net_info_t client_end;
+  struct server_result_t server = {0};
+  CHECK(net_pipe(&client_end, &server.info));
+  const char *request = "GET /ws HTTP/1.1\r\nHost: a\r\n\r\n";
+  CHECK(net_write(&client_end, request, strlen(request)) ==
+        (ssize_t)strlen(request));
+  serve_upgrade(&server);
+  CHECK(!server.ok);
+  char buf[128] = {0};
+  CHECK(net_read(&client_end, buf, sizeof(buf) - 1) > 0);
+  CHECK(strncmp(buf, "HTTP/1.1 400", 12) == 0);
+  net_close(&server.info);
+  net_close(&client_end);
+}
+
+int main(void) {
+  test_complete();
+  test_incomplete();
+  test_invalid();
+  test_server_upgrade();
+  test_server_reject();
+  return TEST_RESULT();
+}
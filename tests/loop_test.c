@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include "headers/loop.h"
+#include "tests/echo_server.h"
+#include "tests/test.h"
+
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_URL "ws://localhost:3000/ws"
+#define CLIENTS 4
+#define BIG_LEN 70000
+
+struct test_conn_t {
+  struct ws_client_t client;
+  struct test_echo_t echo;
+  /**
+   * Polled by the main thread while the loop runs on another one.
+   */
+  atomic_uint received;
+  bool closed;
+  enum ws_client_status_t status;
+};
+
+static uint8_t big[BIG_LEN];
+
+static bool on_msg(struct ws_client_t *client, struct ws_message_t *msg,
+                   void *context) {
+  (void)client;
+  struct test_conn_t *conn = context;
+  ++conn->received;
+  if (msg->type == OPCODE_TEXT) {
+    CHECK(msg->body.len == 5 && memcmp(msg->body.byte_data, "hello", 5) == 0);
+    return true;
+  }
+  CHECK(msg->type == OPCODE_BIN);
+  CHECK(msg->body.len == BIG_LEN &&
+        memcmp(msg->body.byte_data, big, BIG_LEN) == 0);
+  // the last echo, leave the loop.
+  return false;
+}
+
+static void on_close(struct ws_client_t *client, enum ws_client_status_t status,
+                     void *context) {
+  struct test_conn_t *conn = context;
+  conn->closed = true;
+  conn->status = status;
+  ws_client_free(client);
+}
+
+/**
+ * Connect every client to its own echo server over a socketpair, the loop
+ * needs a real file descriptor.
+ */
+static bool test_connect(struct test_conn_t *conns, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    memset(&conns[i], 0, sizeof(struct test_conn_t));
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+      return false;
+    }
+    struct net_info_t client_end;
+    memset(&client_end, 0, sizeof(struct net_info_t));
+    client_end.socket = fds[0];
+    client_end.transport = &net_unix_transport;
+    conns[i].echo.info.socket = fds[1];
+    conns[i].echo.info.transport = &net_unix_transport;
+    if (!test_echo_start(&conns[i].echo) ||
+        !ws_client_from_str(TEST_URL, strlen(TEST_URL), &conns[i].client) ||
+        !ws_client_upgrade(&conns[i].client, &client_end)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_send(struct test_conn_t *conns, size_t len) {
+  byte_array hello = {(uint8_t *)"hello", 5, 5};
+  byte_array body = {big, BIG_LEN, BIG_LEN};
+  for (size_t i = 0; i < len; ++i) {
+    CHECK(ws_client_write(&conns[i].client, OPCODE_TEXT, hello));
+    CHECK(ws_client_write(&conns[i].client, OPCODE_BIN, body));
+  }
+}
+
+static void test_finish(struct test_conn_t *conns, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    // the client was freed by on_close, which closes the server's peer.
+    test_echo_join(&conns[i].echo);
+    CHECK(conns[i].echo.upgraded);
+    CHECK(conns[i].echo.messages == 2);
+    CHECK(conns[i].received == 2);
+    CHECK(conns[i].closed);
+    CHECK(conns[i].status == WS_CLIENT_STOPPED);
+  }
+}
+
+static void test_run() {
+  static struct test_conn_t conns[CLIENTS];
+  struct ws_loop_t *loop = ws_loop_create();
+  CHECK(loop != NULL);
+  CHECK(test_connect(conns, CLIENTS));
+  for (size_t i = 0; i < CLIENTS; ++i) {
+    CHECK(ws_loop_add(loop, &conns[i].client, on_msg, on_close, &conns[i]));
+  }
+  // writes go through the loop's backend once the clients are added.
+  test_send(conns, CLIENTS);
+  CHECK(ws_loop_run(loop));
+  test_finish(conns, CLIENTS);
+  ws_loop_destroy(&loop);
+}
+
+static void test_run_spin() {
+  static struct test_conn_t conns[CLIENTS];
+  struct ws_loop_t *loop = ws_loop_create();
+  CHECK(loop != NULL);
+  CHECK(test_connect(conns, CLIENTS));
+  for (size_t i = 0; i < CLIENTS; ++i) {
+    CHECK(ws_loop_add(loop, &conns[i].client, on_msg, on_close, &conns[i]));
+  }
+  test_send(conns, CLIENTS);
+  struct ws_loop_spin_t spin;
+  ws_loop_spin_init(&spin);
+  // short enough to park between the echoes.
+  spin.spin_us = 100;
+  spin.park_ms = 10;
+  CHECK(ws_loop_run_spin(loop, &spin));
+  test_finish(conns, CLIENTS);
+  ws_loop_destroy(&loop);
+}
+
+struct test_spin_t {
+  struct ws_loop_t *loop;
+  struct ws_loop_spin_t spin;
+  bool ok;
+  /**
+   * Set if the loop thread was left pinned to spin.cpu alone.
+   */
+  bool pinned;
+};
+
+static void *test_spin_main(void *arg) {
+  struct test_spin_t *t = arg;
+  t->ok = ws_loop_run_spin(t->loop, &t->spin);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  t->pinned =
+      pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0 &&
+      CPU_COUNT(&set) == 1 && CPU_ISSET(t->spin.cpu, &set);
+  return NULL;
+}
+
+/**
+ * Run a pinned spin loop on its own thread with a quiet client, deliver a
+ * late message from the server end and stop the loop from this thread while
+ * the client is still connected.
+ */
+static void test_spin_stop(int spin_us, int park_ms) {
+  static struct test_conn_t conn;
+  struct test_spin_t t;
+  memset(&t, 0, sizeof(struct test_spin_t));
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CHECK(sched_getaffinity(0, sizeof(set), &set) == 0);
+  ws_loop_spin_init(&t.spin);
+  // the last allowed cpu, so pinning actually narrows the mask.
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      t.spin.cpu = cpu;
+    }
+  }
+  t.spin.spin_us = spin_us;
+  t.spin.park_ms = park_ms;
+  t.loop = ws_loop_create();
+  CHECK(t.loop != NULL);
+  CHECK(test_connect(&conn, 1));
+  CHECK(ws_loop_add(t.loop, &conn.client, on_msg, on_close, &conn));
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, test_spin_main, &t) == 0);
+
+  // long enough to be spinning, or parked when spin_us allows it.
+  usleep(50 * 1000);
+  byte_array hello = {(uint8_t *)"hello", 5, 5};
+  CHECK(test_echo_write(&conn.echo.info, OPCODE_TEXT, &hello));
+  for (int i = 0; i < 2000 && atomic_load(&conn.received) == 0; ++i) {
+    usleep(1000);
+  }
+  CHECK(atomic_load(&conn.received) == 1);
+  ws_loop_stop(t.loop);
+  CHECK(pthread_join(thread, NULL) == 0);
+  CHECK(t.ok);
+  CHECK(t.pinned);
+  // stopping leaves the clients in the loop, untouched.
+  CHECK(!conn.closed);
+  CHECK(ws_loop_remove(t.loop, &conn.client));
+  ws_client_free(&conn.client);
+  test_echo_join(&conn.echo);
+  CHECK(conn.echo.upgraded);
+  CHECK(conn.echo.messages == 0);
+  ws_loop_destroy(&t.loop);
+}
+
+static void test_spin_bad_cpu() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CHECK(sched_getaffinity(0, sizeof(set), &set) == 0);
+  struct ws_loop_spin_t spin;
+  ws_loop_spin_init(&spin);
+  // the first cpu the process may not run on, pinning to it fails.
+  for (spin.cpu = 0; spin.cpu < CPU_SETSIZE - 1 && CPU_ISSET(spin.cpu, &set);
+       ++spin.cpu) {
+  }
+  struct ws_loop_t *loop = ws_loop_create();
+  CHECK(loop != NULL);
+  CHECK(!ws_loop_run_spin(loop, &spin));
+  ws_loop_destroy(&loop);
+}
+
+int main(void) {
+  signal(SIGPIPE, SIG_IGN);
+  for (size_t i = 0; i < BIG_LEN; ++i) {
+    big[i] = (uint8_t)(i * 7);
+  }
+  test_run();
+  test_run_spin();
+  // never parks.
+  test_spin_stop(-1, -1);
+  // parks with no timeout, woken by the message and then by the stop.
+  test_spin_stop(1000, -1);
+  test_spin_bad_cpu();
+  return TEST_RESULT();
+}
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+#include "headers/net.h"
+#include "tests/test.h"
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 20
+#define EYEBALLS_HOST "eyeballs.test"
+#define BLACKHOLE_CLIENTS 8
+#define SHARDED_CLIENTS 64
+
+/**
+ * Resolve EYEBALLS_HOST to 127.0.0.2 followed by 127.0.0.1, everything else
+ * normally.
+ */
+int getaddrinfo(const char *restrict node, const char *restrict service,
+                const struct addrinfo *restrict hints,
+                struct addrinfo **restrict res) {
+  typedef int(getaddrinfo_fn)(const char *restrict, const char *restrict,
+                              const struct addrinfo *restrict,
+                              struct addrinfo **restrict);
+  getaddrinfo_fn *next = (getaddrinfo_fn *)dlsym(RTLD_NEXT, "getaddrinfo");
+  if (node == NULL || strcmp(node, EYEBALLS_HOST) != 0) {
+    return next(node, service, hints, res);
+  }
+  struct addrinfo only_v4;
+  memset(&only_v4, 0, sizeof(only_v4));
+  only_v4.ai_family = AF_INET;
+  only_v4.ai_socktype = SOCK_STREAM;
+  only_v4.ai_flags = AI_NUMERICHOST;
+  struct addrinfo *first = NULL;
+  struct addrinfo *second = NULL;
+  int err = next("127.0.0.2", service, &only_v4, &first);
+  if (err == 0) {
+    err = next("127.0.0.1", service, &only_v4, &second);
+  }
+  if (err != 0) {
+    if (first != NULL) {
+      freeaddrinfo(first);
+    }
+    return err;
+  }
+  // freeaddrinfo walks the whole chain.
+  struct addrinfo *tail = first;
+  while (tail->ai_next != NULL) {
+    tail = tail->ai_next;
+  }
+  tail->ai_next = second;
+  *res = first;
+  return 0;
+}
+
+static int64_t test_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/**
+ * Listen on a free loopback port and write its address to addr.
+ */
+static bool test_listen(struct net_listener_t *listener,
+                        const struct net_listen_options_t *opts,
+                        struct sockaddr_in *addr) {
+  if (!net_listen("127.0.0.1", "0", opts, listener)) {
+    return false;
+  }
+  socklen_t addr_len = sizeof(struct sockaddr_in);
+  if (getsockname(listener->socket, (struct sockaddr *)addr, &addr_len) ==
+      -1) {
+    net_listener_close(listener);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Connect a plain TCP connection, net_connect_with uses TLS in SSL builds.
+ */
+static bool test_connect(const struct sockaddr_in *addr,
+                         struct net_info_t *out) {
+  memset(out, 0, sizeof(struct net_info_t));
+  out->socket = socket(AF_INET, SOCK_STREAM, 0);
+  out->transport = &net_tcp_transport;
+  if (out->socket == -1) {
+    return false;
+  }
+  if (connect(out->socket, (const struct sockaddr *)addr,
+              sizeof(struct sockaddr_in)) == -1) {
+    close(out->socket);
+    out->socket = -1;
+    return false;
+  }
+  return true;
+}
+
+static void test_quick_ack() {
+  struct net_listener_t listener;
+  struct sockaddr_in addr;
+  CHECK(test_listen(&listener, NULL, &addr));
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.quick_ack = true;
+  struct net_info_t client;
+  struct net_info_t server;
+  CHECK(test_connect(&addr, &client));
+  CHECK(net_accept(&listener, &server) == 1);
+  CHECK(net_set_options(&client, &opts));
+  CHECK(client.quick_ack);
+
+  // answering every message right away is the pattern that makes Linux
+  // fall back to delayed ACKs.
+  for (int i = 0; i < ROUNDS; ++i) {
+    char byte = (char)i;
+    CHECK(net_write(&server, &byte, 1) == 1);
+    CHECK(net_read(&client, &byte, 1) == 1);
+    int quick_ack = 0;
+    socklen_t len = sizeof(quick_ack);
+    CHECK(getsockopt(client.socket, IPPROTO_TCP, TCP_QUICKACK, &quick_ack,
+                     &len) == 0);
+    CHECK(quick_ack == 1);
+    CHECK(net_write(&client, &byte, 1) == 1);
+    CHECK(net_read(&server, &byte, 1) == 1);
+  }
+  net_close(&client);
+  net_close(&server);
+  net_listener_close(&listener);
+}
+
+/**
+ * Accept every queued connection on a non-blocking listener.
+ *
+ * @return The number of accepted connections.
+ */
+static unsigned int test_drain(struct net_listener_t *listener) {
+  unsigned int accepted = 0;
+  struct net_info_t server;
+  while (net_accept(listener, &server) == 1) {
+    CHECK(server.transport == &net_tcp_transport);
+    net_close(&server);
+    ++accepted;
+  }
+  return accepted;
+}
+
+static void test_reuse_port() {
+  struct net_listen_options_t opts;
+  net_listen_options_init(&opts);
+  opts.nonblocking = true;
+  opts.reuse_port = true;
+  struct net_listener_t first;
+  struct sockaddr_in addr;
+  CHECK(test_listen(&first, &opts, &addr));
+  CHECK(first.nonblocking);
+  struct net_info_t server;
+  CHECK(net_accept(&first, &server) == NET_WOULD_BLOCK);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+  // only listeners that all set SO_REUSEPORT share the port.
+  struct net_listen_options_t plain;
+  net_listen_options_init(&plain);
+  struct net_listener_t second;
+  CHECK(!net_listen("127.0.0.1", port, &plain, &second));
+  CHECK(net_listen("127.0.0.1", port, &opts, &second));
+
+  // the kernel spreads the connections by their address hash.
+  struct net_info_t clients[SHARDED_CLIENTS];
+  for (int i = 0; i < SHARDED_CLIENTS; ++i) {
+    CHECK(test_connect(&addr, &clients[i]));
+  }
+  const unsigned int first_accepted = test_drain(&first);
+  const unsigned int second_accepted = test_drain(&second);
+  CHECK(first_accepted + second_accepted == SHARDED_CLIENTS);
+  CHECK(first_accepted > 0 && second_accepted > 0);
+  for (int i = 0; i < SHARDED_CLIENTS; ++i) {
+    net_close(&clients[i]);
+  }
+  net_listener_close(&first);
+  net_listener_close(&second);
+}
+
+/**
+ * A listener on 127.0.0.2 whose accept queue is full, new connects to it
+ * never complete.
+ */
+struct test_blackhole_t {
+  int listener;
+  int clients[BLACKHOLE_CLIENTS];
+};
+
+static void test_blackhole_stop(struct test_blackhole_t *hole) {
+  for (int i = 0; i < BLACKHOLE_CLIENTS; ++i) {
+    if (hole->clients[i] != -1) {
+      close(hole->clients[i]);
+    }
+  }
+  close(hole->listener);
+}
+
+/**
+ * Start a blackhole on the given port, 0 picks a free one.
+ */
+static bool test_blackhole_start(struct test_blackhole_t *hole,
+                                 unsigned short port) {
+  for (int i = 0; i < BLACKHOLE_CLIENTS; ++i) {
+    hole->clients[i] = -1;
+  }
+  hole->listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.2", &addr.sin_addr);
+  socklen_t addr_len = sizeof(addr);
+  if (hole->listener == -1 ||
+      bind(hole->listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(hole->listener, 0) == -1 ||
+      getsockname(hole->listener, (struct sockaddr *)&addr, &addr_len) ==
+          -1) {
+    test_blackhole_stop(hole);
+    return false;
+  }
+  // how many connects fit in a zero backlog differs between kernels, keep
+  // connecting until one is left hanging.
+  for (int i = 0; i < BLACKHOLE_CLIENTS; ++i) {
+    hole->clients[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    (void)connect(hole->clients[i], (struct sockaddr *)&addr, sizeof(addr));
+    struct pollfd pfd = {.fd = hole->clients[i], .events = POLLOUT};
+    if (poll(&pfd, 1, 50) == 0) {
+      return true;
+    }
+  }
+  test_blackhole_stop(hole);
+  return false;
+}
+
+static void test_connect_deadline() {
+  struct test_blackhole_t hole;
+  CHECK(test_blackhole_start(&hole, 0));
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  CHECK(getsockname(hole.listener, (struct sockaddr *)&addr, &addr_len) == 0);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.connect_timeout_ms = 300;
+  struct net_info_t info;
+  const int64_t start = test_now_ms();
+  CHECK(!net_connect_with("127.0.0.2", port, &opts, &info));
+  const int64_t elapsed = test_now_ms() - start;
+  CHECK(elapsed >= 250 && elapsed < 1500);
+  test_blackhole_stop(&hole);
+}
+
+#ifndef WEBC_USE_SSL
+/**
+ * Read the net.ipv4.tcp_fastopen sysctl, -1 if it can't be read.
+ */
+static int test_fast_open_sysctl() {
+  FILE *file = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+  if (file == NULL) {
+    return -1;
+  }
+  int value = -1;
+  if (fscanf(file, "%d", &value) != 1) {
+    value = -1;
+  }
+  fclose(file);
+  return value;
+}
+
+/**
+ * Connect with Fast Open, send a byte and accept the connection.
+ *
+ * @return True if the SYN carried the byte.
+ */
+static bool test_fast_open_visit(struct net_listener_t *listener,
+                                 const char *port) {
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.fast_open = true;
+  struct net_info_t client;
+  CHECK(net_connect_with("127.0.0.1", port, &opts, &client));
+  int fast_open = 0;
+  socklen_t len = sizeof(fast_open);
+  CHECK(getsockopt(client.socket, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                   &fast_open, &len) == 0);
+  CHECK(fast_open == 1);
+  CHECK(net_write(&client, "a", 1) == 1);
+  struct net_info_t server;
+  CHECK(net_accept(listener, &server) == 1);
+  char byte = 0;
+  CHECK(net_read(&server, &byte, 1) == 1 && byte == 'a');
+  struct tcp_info info;
+  len = sizeof(info);
+  CHECK(getsockopt(client.socket, IPPROTO_TCP, TCP_INFO, &info, &len) == 0);
+  net_close(&server);
+  net_close(&client);
+  return (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+}
+
+static void test_fast_open() {
+  struct net_listen_options_t listen_opts;
+  net_listen_options_init(&listen_opts);
+  listen_opts.fast_open_queue = 16;
+  struct net_listener_t listener;
+  struct sockaddr_in addr;
+  CHECK(test_listen(&listener, &listen_opts, &addr));
+  int queue = 0;
+  socklen_t len = sizeof(queue);
+  CHECK(getsockopt(listener.socket, IPPROTO_TCP, TCP_FASTOPEN, &queue,
+                   &len) == 0);
+  CHECK(queue == 16);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+  // the first connect fetches the cookie unless the kernel still holds one
+  // from an earlier run, the next one sends data in the SYN. Needs both the
+  // client (1) and server (2) bits of the sysctl.
+  (void)test_fast_open_visit(&listener, port);
+  const bool syn_data = test_fast_open_visit(&listener, port);
+  const int sysctl = test_fast_open_sysctl();
+  if (sysctl != -1 && (sysctl & 3) == 3) {
+    CHECK(syn_data);
+  } else {
+    fprintf(stderr, "net.ipv4.tcp_fastopen is %d, skipping SYN data check.\n",
+            sysctl);
+  }
+  net_listener_close(&listener);
+}
+
+/**
+ * Connect to EYEBALLS_HOST with the given attempt delay.
+ *
+ * @return The time it took, -1 if the connect failed.
+ */
+static int64_t test_eyeballs_connect(struct net_listener_t *listener,
+                                     const char *port,
+                                     unsigned int attempt_delay_ms) {
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.attempt_delay_ms = attempt_delay_ms;
+  struct net_info_t client;
+  const int64_t start = test_now_ms();
+  if (!net_connect_with(EYEBALLS_HOST, port, &opts, &client)) {
+    return -1;
+  }
+  const int64_t elapsed = test_now_ms() - start;
+  struct net_info_t server;
+  CHECK(net_accept(listener, &server) == 1);
+  net_close(&server);
+  net_close(&client);
+  return elapsed;
+}
+
+static void test_happy_eyeballs() {
+  struct net_listener_t listener;
+  struct sockaddr_in addr;
+  CHECK(test_listen(&listener, NULL, &addr));
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+  // 127.0.0.2 refuses, the listening 127.0.0.1 is tried without waiting
+  // out the attempt delay.
+  int64_t elapsed = test_eyeballs_connect(&listener, port, 3000);
+  CHECK(elapsed >= 0 && elapsed < 1000);
+
+  // 127.0.0.2 never answers, 127.0.0.1 starts after the attempt delay and
+  // wins the race.
+  struct test_blackhole_t hole;
+  CHECK(test_blackhole_start(&hole, ntohs(addr.sin_port)));
+  elapsed = test_eyeballs_connect(&listener, port, 200);
+  CHECK(elapsed >= 150 && elapsed < 1500);
+  test_blackhole_stop(&hole);
+  net_listener_close(&listener);
+}
+#endif
+
+int main(void) {
+  signal(SIGPIPE, SIG_IGN);
+  test_quick_ack();
+  test_reuse_port();
+  test_connect_deadline();
+#ifndef WEBC_USE_SSL
+  // net_connect_with always runs a TLS handshake in SSL builds.
+  test_fast_open();
+  test_happy_eyeballs();
+#endif
+  return TEST_RESULT();
+}
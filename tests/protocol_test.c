@@ -0,0 +1,101 @@
+#include "headers/protocol.h"
+#include "tests/test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t masking_key[4] = {0x37, 0xFA, 0x21, 0x3D};
+
+/**
+ * Expected header length for the payload length.
+ */
+static size_t expected_header_len(uint64_t payload_len, bool mask) {
+  size_t result = 2;
+  if (payload_len > 0xFFFF) {
+    result += 8;
+  } else if (payload_len > 125) {
+    result += 2;
+  }
+  return result + (mask ? 4 : 0);
+}
+
+static void test_header_round_trip(uint64_t payload_len, bool mask) {
+  uint8_t buf[WS_FRAME_HEADER_STORE_LEN];
+  memset(buf, 0xAA, sizeof(buf));
+  const uint8_t codes = WS_FRAME_FIN | OPCODE_BIN;
+  const size_t header_len =
+      ws_frame_write_header(buf, codes, mask, masking_key, payload_len);
+  CHECK(header_len == expected_header_len(payload_len, mask));
+  CHECK(buf[0] == codes);
+  CHECK(((buf[1] & 0x80) != 0) == mask);
+
+  struct ws_frame_desc_t desc;
+  if (payload_len <= UINT32_MAX) {
+    CHECK(ws_frame_desc_read(&desc, buf, header_len) == WS_FRAME_SUCCESS);
+    CHECK(desc.len == payload_len);
+    CHECK(desc.header_len == header_len);
+    CHECK(desc.offset == header_len);
+    CHECK(ws_frame_desc_opcode(&desc) == OPCODE_BIN);
+    CHECK(ws_frame_desc_fin(&desc));
+    CHECK(!ws_frame_desc_rsv1(&desc));
+    CHECK(ws_frame_desc_masked(&desc) == mask);
+    if (mask) {
+      CHECK(memcmp(desc.masking_key, masking_key, 4) == 0);
+    }
+  } else {
+    // the descriptor only holds 32 bit lengths.
+    CHECK(ws_frame_desc_read(&desc, buf, header_len) == WS_FRAME_INVALID);
+  }
+  struct ws_frame_t frame;
+  ws_frame_init(&frame);
+  CHECK(ws_frame_read_header(&frame, buf, header_len) == WS_FRAME_SUCCESS);
+  CHECK(frame.payload_len == payload_len);
+  CHECK(frame.info.flags.mask == mask);
+
+  // every truncated header asks for more bytes.
+  for (size_t len = 0; len < header_len; ++len) {
+    CHECK(ws_frame_desc_read(&desc, buf, len) == WS_FRAME_ERROR_LEN);
+  }
+}
+
+static void test_append(size_t payload_len, bool mask) {
+  uint8_t *payload = malloc(payload_len + 1);
+  for (size_t i = 0; i < payload_len; ++i) {
+    payload[i] = (uint8_t)(i * 31);
+  }
+  byte_array out = {0};
+  uint8_t key[4];
+  memcpy(key, masking_key, sizeof(key));
+  CHECK(ws_frame_append(&out, WS_FRAME_FIN | OPCODE_TEXT, mask, key, payload,
+                        payload_len) == WS_FRAME_SUCCESS);
+  const size_t header_len = expected_header_len(payload_len, mask);
+  CHECK(out.len == header_len + payload_len);
+
+  struct ws_frame_desc_t desc;
+  CHECK(ws_frame_desc_read(&desc, out.byte_data, out.len) == WS_FRAME_SUCCESS);
+  CHECK(desc.len == payload_len);
+  CHECK(desc.offset == header_len);
+  bool same = true;
+  for (size_t i = 0; i < payload_len && same; ++i) {
+    const uint8_t value =
+        out.byte_data[desc.offset + i] ^ (mask ? masking_key[i % 4] : 0);
+    same = value == payload[i];
+  }
+  CHECK(same);
+  free(out.byte_data);
+  free(payload);
+}
+
+int main(void) {
+  const uint64_t lens[] = {0, 125, 126, 65535, 65536, (uint64_t)1 << 32};
+  for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); ++i) {
+    test_header_round_trip(lens[i], false);
+    test_header_round_trip(lens[i], true);
+  }
+  const size_t append_lens[] = {0, 5, 125, 126, 65535, 65536};
+  for (size_t i = 0; i < sizeof(append_lens) / sizeof(append_lens[0]); ++i) {
+    test_append(append_lens[i], false);
+    test_append(append_lens[i], true);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,136 @@
+#include "headers/standby.h"
+#include "tests/echo_server.h"
+#include "tests/test.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MAX_CONNS 8
+
+/**
+ * Unix socket server running an echo server per accepted connection.
+ */
+struct test_listener_t {
+  struct net_listener_t listener;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct test_echo_t echos[MAX_CONNS];
+  unsigned int len;
+};
+
+static void *test_listener_main(void *arg) {
+  struct test_listener_t *server = arg;
+  while (server->len < MAX_CONNS) {
+    struct test_echo_t *echo = &server->echos[server->len];
+    if (net_accept(&server->listener, &echo->info) != 1 ||
+        !test_echo_start(echo)) {
+      break;
+    }
+    pthread_mutex_lock(&server->lock);
+    ++server->len;
+    pthread_mutex_unlock(&server->lock);
+  }
+  return NULL;
+}
+
+static unsigned int test_listener_len(struct test_listener_t *server) {
+  pthread_mutex_lock(&server->lock);
+  const unsigned int result = server->len;
+  pthread_mutex_unlock(&server->lock);
+  return result;
+}
+
+struct test_state_t {
+  unsigned int promoted;
+  unsigned int received;
+};
+
+static bool on_msg(struct ws_client_t *client, struct ws_message_t *msg,
+                   void *context) {
+  (void)client;
+  struct test_state_t *state = context;
+  CHECK(msg->type == OPCODE_TEXT && msg->body.len == 5);
+  ++state->received;
+  return true;
+}
+
+static void on_promote(struct ws_client_t *client, void *context) {
+  (void)client;
+  struct test_state_t *state = context;
+  ++state->promoted;
+}
+
+/**
+ * Run the standby until the condition holds, at most about two seconds.
+ */
+#define RUN_UNTIL(standby, cond)                                               \
+  for (int i_ = 0; i_ < 200 && !(cond); ++i_) {                                \
+    CHECK(ws_standby_run_once(standby, 10) == WS_CLIENT_OK);                   \
+  }
+
+static void test_failover(const char *path) {
+  struct test_listener_t server;
+  memset(&server, 0, sizeof(struct test_listener_t));
+  pthread_mutex_init(&server.lock, NULL);
+  CHECK(net_listen_unix(path, NULL, &server.listener));
+  CHECK(pthread_create(&server.thread, NULL, test_listener_main, &server) ==
+        0);
+
+  char url[128];
+  snprintf(url, sizeof(url), "ws+unix://%s:/ws", path);
+  struct ws_standby_options_t opts;
+  ws_standby_options_init(&opts);
+  opts.ping_interval_ms = 50;
+  struct test_state_t state = {0, 0};
+  struct ws_standby_t *standby =
+      ws_standby_create(url, NULL, &opts, on_msg, on_promote, &state);
+  CHECK(standby != NULL);
+  if (standby == NULL) {
+    return;
+  }
+  CHECK(ws_standby_connect(standby));
+  CHECK(state.promoted == 1);
+  RUN_UNTIL(standby, ws_standby_ready(standby));
+  CHECK(ws_standby_ready(standby));
+  CHECK(test_listener_len(&server) == 2);
+
+  byte_array hello = {(uint8_t *)"hello", 5, 5};
+  CHECK(ws_client_write(ws_standby_active(standby), OPCODE_TEXT, hello));
+  RUN_UNTIL(standby, state.received == 1);
+  CHECK(state.received == 1);
+
+  // the server drops the active connection, the first one it accepted.
+  shutdown(server.echos[0].info.socket, SHUT_RDWR);
+  RUN_UNTIL(standby, ws_standby_failovers(standby) == 1);
+  CHECK(ws_standby_failovers(standby) == 1);
+  CHECK(state.promoted == 2);
+  // the promoted standby carries traffic right away.
+  CHECK(ws_client_write(ws_standby_active(standby), OPCODE_TEXT, hello));
+  RUN_UNTIL(standby, state.received == 2);
+  CHECK(state.received == 2);
+  // and a new standby is connected behind it.
+  RUN_UNTIL(standby, ws_standby_ready(standby));
+  CHECK(ws_standby_ready(standby));
+  CHECK(test_listener_len(&server) == 3);
+
+  ws_standby_destroy(&standby);
+  shutdown(server.listener.socket, SHUT_RDWR);
+  pthread_join(server.thread, NULL);
+  for (unsigned int i = 0; i < server.len; ++i) {
+    test_echo_join(&server.echos[i]);
+    CHECK(server.echos[i].upgraded);
+  }
+  net_listener_close(&server.listener);
+  pthread_mutex_destroy(&server.lock);
+}
+
+int main(void) {
+  signal(SIGPIPE, SIG_IGN);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/webc_standby_test_%d.sock", (int)getpid());
+  test_failover(path);
+  unlink(path);
+  return TEST_RESULT();
+}
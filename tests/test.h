@@ -0,0 +1,25 @@
+#ifndef CSTD_WEBSOCKET_TEST_H
+#define CSTD_WEBSOCKET_TEST_H
+
+/**
+ * Minimal helpers shared by the test programs.
+ * Every test is a standalone program, a failed check is reported and the
+ * program exits non-zero once all checks ran.
+ */
+
+#include <stdio.h>
+
+static int test_failures = 0;
+
+#define CHECK(expr)                                                            \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,        \
+              #expr);                                                          \
+      ++test_failures;                                                         \
+    }                                                                          \
+  } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+#endif
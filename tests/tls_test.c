@@ -0,0 +1,822 @@
+#include "tests/test.h"
+
+#ifdef WEBC_USE_SSL
+
+#include "headers/tls.h"
+#include "headers/websocket.h"
+#include "tests/echo_server.h"
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define TEST_URL "ws://localhost:3000/ws"
+#define BIG_LEN 70000
+
+static char key_file[] = "/tmp/webc_tls_test_key_XXXXXX";
+static char cert_file[] = "/tmp/webc_tls_test_cert_XXXXXX";
+
+/**
+ * Write a self-signed localhost certificate and its key to the temp files.
+ */
+static bool test_write_cert() {
+  EVP_PKEY *pkey = EVP_EC_gen("P-256");
+  X509 *x509 = X509_new();
+  bool ok = pkey != NULL && x509 != NULL;
+  if (ok) {
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME *name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    ok = X509_sign(x509, pkey, EVP_sha256()) > 0;
+  }
+  const int key_fd = mkstemp(key_file);
+  const int cert_fd = mkstemp(cert_file);
+  FILE *key = key_fd != -1 ? fdopen(key_fd, "w") : NULL;
+  FILE *cert = cert_fd != -1 ? fdopen(cert_fd, "w") : NULL;
+  ok = ok && key != NULL && cert != NULL &&
+       PEM_write_PrivateKey(key, pkey, NULL, NULL, 0, NULL, NULL) == 1 &&
+       PEM_write_X509(cert, x509) == 1;
+  if (key != NULL) {
+    fclose(key);
+  }
+  if (cert != NULL) {
+    fclose(cert);
+  }
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+  return ok;
+}
+
+/**
+ * Move the pending output of one engine into the other.
+ */
+static void test_shuttle(struct tls_engine_t *from, struct tls_engine_t *to) {
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = tls_engine_take(from, buf, sizeof(buf))) > 0) {
+    CHECK(tls_engine_feed(to, buf, n));
+  }
+}
+
+static void test_read_keeps_close(struct net_tls_ctx_t *client_ctx,
+                                  struct net_tls_ctx_t *server_ctx) {
+  struct tls_engine_t *client = tls_engine_create_client(client_ctx, NULL);
+  struct tls_engine_t *server = tls_engine_create_server(server_ctx);
+  CHECK(client != NULL && server != NULL);
+  if (client == NULL || server == NULL) {
+    tls_engine_destroy(&client);
+    tls_engine_destroy(&server);
+    return;
+  }
+  for (int i = 0; i < 10 && !(tls_engine_is_ready(client) &&
+                              tls_engine_is_ready(server));
+       ++i) {
+    CHECK(tls_engine_handshake(client) != -1);
+    test_shuttle(client, server);
+    CHECK(tls_engine_handshake(server) != -1);
+    test_shuttle(server, client);
+  }
+  CHECK(tls_engine_is_ready(client) && tls_engine_is_ready(server));
+
+  // data and the close_notify arrive together.
+  CHECK(tls_engine_write(server, "abc", 3) == 3);
+  tls_engine_shutdown(server);
+  test_shuttle(server, client);
+  char buf[64];
+  CHECK(tls_engine_read(client, buf, sizeof(buf)) == 3);
+  CHECK(memcmp(buf, "abc", 3) == 0);
+  CHECK(ERR_peek_error() == 0);
+  CHECK(tls_engine_peek(client, buf, sizeof(buf)) == 0);
+  CHECK(tls_engine_read(client, buf, sizeof(buf)) == 0);
+  tls_engine_destroy(&client);
+  tls_engine_destroy(&server);
+}
+
+/**
+ * Create a pipe with a TLS engine on both ends and an echo server on the
+ * server end.
+ */
+static bool test_tls_pipe(struct net_tls_ctx_t *client_ctx,
+                          struct net_tls_ctx_t *server_ctx,
+                          struct net_info_t *client_end,
+                          struct test_echo_t *echo) {
+  if (!net_pipe(client_end, &echo->info)) {
+    return false;
+  }
+  struct tls_engine_t *client = tls_engine_create_client(client_ctx, NULL);
+  struct tls_engine_t *server = tls_engine_create_server(server_ctx);
+  if (client == NULL || server == NULL ||
+      !tls_engine_wrap(client_end, client)) {
+    tls_engine_destroy(&client);
+    tls_engine_destroy(&server);
+    return false;
+  }
+  if (!tls_engine_wrap(&echo->info, server)) {
+    tls_engine_destroy(&server);
+    return false;
+  }
+  return test_echo_start(echo);
+}
+
+static void test_echo(struct net_tls_ctx_t *client_ctx,
+                      struct net_tls_ctx_t *server_ctx) {
+  struct net_info_t client_end;
+  struct test_echo_t echo;
+  memset(&echo, 0, sizeof(struct test_echo_t));
+  CHECK(test_tls_pipe(client_ctx, server_ctx, &client_end, &echo));
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(TEST_URL, strlen(TEST_URL), &client));
+  CHECK(ws_client_upgrade(&client, &client_end));
+
+  static uint8_t big[BIG_LEN];
+  for (size_t i = 0; i < BIG_LEN; ++i) {
+    big[i] = (uint8_t)(i * 13);
+  }
+  byte_array hello = {(uint8_t *)"hello", 5, 5};
+  byte_array body = {big, BIG_LEN, BIG_LEN};
+  CHECK(ws_client_write(&client, OPCODE_TEXT, hello));
+  // spans several TLS records sent with one pipe write.
+  CHECK(ws_client_write(&client, OPCODE_BIN, body));
+  struct ws_message_t *msg = NULL;
+  CHECK(ws_client_next_msg(&client, &msg) && msg != NULL);
+  if (msg != NULL) {
+    CHECK(msg->type == OPCODE_TEXT && msg->body.len == 5 &&
+          memcmp(msg->body.byte_data, "hello", 5) == 0);
+    ws_message_free(msg);
+    free(msg);
+    msg = NULL;
+  }
+  CHECK(ws_client_next_msg(&client, &msg) && msg != NULL);
+  if (msg != NULL) {
+    CHECK(msg->type == OPCODE_BIN && msg->body.len == BIG_LEN &&
+          memcmp(msg->body.byte_data, big, BIG_LEN) == 0);
+    ws_message_free(msg);
+    free(msg);
+  }
+  // sends a close_notify, the server sees the end of the stream.
+  ws_client_free(&client);
+  test_echo_join(&echo);
+  CHECK(echo.upgraded);
+  CHECK(echo.messages == 2);
+}
+
+static bool on_msg(struct ws_client_t *client, struct ws_message_t *msg,
+                   void *context) {
+  (void)client;
+  unsigned int *received = context;
+  CHECK(msg->type == OPCODE_TEXT && msg->body.len == 4 &&
+        memcmp(msg->body.byte_data, "ping", 4) == 0);
+  ++*received;
+  return true;
+}
+
+static void test_echo_nonblocking(struct net_tls_ctx_t *client_ctx,
+                                  struct net_tls_ctx_t *server_ctx) {
+  struct net_info_t client_end;
+  struct test_echo_t echo;
+  memset(&echo, 0, sizeof(struct test_echo_t));
+  CHECK(test_tls_pipe(client_ctx, server_ctx, &client_end, &echo));
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(TEST_URL, strlen(TEST_URL), &client));
+  CHECK(ws_client_upgrade(&client, &client_end));
+  CHECK(ws_client_set_nonblocking(&client, true));
+
+  unsigned int received = 0;
+  // nothing was sent yet, the read would block.
+  CHECK(ws_client_process(&client, on_msg, &received) == WS_CLIENT_OK);
+  CHECK(received == 0);
+  byte_array ping = {(uint8_t *)"ping", 4, 4};
+  CHECK(ws_client_write(&client, OPCODE_TEXT, ping));
+  for (int i = 0; i < 1000 && received == 0; ++i) {
+    CHECK(ws_client_process(&client, on_msg, &received) == WS_CLIENT_OK);
+    usleep(1000);
+  }
+  CHECK(received == 1);
+  ws_client_free(&client);
+  test_echo_join(&echo);
+  CHECK(echo.messages == 1);
+}
+
+/**
+ * Loopback TLS server answering every connection with one byte and keeping
+ * what the client sent until it closed. Each connection gets a thread so a
+ * client can keep one open while making the next.
+ */
+struct test_tls_server_t {
+  struct net_listener_t listener;
+  pthread_t thread;
+  char port[8];
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  unsigned int active;
+  /**
+   * Close the next connection without a handshake, needs defer_handshake.
+   */
+  bool fail_next;
+  char received[64];
+  size_t received_len;
+};
+
+struct test_tls_conn_t {
+  struct test_tls_server_t *server;
+  struct net_info_t info;
+  bool fail;
+};
+
+static void *test_tls_conn_main(void *arg) {
+  struct test_tls_conn_t *conn = arg;
+  struct test_tls_server_t *server = conn->server;
+  if (!conn->fail && net_handshake(&conn->info, 0) &&
+      net_write(&conn->info, "x", 1) == 1) {
+    char buf[64];
+    ssize_t n;
+    while ((n = net_read(&conn->info, buf, sizeof(buf))) > 0) {
+      pthread_mutex_lock(&server->lock);
+      const size_t room = sizeof(server->received) - server->received_len;
+      const size_t len = (size_t)n < room ? (size_t)n : room;
+      memcpy(&server->received[server->received_len], buf, len);
+      server->received_len += len;
+      pthread_mutex_unlock(&server->lock);
+    }
+  }
+  net_close(&conn->info);
+  free(conn);
+  pthread_mutex_lock(&server->lock);
+  --server->active;
+  pthread_cond_broadcast(&server->cond);
+  pthread_mutex_unlock(&server->lock);
+  return NULL;
+}
+
+static void *test_tls_server_main(void *arg) {
+  struct test_tls_server_t *server = arg;
+  while (true) {
+    struct test_tls_conn_t *conn = malloc(sizeof(struct test_tls_conn_t));
+    if (conn == NULL) {
+      break;
+    }
+    if (net_accept(&server->listener, &conn->info) != 1) {
+      free(conn);
+      break;
+    }
+    conn->server = server;
+    pthread_mutex_lock(&server->lock);
+    conn->fail = server->fail_next;
+    server->fail_next = false;
+    ++server->active;
+    pthread_mutex_unlock(&server->lock);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, test_tls_conn_main, conn) != 0) {
+      conn->fail = true;
+      test_tls_conn_main(conn);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+/**
+ * Listen on every IPv4 address, 127.0.0.x hosts are separate cache keys.
+ */
+static bool test_tls_server_start(struct test_tls_server_t *server,
+                                  struct net_tls_ctx_t *tls_ctx,
+                                  bool defer_handshake) {
+  memset(server, 0, sizeof(struct test_tls_server_t));
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_cond_init(&server->cond, NULL);
+  struct net_listen_options_t opts;
+  net_listen_options_init(&opts);
+  opts.tls_ctx = tls_ctx;
+  opts.defer_handshake = defer_handshake;
+  if (!net_listen("0.0.0.0", "0", &opts, &server->listener)) {
+    return false;
+  }
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(server->listener.socket, (struct sockaddr *)&addr,
+                  &addr_len) == -1) {
+    net_listener_close(&server->listener);
+    return false;
+  }
+  snprintf(server->port, sizeof(server->port), "%d", ntohs(addr.sin_port));
+  return pthread_create(&server->thread, NULL, test_tls_server_main, server) ==
+         0;
+}
+
+/**
+ * Wait until every connection so far was closed by its client.
+ */
+static void test_tls_server_idle(struct test_tls_server_t *server) {
+  pthread_mutex_lock(&server->lock);
+  while (server->active > 0) {
+    pthread_cond_wait(&server->cond, &server->lock);
+  }
+  pthread_mutex_unlock(&server->lock);
+}
+
+static void test_tls_server_stop(struct test_tls_server_t *server) {
+  shutdown(server->listener.socket, SHUT_RDWR);
+  pthread_join(server->thread, NULL);
+  test_tls_server_idle(server);
+  net_listener_close(&server->listener);
+  pthread_mutex_destroy(&server->lock);
+  pthread_cond_destroy(&server->cond);
+}
+
+/**
+ * Connect, read the server's byte, which also takes in TLS 1.3 tickets,
+ * and close.
+ *
+ * @return 1 if the session was resumed, 0 if not, -1 if the connect failed.
+ */
+static int test_tls_visit(struct net_tls_ctx_t *tls_ctx, const char *host,
+                          const char *port) {
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = tls_ctx;
+  struct net_info_t info;
+  if (!net_connect_with(host, port, &opts, &info)) {
+    return -1;
+  }
+  char byte = 0;
+  CHECK(net_read(&info, &byte, 1) == 1 && byte == 'x');
+  const int result = net_session_resumed(&info) ? 1 : 0;
+  net_close(&info);
+  return result;
+}
+
+static void test_session_cache(struct net_tls_ctx_t *server_ctx) {
+  struct test_tls_server_t server;
+  CHECK(test_tls_server_start(&server, server_ctx, true));
+  struct net_tls_ctx_t *tls13 = net_tls_ctx_create_client(cert_file, NULL);
+  struct net_tls_ctx_t *tls12 = net_tls_ctx_create_client(cert_file, NULL);
+  CHECK(tls13 != NULL && tls12 != NULL);
+  if (tls13 == NULL || tls12 == NULL) {
+    net_tls_ctx_destroy(&tls13);
+    net_tls_ctx_destroy(&tls12);
+    test_tls_server_stop(&server);
+    return;
+  }
+  SSL_CTX_set_max_proto_version(net_tls_ctx_get(tls12), TLS1_2_VERSION);
+  const char *port = server.port;
+
+  // TLS 1.3 tickets are used once, the resumed connection brings new ones.
+  CHECK(test_tls_visit(tls13, "127.0.0.1", port) == 0);
+  CHECK(test_tls_visit(tls13, "127.0.0.1", port) == 1);
+  CHECK(test_tls_visit(tls13, "127.0.0.1", port) == 1);
+  // a connection that didn't read yet holds the only ticket, the next one
+  // gets none.
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = tls13;
+  struct net_info_t info;
+  CHECK(net_connect_with("127.0.0.1", port, &opts, &info));
+  CHECK(net_session_resumed(&info));
+  CHECK(test_tls_visit(tls13, "127.0.0.1", port) == 0);
+  net_close(&info);
+
+  // TLS 1.2 sessions stay cached after resuming.
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == 0);
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == 1);
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == 1);
+
+  // a failed handshake drops the session it offered.
+  pthread_mutex_lock(&server.lock);
+  server.fail_next = true;
+  pthread_mutex_unlock(&server.lock);
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == -1);
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == 0);
+
+  // fill the cache with 127.0.0.1 as the oldest entry, then use it again
+  // so 127.0.0.2 is the least recently used one.
+  char host[32];
+  for (int i = 2; i <= NET_SESSION_CACHE_SIZE; ++i) {
+    snprintf(host, sizeof(host), "127.0.0.%d", i);
+    CHECK(test_tls_visit(tls12, host, port) == 0);
+  }
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == 1);
+  snprintf(host, sizeof(host), "127.0.0.%d", NET_SESSION_CACHE_SIZE + 1);
+  CHECK(test_tls_visit(tls12, host, port) == 0);
+  // only the least recently used entry went.
+  CHECK(test_tls_visit(tls12, "127.0.0.1", port) == 1);
+  CHECK(test_tls_visit(tls12, "127.0.0.3", port) == 1);
+  CHECK(test_tls_visit(tls12, "127.0.0.2", port) == 0);
+
+  net_tls_ctx_destroy(&tls13);
+  net_tls_ctx_destroy(&tls12);
+  test_tls_server_stop(&server);
+}
+
+/**
+ * Connect with early data, send the request and read the server's byte.
+ *
+ * @return The early data status of the connection, -1 on failure.
+ */
+static int test_early_visit(struct net_tls_ctx_t *tls_ctx, const char *port,
+                            bool *resumed) {
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = tls_ctx;
+  opts.early_data = true;
+  struct net_info_t info;
+  if (!net_connect_with("127.0.0.1", port, &opts, &info)) {
+    return -1;
+  }
+  int result = -1;
+  char byte = 0;
+  if (net_write(&info, "hello", 5) == 5 && net_read(&info, &byte, 1) == 1 &&
+      byte == 'x') {
+    result = SSL_get_early_data_status(info.ssl);
+    *resumed = net_session_resumed(&info);
+  }
+  net_close(&info);
+  return result;
+}
+
+/**
+ * Take what the server received since the last call.
+ */
+static size_t test_tls_server_take(struct test_tls_server_t *server,
+                                   char *buf, size_t buf_len) {
+  test_tls_server_idle(server);
+  pthread_mutex_lock(&server->lock);
+  const size_t len =
+      server->received_len < buf_len ? server->received_len : buf_len;
+  memcpy(buf, server->received, len);
+  server->received_len = 0;
+  pthread_mutex_unlock(&server->lock);
+  return len;
+}
+
+static void test_early_data() {
+  struct net_tls_ctx_t *server_ctx =
+      net_tls_ctx_create_server(key_file, cert_file);
+  struct net_tls_ctx_t *client_ctx = net_tls_ctx_create_client(cert_file, NULL);
+  CHECK(server_ctx != NULL && client_ctx != NULL);
+  if (server_ctx == NULL || client_ctx == NULL) {
+    net_tls_ctx_destroy(&client_ctx);
+    net_tls_ctx_destroy(&server_ctx);
+    return;
+  }
+  CHECK(net_tls_ctx_set_early_data(server_ctx, 16384));
+  struct test_tls_server_t server;
+  CHECK(test_tls_server_start(&server, server_ctx, false));
+  char received[64];
+
+  // the first connection gets a ticket that allows early data.
+  CHECK(test_tls_visit(client_ctx, "127.0.0.1", server.port) == 0);
+  bool resumed = false;
+  CHECK(test_early_visit(client_ctx, server.port, &resumed) ==
+        SSL_EARLY_DATA_ACCEPTED);
+  CHECK(resumed);
+  CHECK(test_tls_server_take(&server, received, sizeof(received)) == 5 &&
+        memcmp(received, "hello", 5) == 0);
+
+  // with early data the server keeps its tickets in its session cache,
+  // once it forgot them the client's ticket is as unknown as one from
+  // another context. The early data is rejected and sent again.
+  SSL_CTX_flush_sessions(net_tls_ctx_get(server_ctx), LONG_MAX);
+  resumed = true;
+  CHECK(test_early_visit(client_ctx, server.port, &resumed) ==
+        SSL_EARLY_DATA_REJECTED);
+  CHECK(!resumed);
+  CHECK(test_tls_server_take(&server, received, sizeof(received)) == 5 &&
+        memcmp(received, "hello", 5) == 0);
+
+  test_tls_server_stop(&server);
+  net_tls_ctx_destroy(&client_ctx);
+  net_tls_ctx_destroy(&server_ctx);
+}
+
+/**
+ * Sizes of the application data records a connection sent.
+ */
+struct test_records_sent_t {
+  unsigned int small;
+  unsigned int full;
+  unsigned int other;
+};
+
+static void test_count_record(int write_p, int version, int content_type,
+                              const void *buf, size_t len, SSL *ssl,
+                              void *arg) {
+  (void)version;
+  (void)ssl;
+  if (!write_p || content_type != SSL3_RT_HEADER || len < 5) {
+    return;
+  }
+  const uint8_t *header = buf;
+  const size_t record_len = ((size_t)header[3] << 8) | header[4];
+  struct test_records_sent_t *sent = arg;
+  // the lengths include the content type and the tag.
+  if (record_len <= NET_TLS_SMALL_RECORD + 64) {
+    ++sent->small;
+  } else if (record_len >= SSL3_RT_MAX_PLAIN_LENGTH) {
+    ++sent->full;
+  } else {
+    ++sent->other;
+  }
+}
+
+/**
+ * Write len bytes and return the records they went out in.
+ */
+static struct test_records_sent_t test_write_records(struct net_info_t *info,
+                                                     size_t len) {
+  static uint8_t buf[64 * 1024];
+  struct test_records_sent_t sent = {0, 0, 0};
+  SSL_set_msg_callback(info->ssl, test_count_record);
+  SSL_set_msg_callback_arg(info->ssl, &sent);
+  while (len > 0) {
+    const size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+    const ssize_t n = net_write(info, buf, chunk);
+    CHECK(n > 0);
+    if (n <= 0) {
+      break;
+    }
+    len -= (size_t)n;
+  }
+  SSL_set_msg_callback(info->ssl, NULL);
+  return sent;
+}
+
+static bool test_records_connect(struct net_tls_ctx_t *client_ctx,
+                                 const char *port,
+                                 enum net_tls_records_t mode,
+                                 struct net_info_t *info) {
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = client_ctx;
+  opts.tls_records = mode;
+  if (!net_connect_with("127.0.0.1", port, &opts, info)) {
+    return false;
+  }
+  // finishes the handshake and takes in the tickets.
+  char byte = 0;
+  CHECK(net_read(info, &byte, 1) == 1);
+  return true;
+}
+
+static void test_record_sizes(struct net_tls_ctx_t *client_ctx,
+                              struct net_tls_ctx_t *server_ctx) {
+  struct test_tls_server_t server;
+  CHECK(test_tls_server_start(&server, server_ctx, false));
+  struct net_info_t info;
+  struct test_records_sent_t sent;
+
+  CHECK(test_records_connect(client_ctx, server.port, NET_TLS_RECORDS_FULL,
+                             &info));
+  sent = test_write_records(&info, 64 * 1024);
+  CHECK(sent.full == 4 && sent.small == 0 && sent.other == 0);
+  net_close(&info);
+
+  CHECK(test_records_connect(client_ctx, server.port, NET_TLS_RECORDS_SMALL,
+                             &info));
+  sent = test_write_records(&info, 2 * NET_TLS_BOOST_BYTES);
+  CHECK(sent.full == 0 && sent.other == 0);
+  // every 64 KB write is cut on its own.
+  const unsigned int per_write =
+      (64 * 1024 + NET_TLS_SMALL_RECORD - 1) / NET_TLS_SMALL_RECORD;
+  CHECK(sent.small == (2 * NET_TLS_BOOST_BYTES / (64 * 1024)) * per_write);
+  net_close(&info);
+
+  // small records until a burst reached NET_TLS_BOOST_BYTES, full ones after
+  // that and small ones again once the connection was idle.
+  CHECK(test_records_connect(client_ctx, server.port, NET_TLS_RECORDS_DYNAMIC,
+                             &info));
+  sent = test_write_records(&info, NET_TLS_BOOST_BYTES);
+  CHECK(sent.full == 0 && sent.other == 0 && sent.small > 0);
+  sent = test_write_records(&info, 64 * 1024);
+  CHECK(sent.full == 4 && sent.small == 0 && sent.other == 0);
+  usleep((NET_TLS_IDLE_RESET_MS + 100) * 1000);
+  sent = test_write_records(&info, 64 * 1024);
+  CHECK(sent.full == 0 && sent.small > 0 && sent.other == 0);
+  net_close(&info);
+  test_tls_server_stop(&server);
+}
+
+/**
+ * TLS server sending a few small records and waiting for the client to close.
+ */
+struct test_records_t {
+  struct net_listener_t listener;
+  pthread_t thread;
+};
+
+static void *test_records_main(void *arg) {
+  struct test_records_t *server = arg;
+  struct net_info_t info;
+  if (net_accept(&server->listener, &info) != 1) {
+    return NULL;
+  }
+  const char *records[] = {"a", "b", "c"};
+  for (size_t i = 0; i < sizeof(records) / sizeof(records[0]); ++i) {
+    CHECK(net_write(&info, records[i], 1) == 1);
+  }
+  char buf[16];
+  while (net_read(&info, buf, sizeof(buf)) > 0) {
+  }
+  net_close(&info);
+  return NULL;
+}
+
+static void test_rx_timestamps(struct net_tls_ctx_t *client_ctx,
+                               struct net_tls_ctx_t *server_ctx) {
+  struct test_records_t server;
+  struct net_listen_options_t listen_opts;
+  net_listen_options_init(&listen_opts);
+  listen_opts.tls_ctx = server_ctx;
+  CHECK(net_listen("127.0.0.1", "0", &listen_opts, &server.listener));
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  CHECK(getsockname(server.listener.socket, (struct sockaddr *)&addr,
+                    &addr_len) == 0);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+  CHECK(pthread_create(&server.thread, NULL, test_records_main, &server) == 0);
+
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = client_ctx;
+  opts.rx_timestamps = true;
+  struct net_info_t info;
+  CHECK(net_connect_with("127.0.0.1", port, &opts, &info));
+  char buf[16];
+  size_t received = 0;
+  while (received < 3) {
+    const ssize_t n = net_read(&info, &buf[received], sizeof(buf) - received);
+    CHECK(n > 0);
+    if (n <= 0) {
+      break;
+    }
+    CHECK(info.rx_time.software.tv_sec != 0);
+    received += (size_t)n;
+  }
+  CHECK(received == 3 && memcmp(buf, "abc", 3) == 0);
+  // the peek finds nothing queued and answers for OpenSSL.
+  CHECK(net_set_nonblocking(&info, true));
+  CHECK(net_read(&info, buf, sizeof(buf)) == NET_WOULD_BLOCK);
+  net_close(&info);
+  pthread_join(server.thread, NULL);
+  net_listener_close(&server.listener);
+}
+
+static void test_drain_records(struct net_tls_ctx_t *client_ctx,
+                               struct net_tls_ctx_t *server_ctx) {
+  struct test_records_t server;
+  struct net_listen_options_t listen_opts;
+  net_listen_options_init(&listen_opts);
+  listen_opts.tls_ctx = server_ctx;
+  CHECK(net_listen("127.0.0.1", "0", &listen_opts, &server.listener));
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  CHECK(getsockname(server.listener.socket, (struct sockaddr *)&addr,
+                    &addr_len) == 0);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+  CHECK(pthread_create(&server.thread, NULL, test_records_main, &server) == 0);
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = client_ctx;
+  struct net_info_t info;
+  CHECK(net_connect_with("127.0.0.1", port, &opts, &info));
+  // the three one byte records are all in the socket by then.
+  usleep(100000);
+  char buf[16];
+  // a blocking read returns one record, reading on could block.
+  CHECK(net_read(&info, buf, sizeof(buf)) == 1 && buf[0] == 'a');
+  // a non-blocking one takes every record the socket read brought in.
+  CHECK(net_set_nonblocking(&info, true));
+  CHECK(info.nonblocking);
+  CHECK(net_read(&info, buf, sizeof(buf)) == 2 && memcmp(buf, "bc", 2) == 0);
+  CHECK(net_read(&info, buf, sizeof(buf)) == NET_WOULD_BLOCK);
+  net_close(&info);
+  pthread_join(server.thread, NULL);
+  net_listener_close(&server.listener);
+}
+
+struct test_ktls_t {
+  struct net_listener_t listener;
+  pthread_t thread;
+  bool ktls_option;
+};
+
+/**
+ * Answer a "ping" with a "pong" on one accepted connection.
+ */
+static void *test_ktls_main(void *arg) {
+  struct test_ktls_t *server = arg;
+  struct net_info_t info;
+  if (net_accept(&server->listener, &info) != 1) {
+    return NULL;
+  }
+  if (server->listener.defer_handshake) {
+    CHECK(net_handshake(&info, 1000));
+  }
+  server->ktls_option = (SSL_get_options(info.ssl) & SSL_OP_ENABLE_KTLS) != 0;
+  char buf[4];
+  size_t received = 0;
+  while (received < sizeof(buf)) {
+    const ssize_t n = net_read(&info, &buf[received], sizeof(buf) - received);
+    if (n <= 0) {
+      break;
+    }
+    received += (size_t)n;
+  }
+  CHECK(received == 4 && memcmp(buf, "ping", 4) == 0);
+  CHECK(net_write(&info, "pong", 4) == 4);
+  net_close(&info);
+  return NULL;
+}
+
+static void test_ktls_accept(struct net_tls_ctx_t *client_ctx,
+                             struct net_tls_ctx_t *server_ctx,
+                             bool defer_handshake) {
+  struct test_ktls_t server;
+  memset(&server, 0, sizeof(server));
+  struct net_listen_options_t listen_opts;
+  net_listen_options_init(&listen_opts);
+  listen_opts.tls_ctx = server_ctx;
+  listen_opts.defer_handshake = defer_handshake;
+  listen_opts.ktls = true;
+  CHECK(net_listen("127.0.0.1", "0", &listen_opts, &server.listener));
+  CHECK(server.listener.ktls);
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  CHECK(getsockname(server.listener.socket, (struct sockaddr *)&addr,
+                    &addr_len) == 0);
+  char port[8];
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+  CHECK(pthread_create(&server.thread, NULL, test_ktls_main, &server) == 0);
+
+  // the records go through the kernel where the tls module and OpenSSL
+  // support it, through OpenSSL otherwise. Both have to work.
+  struct net_options_t opts;
+  net_options_init(&opts);
+  opts.tls_ctx = client_ctx;
+  opts.ktls = true;
+  struct net_info_t info;
+  CHECK(net_connect_with("127.0.0.1", port, &opts, &info));
+  CHECK(net_write(&info, "ping", 4) == 4);
+  char buf[4];
+  size_t received = 0;
+  while (received < sizeof(buf)) {
+    const ssize_t n = net_read(&info, &buf[received], sizeof(buf) - received);
+    CHECK(n > 0);
+    if (n <= 0) {
+      break;
+    }
+    received += (size_t)n;
+  }
+  CHECK(received == 4 && memcmp(buf, "pong", 4) == 0);
+  net_close(&info);
+  pthread_join(server.thread, NULL);
+  CHECK(server.ktls_option);
+  net_listener_close(&server.listener);
+}
+
+int main(void) {
+  signal(SIGPIPE, SIG_IGN);
+  CHECK(test_write_cert());
+  struct net_tls_ctx_t *server_ctx =
+      net_tls_ctx_create_server(key_file, cert_file);
+  // trusts the test certificate and verifies the server.
+  struct net_tls_ctx_t *client_ctx = net_tls_ctx_create_client(cert_file, NULL);
+  CHECK(server_ctx != NULL && client_ctx != NULL);
+  if (server_ctx != NULL && client_ctx != NULL) {
+    test_read_keeps_close(client_ctx, server_ctx);
+    test_echo(client_ctx, server_ctx);
+    test_echo_nonblocking(client_ctx, server_ctx);
+    test_rx_timestamps(client_ctx, server_ctx);
+    test_drain_records(client_ctx, server_ctx);
+    test_ktls_accept(client_ctx, server_ctx, false);
+    test_ktls_accept(client_ctx, server_ctx, true);
+    test_session_cache(server_ctx);
+    test_record_sizes(client_ctx, server_ctx);
+    test_early_data();
+  }
+  net_tls_ctx_destroy(&client_ctx);
+  net_tls_ctx_destroy(&server_ctx);
+  unlink(key_file);
+  unlink(cert_file);
+  return TEST_RESULT();
+}
+
+#else
+
+int main(void) { return TEST_RESULT(); }
+
+#endif
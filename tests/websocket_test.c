@@ -0,0 +1,447 @@
+#include "headers/net.h"
+#include "headers/server.h"
+#include "headers/websocket.h"
+#include "tests/echo_server.h"
+#include "tests/test.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_URL "ws://localhost:3000/ws"
+#define BIG_LEN 70000
+
+/**
+ * Server end of a pipe, upgraded on its own thread.
+ */
+struct test_server_t {
+  struct net_info_t info;
+  pthread_t thread;
+  bool ok;
+  byte_array rest;
+};
+
+static void *test_server_main(void *arg) {
+  struct test_server_t *server = arg;
+  server->ok = ws_server_upgrade(&server->info, NULL, &server->rest);
+  return NULL;
+}
+
+/**
+ * Create a pipe and answer the upgrade on the server end.
+ */
+static bool test_server_start(struct test_server_t *server,
+                              struct net_info_t *client_end) {
+  memset(server, 0, sizeof(struct test_server_t));
+  if (!net_pipe(client_end, &server->info)) {
+    return false;
+  }
+  return pthread_create(&server->thread, NULL, test_server_main, server) == 0;
+}
+
+/**
+ * Read exactly len bytes from the server end, starting with the bytes that
+ * came in behind the upgrade request.
+ */
+static bool test_server_read(struct test_server_t *server, uint8_t *buf,
+                             size_t len) {
+  size_t offset = server->rest.len < len ? server->rest.len : len;
+  memcpy(buf, server->rest.byte_data, offset);
+  memmove(server->rest.byte_data, &server->rest.byte_data[offset],
+          server->rest.len - offset);
+  server->rest.len -= offset;
+  while (offset < len) {
+    const ssize_t n = net_read(&server->info, &buf[offset], len - offset);
+    if (n <= 0) {
+      return false;
+    }
+    offset += n;
+  }
+  return true;
+}
+
+static void test_server_stop(struct test_server_t *server) {
+  net_close(&server->info);
+  free(server->rest.byte_data);
+}
+
+static void test_queue_survives_failed_connect() {
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(TEST_URL, strlen(TEST_URL), &client));
+  byte_array body = {(uint8_t *)"subscribe", 9, 9};
+  CHECK(ws_client_queue_msg(&client, OPCODE_TEXT, body));
+
+  // the first attempt fails, the server end is gone.
+  struct net_info_t client_end, server_end;
+  CHECK(net_pipe(&client_end, &server_end));
+  net_close(&server_end);
+  CHECK(!ws_client_upgrade(&client, &client_end));
+  CHECK(ws_client_has_pending(&client));
+
+  // the reconnect sends the queued message right after the 101.
+  struct test_server_t server;
+  CHECK(test_server_start(&server, &client_end));
+  CHECK(ws_client_upgrade(&client, &client_end));
+  pthread_join(server.thread, NULL);
+  CHECK(server.ok);
+  CHECK(!ws_client_has_pending(&client));
+  // masked text frame: 2 header bytes, 4 byte key, 9 byte payload.
+  uint8_t frame[15];
+  CHECK(test_server_read(&server, frame, sizeof(frame)));
+  CHECK(frame[0] == 0x81 && frame[1] == (0x80 | 9));
+  for (size_t i = 0; i < 9; ++i) {
+    frame[6 + i] ^= frame[2 + (i % 4)];
+  }
+  CHECK(memcmp(&frame[6], "subscribe", 9) == 0);
+  test_server_stop(&server);
+  ws_client_free(&client);
+}
+
+static bool test_msg_is(struct ws_message_t *msg, enum ws_opcode_t type,
+                        const uint8_t *body, size_t len) {
+  return msg != NULL && msg->type == type && msg->body.len == len &&
+         (len == 0 || memcmp(msg->body.byte_data, body, len) == 0);
+}
+
+static void test_free_msg(struct ws_message_t **msg) {
+  if (*msg != NULL) {
+    ws_message_free(*msg);
+    free(*msg);
+    *msg = NULL;
+  }
+}
+
+static void test_echo_over_pipe() {
+  struct net_info_t client_end;
+  struct test_echo_t echo;
+  memset(&echo, 0, sizeof(struct test_echo_t));
+  CHECK(net_pipe(&client_end, &echo.info));
+  CHECK(test_echo_start(&echo));
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(TEST_URL, strlen(TEST_URL), &client));
+  CHECK(ws_client_upgrade(&client, &client_end));
+
+  // one message per payload length encoding: 7 bit, 16 bit and 64 bit.
+  static uint8_t big[BIG_LEN];
+  for (size_t i = 0; i < BIG_LEN; ++i) {
+    big[i] = (uint8_t)(i * 31);
+  }
+  const size_t lens[] = {0, 5, 126, BIG_LEN};
+  for (size_t i = 0; i < 4; ++i) {
+    byte_array body = {big, lens[i], lens[i]};
+    CHECK(ws_client_write(&client, OPCODE_BIN, body));
+  }
+  byte_array ping = {(uint8_t *)"beat", 4, 4};
+  CHECK(ws_client_write(&client, OPCODE_PING, ping));
+
+  struct timespec before;
+  clock_gettime(CLOCK_REALTIME, &before);
+  for (size_t i = 0; i < 4; ++i) {
+    struct ws_message_t *msg = NULL;
+    CHECK(ws_client_next_msg(&client, &msg));
+    CHECK(test_msg_is(msg, OPCODE_BIN, big, lens[i]));
+    if (msg != NULL) {
+      // pipes have no kernel timestamps, the dispatch time is always set.
+      CHECK(msg->rx_time.software.tv_sec == 0);
+      CHECK(msg->dispatch_time.tv_sec >= before.tv_sec);
+    }
+    test_free_msg(&msg);
+  }
+  struct ws_message_t *msg = NULL;
+  CHECK(ws_client_next_msg(&client, &msg));
+  CHECK(test_msg_is(msg, OPCODE_PONG, (const uint8_t *)"beat", 4));
+  test_free_msg(&msg);
+
+  byte_array bye = {(uint8_t *)"bye", 3, 3};
+  CHECK(ws_client_write(&client, OPCODE_CLOSE, bye));
+  CHECK(ws_client_next_msg(&client, &msg));
+  CHECK(test_msg_is(msg, OPCODE_CLOSE, (const uint8_t *)"bye", 3));
+  test_free_msg(&msg);
+  test_echo_join(&echo);
+  CHECK(echo.upgraded);
+  CHECK(echo.messages == 6);
+  ws_client_free(&client);
+}
+
+/**
+ * Append an unmasked frame, the server side of the wire.
+ */
+static void test_append_frame(byte_array *out, uint8_t flags_opcode,
+                              const char *body) {
+  uint8_t key[4] = {0};
+  CHECK(ws_frame_append(out, flags_opcode, false, key, (uint8_t *)body,
+                        strlen(body)) == WS_FRAME_SUCCESS);
+}
+
+static void test_reader_fragments() {
+  byte_array wire;
+  memset(&wire, 0, sizeof(byte_array));
+  // a fragmented text message with a ping in the middle, then a whole one.
+  test_append_frame(&wire, OPCODE_TEXT, "frag");
+  test_append_frame(&wire, WS_FRAME_FIN | OPCODE_PING, "p");
+  test_append_frame(&wire, OPCODE_CONT, "men");
+  test_append_frame(&wire, WS_FRAME_FIN | OPCODE_CONT, "ted");
+  test_append_frame(&wire, WS_FRAME_FIN | OPCODE_TEXT, "whole");
+
+  // the same bytes through the pipe and fed one byte at a time.
+  struct net_info_t a, b;
+  CHECK(net_pipe(&a, &b));
+  CHECK(net_write(&a, wire.byte_data, wire.len) == (ssize_t)wire.len);
+  net_close(&a);
+  struct ws_reader_t *from_pipe = ws_reader_create();
+  struct ws_reader_t *from_bytes = ws_reader_create();
+  CHECK(from_pipe != NULL && from_bytes != NULL);
+  if (from_pipe == NULL || from_bytes == NULL) {
+    return;
+  }
+  CHECK(ws_reader_handle(from_pipe, &b));
+  for (size_t i = 0; i < wire.len; ++i) {
+    CHECK(ws_reader_feed(from_bytes, &wire.byte_data[i], 1));
+  }
+  struct ws_reader_t *readers[] = {from_pipe, from_bytes};
+  for (size_t i = 0; i < 2; ++i) {
+    struct ws_message_t *msg = ws_reader_next_msg(readers[i]);
+    CHECK(test_msg_is(msg, OPCODE_PING, (const uint8_t *)"p", 1));
+    test_free_msg(&msg);
+    msg = ws_reader_next_msg(readers[i]);
+    CHECK(test_msg_is(msg, OPCODE_TEXT, (const uint8_t *)"fragmented", 10));
+    test_free_msg(&msg);
+    msg = ws_reader_next_msg(readers[i]);
+    CHECK(test_msg_is(msg, OPCODE_TEXT, (const uint8_t *)"whole", 5));
+    test_free_msg(&msg);
+    CHECK(ws_reader_next_msg(readers[i]) == NULL);
+  }
+  // the writer closed, no more messages come.
+  CHECK(ws_reader_fill(from_pipe, &b) == 0);
+  ws_reader_destroy(&from_pipe);
+  ws_reader_destroy(&from_bytes);
+  net_close(&b);
+  free(wire.byte_data);
+}
+
+/**
+ * Pipe end whose writes take at most budget bytes, like a socket buffer
+ * that fills up.
+ */
+struct test_choke_t {
+  struct net_info_t pipe;
+  size_t budget;
+};
+
+static ssize_t test_choke_peek(struct net_info_t *info, void *buf,
+                               size_t buf_len) {
+  struct test_choke_t *choke = info->transport_data;
+  return net_peek(&choke->pipe, buf, buf_len);
+}
+
+static ssize_t test_choke_read(struct net_info_t *info, void *buf,
+                               size_t buf_len) {
+  struct test_choke_t *choke = info->transport_data;
+  return net_read(&choke->pipe, buf, buf_len);
+}
+
+static ssize_t test_choke_write(struct net_info_t *info, const void *buf,
+                                size_t buf_len) {
+  struct test_choke_t *choke = info->transport_data;
+  if (choke->budget == 0) {
+    return NET_WOULD_BLOCK;
+  }
+  const size_t n = buf_len < choke->budget ? buf_len : choke->budget;
+  const ssize_t written = net_write(&choke->pipe, buf, n);
+  if (written > 0) {
+    choke->budget -= written;
+  }
+  return written;
+}
+
+static bool test_choke_set_nonblocking(struct net_info_t *info, bool enable) {
+  struct test_choke_t *choke = info->transport_data;
+  return net_set_nonblocking(&choke->pipe, enable);
+}
+
+static void test_choke_close(struct net_info_t *info) {
+  struct test_choke_t *choke = info->transport_data;
+  net_close(&choke->pipe);
+}
+
+static const struct net_transport_t test_choke_transport = {
+    .name = "choke",
+    .peek = test_choke_peek,
+    .read = test_choke_read,
+    .write = test_choke_write,
+    .set_nonblocking = test_choke_set_nonblocking,
+    .close = test_choke_close,
+};
+
+static bool on_echo(struct ws_client_t *client, struct ws_message_t *msg,
+                    void *context) {
+  (void)client;
+  unsigned int *received = context;
+  if (*received == 0) {
+    CHECK(msg->type == OPCODE_BIN && msg->body.len == BIG_LEN);
+  } else {
+    CHECK(test_msg_is(msg, OPCODE_TEXT, (const uint8_t *)"hello", 5));
+  }
+  CHECK(msg->dispatch_time.tv_sec > 0);
+  ++*received;
+  return true;
+}
+
+static void test_pending_flush() {
+  struct test_choke_t choke;
+  struct test_echo_t echo;
+  memset(&choke, 0, sizeof(struct test_choke_t));
+  memset(&echo, 0, sizeof(struct test_echo_t));
+  CHECK(net_pipe(&choke.pipe, &echo.info));
+  CHECK(test_echo_start(&echo));
+  struct net_info_t client_end;
+  memset(&client_end, 0, sizeof(struct net_info_t));
+  client_end.socket = -1;
+  client_end.transport = &test_choke_transport;
+  client_end.transport_data = &choke;
+  choke.budget = SIZE_MAX;
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(TEST_URL, strlen(TEST_URL), &client));
+  CHECK(ws_client_upgrade(&client, &client_end));
+  CHECK(ws_client_set_nonblocking(&client, true));
+
+  // the first write is cut short, the rest waits in the pending buffer.
+  static uint8_t big[BIG_LEN];
+  memset(big, 0x5a, sizeof(big));
+  choke.budget = 100;
+  byte_array body = {big, BIG_LEN, BIG_LEN};
+  CHECK(ws_client_write(&client, OPCODE_BIN, body));
+  CHECK(ws_client_has_pending(&client));
+  // nothing goes out, later messages queue up behind it.
+  byte_array hello = {(uint8_t *)"hello", 5, 5};
+  CHECK(ws_client_write(&client, OPCODE_TEXT, hello));
+  CHECK(ws_client_has_pending(&client));
+
+  // the buffer drains, both arrive in order and are echoed.
+  choke.budget = SIZE_MAX;
+  unsigned int received = 0;
+  for (int i = 0; i < 1000 && received < 2; ++i) {
+    CHECK(ws_client_process(&client, on_echo, &received) == WS_CLIENT_OK);
+    if (received < 2) {
+      usleep(1000);
+    }
+  }
+  CHECK(!ws_client_has_pending(&client));
+  CHECK(received == 2);
+  ws_client_free(&client);
+  test_echo_join(&echo);
+  CHECK(echo.messages == 2);
+}
+
+static bool on_beat(struct ws_client_t *client, struct ws_message_t *msg,
+                    void *context) {
+  (void)client;
+  unsigned int *received = context;
+  CHECK(test_msg_is(msg, OPCODE_TEXT, (const uint8_t *)"beat", 4));
+  ++*received;
+  return true;
+}
+
+static void test_rx_bytes_idle() {
+  struct net_info_t client_end;
+  struct test_echo_t echo;
+  memset(&echo, 0, sizeof(struct test_echo_t));
+  CHECK(net_pipe(&client_end, &echo.info));
+  CHECK(test_echo_start(&echo));
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(TEST_URL, strlen(TEST_URL), &client));
+  CHECK(ws_client_upgrade(&client, &client_end));
+  CHECK(ws_client_set_nonblocking(&client, true));
+
+  // reads that would block receive nothing and count nothing.
+  const uint64_t before = ws_client_rx_bytes(&client);
+  unsigned int received = 0;
+  for (int i = 0; i < 3; ++i) {
+    CHECK(ws_client_process(&client, on_beat, &received) == WS_CLIENT_OK);
+  }
+  CHECK(received == 0);
+  CHECK(ws_client_rx_bytes(&client) == before);
+
+  byte_array beat = {(uint8_t *)"beat", 4, 4};
+  CHECK(ws_client_write(&client, OPCODE_TEXT, beat));
+  for (int i = 0; i < 1000 && received == 0; ++i) {
+    CHECK(ws_client_process(&client, on_beat, &received) == WS_CLIENT_OK);
+    if (received == 0) {
+      usleep(1000);
+    }
+  }
+  CHECK(received == 1);
+  // a 2 byte header and the 4 byte body.
+  CHECK(ws_client_rx_bytes(&client) == before + 6);
+  ws_client_free(&client);
+  test_echo_join(&echo);
+  CHECK(echo.messages == 1);
+}
+
+/**
+ * Parse a ws+unix URL and check the socket path and request path, NULL
+ * request_path means none was given.
+ */
+static void test_unix_url(const char *url, size_t len, const char *unix_path,
+                          const char *request_path) {
+  struct ws_client_t client;
+  CHECK(ws_client_from_str(url, len, &client));
+  CHECK(client.unix_path != NULL && strcmp(client.unix_path, unix_path) == 0);
+  CHECK(client.host != NULL && strcmp(client.host, "localhost") == 0);
+  if (request_path == NULL) {
+    CHECK(client.path == NULL);
+  } else {
+    CHECK(client.path != NULL && strcmp(client.path, request_path) == 0);
+  }
+  ws_client_free(&client);
+}
+
+static void test_unix_urls() {
+  const char *url = "ws+unix:///tmp/ws.sock:/ws";
+  test_unix_url(url, strlen(url), "/tmp/ws.sock", "/ws");
+  // the request path defaults to "/" in the upgrade request.
+  url = "ws+unix:///tmp/ws.sock";
+  test_unix_url(url, strlen(url), "/tmp/ws.sock", NULL);
+  // only ":/" ends the socket path, the first one wins.
+  url = "ws+unix:///tmp/a:b.sock:/ws?next=ws://host:80/";
+  test_unix_url(url, strlen(url), "/tmp/a:b.sock", "/ws?next=ws://host:80/");
+  url = "ws+unix://relative.sock:/";
+  test_unix_url(url, strlen(url), "relative.sock", "/");
+  // nothing past len is read.
+  url = "ws+unix:///tmp/ws.sock:/ws:/ignored";
+  test_unix_url(url, strlen(url) - strlen(":/ignored"), "/tmp/ws.sock", "/ws");
+
+  struct ws_client_t client;
+  url = "ws+unix://:/ws";
+  CHECK(!ws_client_from_str(url, strlen(url), &client));
+  ws_client_free(&client);
+  url = "ws+unix://";
+  CHECK(!ws_client_from_str(url, strlen(url), &client));
+  ws_client_free(&client);
+
+  // a path that doesn't fit sockaddr_un fails on connect, not on parse.
+  char long_url[256];
+  memset(long_url, 'a', sizeof(long_url));
+  memcpy(long_url, "ws+unix:///", strlen("ws+unix:///"));
+  CHECK(ws_client_from_str(long_url, sizeof(long_url), &client));
+  CHECK(!ws_client_connect(&client));
+  ws_client_free(&client);
+  url = "ws+unix:///nonexistent/webc/ws.sock:/ws";
+  CHECK(ws_client_from_str(url, strlen(url), &client));
+  CHECK(!ws_client_connect(&client));
+  ws_client_free(&client);
+}
+
+int main(void) {
+  signal(SIGPIPE, SIG_IGN);
+  test_queue_survives_failed_connect();
+  test_echo_over_pipe();
+  test_reader_fragments();
+  test_pending_flush();
+  test_rx_bytes_idle();
+  test_unix_urls();
+  return TEST_RESULT();
+}